@@ -0,0 +1,273 @@
+#include "jinsock.h"
+#include "libjinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+// libjinsock entry points (see libjinsock.h): the search core and the
+// handle code the shell uses, with the settings the shell keeps in
+// globals held by a JsCtx, and errors returned instead of printed.
+
+_Static_assert((int)JS_PROTO_UNIX == (int)SOCK_PROTO_UNIX, "JS_PROTO_* mirror SOCK_PROTO_*");
+
+struct JsHandle {
+    SockHandle sock;
+    JsCtx *ctx;
+    JsHandle *prev, *next;
+};
+
+struct JsCtx {
+    int backend;
+    int threads;
+    int timeout_ms;
+    Filter *filter;
+    JsHandle *handles;          // open handles, closed with the context
+    char err[256];
+};
+
+struct JsResults {
+    ResultStore rs;
+};
+
+// Record why the last call failed, returns the matching JS_ERR_* code
+static int js_fail(JsCtx *ctx, const char *what, int err) {
+    snprintf(ctx->err, sizeof(ctx->err), "%s: %s", what, strerror(err));
+    switch (err) {
+        case ENOMEM: return JS_ERR_NOMEM;
+        case EINVAL: return JS_ERR_INVAL;
+        case EPERM:
+        case EACCES: return JS_ERR_PERM;
+        case EBADF:
+        case ENOTSOCK: return JS_ERR_NOSOCK;
+        case ESRCH: return JS_ERR_EXITED;
+        case ESTALE: return JS_ERR_STALE;
+        case ETIMEDOUT: return JS_ERR_TIMEOUT;
+        case EPIPE:
+        case ECONNRESET: return JS_ERR_CLOSED;
+        default: return JS_ERR_IO;
+    }
+}
+
+JsCtx *js_ctx_new(void) {
+    JsCtx *ctx = calloc(1, sizeof(JsCtx));
+    if (!ctx) return NULL;
+    ctx->backend = DISCOVERY_AUTO;
+    ctx->timeout_ms = 5000;
+    return ctx;
+}
+
+void js_ctx_free(JsCtx *ctx) {
+    if (!ctx) return;
+    while (ctx->handles) js_close(ctx->handles);
+    filter_free(ctx->filter);
+    free(ctx);
+}
+
+const char *js_ctx_error(const JsCtx *ctx) {
+    return ctx->err;
+}
+
+const char *js_strerror(int err) {
+    switch (err) {
+        case JS_OK: return "success";
+        case JS_ERR_NOMEM: return "out of memory";
+        case JS_ERR_INVAL: return "invalid argument";
+        case JS_ERR_PERM: return "permission denied";
+        case JS_ERR_NOSOCK: return "not a socket";
+        case JS_ERR_EXITED: return "process exited";
+        case JS_ERR_STALE: return "fd refers to another socket";
+        case JS_ERR_TIMEOUT: return "timed out";
+        case JS_ERR_CLOSED: return "connection closed";
+        case JS_ERR_IO: return "system error";
+        default: return "unknown error";
+    }
+}
+
+int js_set_backend(JsCtx *ctx, const char *name) {
+    int b = name ? parse_backend(name) : -1;
+    if (b < 0) {
+        snprintf(ctx->err, sizeof(ctx->err), "unknown backend '%s'", name ? name : "");
+        return JS_ERR_INVAL;
+    }
+    ctx->backend = b;
+    return JS_OK;
+}
+
+int js_set_threads(JsCtx *ctx, int threads) {
+    if (threads < 0) return js_fail(ctx, "threads", EINVAL);
+    ctx->threads = threads;
+    return JS_OK;
+}
+
+int js_set_filter(JsCtx *ctx, const char *expr) {
+    Filter *f = NULL;
+    if (expr && *expr) {
+        char err[128] = "";
+        f = filter_compile(expr, err, sizeof(err));
+        if (!f) {
+            snprintf(ctx->err, sizeof(ctx->err), "filter: %s", err);
+            return JS_ERR_INVAL;
+        }
+    }
+    filter_free(ctx->filter);
+    ctx->filter = f;
+    return JS_OK;
+}
+
+int js_set_timeout(JsCtx *ctx, int ms) {
+    if (ms < 0) return js_fail(ctx, "timeout", EINVAL);
+    ctx->timeout_ms = ms;
+    return JS_OK;
+}
+
+int js_search(JsCtx *ctx, const char *pattern, JsResults **out) {
+    JsResults *res = calloc(1, sizeof(JsResults));
+    if (!res) return js_fail(ctx, "search", ENOMEM);
+    SearchOpts o = {
+        .pattern = pattern,
+        .filter = ctx->filter,
+        .backend = ctx->backend,
+        .threads = ctx->threads,
+        .format = OUTPUT_TEXT
+    };
+    if (search_run(&o, &res->rs) < 0) {
+        int rv = js_fail(ctx, "search", errno);
+        if (sockdiag_netns_stuck())
+            snprintf(ctx->err, sizeof(ctx->err), "search: calling thread stuck in another network namespace (%s)",
+                     strerror(sockdiag_netns_stuck()));
+        js_results_free(res);
+        return rv;
+    }
+    *out = res;
+    return JS_OK;
+}
+
+size_t js_results_count(const JsResults *res) {
+    return res->rs.count;
+}
+
+int js_results_get(const JsResults *res, size_t i, JsSocket *out) {
+    if (i >= res->rs.count) return JS_ERR_INVAL;
+    const SocketEntry *e = &res->rs.items[i];
+    memset(out, 0, sizeof(*out));
+    out->pid = e->pid;
+    out->fd = e->fd;
+    out->inode = e->inode;
+    out->comm = entry_proc_name(&res->rs, e);
+    out->proto = e->proto;
+    out->state = e->state;
+    out->family = e->local.family ? e->local.family : e->remote.family;
+    out->lport = e->local.port;
+    out->rport = e->remote.port;
+    memcpy(out->laddr, e->local.addr, sizeof(out->laddr));
+    memcpy(out->raddr, e->remote.addr, sizeof(out->raddr));
+    out->path = entry_path(&res->rs, e);
+    out->peer = e->peer;
+    return JS_OK;
+}
+
+int js_results_remote(const JsResults *res, size_t i, char *buf, size_t buflen) {
+    if (i >= res->rs.count || buflen == 0) return JS_ERR_INVAL;
+    format_remote(&res->rs, &res->rs.items[i], buf, buflen);
+    return JS_OK;
+}
+
+void js_results_free(JsResults *res) {
+    if (!res) return;
+    result_store_free(&res->rs);
+    free(res);
+}
+
+int js_open(JsCtx *ctx, pid_t pid, int fd, unsigned long long inode, JsHandle **out) {
+    JsHandle *h = calloc(1, sizeof(JsHandle));
+    if (!h) return js_fail(ctx, "open", ENOMEM);
+    int rv = handle_open(&h->sock, pid, fd, inode);
+    if (rv < 0) {
+        char what[64];
+        snprintf(what, sizeof(what), "PID %d FD %d", pid, fd);
+        free(h);
+        return js_fail(ctx, what, -rv);
+    }
+    h->ctx = ctx;
+    h->next = ctx->handles;
+    if (h->next) h->next->prev = h;
+    ctx->handles = h;
+    *out = h;
+    return JS_OK;
+}
+
+void js_close(JsHandle *h) {
+    if (!h) return;
+    if (h->prev) h->prev->next = h->next;
+    else h->ctx->handles = h->next;
+    if (h->next) h->next->prev = h->prev;
+    handle_close(&h->sock);
+    free(h);
+}
+
+int js_handle_fd(const JsHandle *h) {
+    return h->sock.sockfd;
+}
+
+// Wait until fd is ready for events or deadline (now_ns based) passes.
+// The duplicate shares its file description with the target, which may
+// have made it non-blocking: the I/O below never blocks, it polls.
+static int js_wait(JsHandle *h, short events, long long deadline) {
+    struct pollfd pfd = { .fd = h->sock.sockfd, .events = events };
+    while (1) {
+        long long left = (deadline - now_ns()) / 1000000;
+        if (left <= 0) {
+            snprintf(h->ctx->err, sizeof(h->ctx->err), "timed out waiting for PID %d FD %d", h->sock.pid, h->sock.fd);
+            return JS_ERR_TIMEOUT;
+        }
+        int rv = poll(&pfd, 1, left > INT_MAX ? INT_MAX : (int)left);
+        if (rv > 0) return JS_OK;
+        if (rv < 0 && errno != EINTR) return js_fail(h->ctx, "poll", errno);
+    }
+}
+
+ssize_t js_send(JsHandle *h, const void *buf, size_t len) {
+    long long deadline = now_ns() + h->ctx->timeout_ms * 1000000LL;
+    int dgram = handle_is_dgram(&h->sock);
+    size_t done = 0;
+    do {
+        // MSG_NOSIGNAL: a closed peer is an error code, not a SIGPIPE in the caller
+        ssize_t n = send(h->sock.sockfd, (const char *)buf + done, len - done, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n >= 0) {
+            done += n;
+            if (dgram) break;
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            int rv = js_fail(h->ctx, "send", errno);
+            return done ? (ssize_t)done : rv;
+        }
+        int rv = js_wait(h, POLLOUT, deadline);
+        if (rv < 0) return done ? (ssize_t)done : rv;
+    } while (done < len);
+    return done;
+}
+
+ssize_t js_recv(JsHandle *h, void *buf, size_t buflen, int timeout_ms) {
+    if (buflen == 0) return js_fail(h->ctx, "recv", EINVAL);
+    if (timeout_ms < 0) timeout_ms = h->ctx->timeout_ms;
+    long long deadline = now_ns() + timeout_ms * 1000000LL;
+    while (1) {
+        ssize_t n = recv(h->sock.sockfd, buf, buflen, MSG_DONTWAIT);
+        if (n > 0) return n;
+        if (n == 0) {
+            if (!handle_eof_on_empty(&h->sock)) return 0;      // empty datagram
+            snprintf(h->ctx->err, sizeof(h->ctx->err), "recv: connection closed by peer");
+            return JS_ERR_CLOSED;
+        }
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) return js_fail(h->ctx, "recv", errno);
+        int rv = js_wait(h, POLLIN, deadline);
+        if (rv < 0) return rv;
+    }
+}
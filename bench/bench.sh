@@ -0,0 +1,158 @@
+#!/bin/bash
+# js5 benchmarks: search over a fixture holding N connections, then send
+# (load mode, per-message and batched writes), sendf and rec (both I/O
+# engines, file and non-file output) throughput and latency. Results go to
+# stdout as one JSON document, progress to stderr. Needs root (pidfd_getfd).
+#
+# Environment:
+#   BENCH_CONNS   connection counts to search over, half TCP half UNIX
+#                 (default "1000 10000"; 200000 needs ~400k fds)
+#   BENCH_RUNS    timed runs per search case, min and median kept (default 5)
+#   BENCH_MSGS    messages per send case (default 200000)
+#   BENCH_MSG     message size in bytes (default 1024)
+#   BENCH_BYTES   bytes per sendf/rec case (default 256M as bytes)
+#   BENCH_NETNS   1 (default) runs the fixture in its own network namespace
+#   BENCH_OUT     also write the JSON there
+
+set -u
+cd "$(dirname "$0")/.."
+JS5=./js5
+FIXTURE=bench/fixture
+CONNS=${BENCH_CONNS:-"1000 10000"}
+RUNS=${BENCH_RUNS:-5}
+MSGS=${BENCH_MSGS:-200000}
+MSG=${BENCH_MSG:-1024}
+BYTES=${BENCH_BYTES:-268435456}
+NETNS=${BENCH_NETNS:-1}
+TMP=$(mktemp -d /tmp/js5-bench.XXXXXX)
+trap 'rm -rf "$TMP"' EXIT
+
+results=()
+log() { echo "bench: $*" >&2; }
+now() { date +%s%N; }
+
+# Field that follows "name" in a line of js5 output
+field() { sed -n "s/.*$1 \([0-9.]*\).*/\1/p" | head -1; }
+# Decimal arithmetic on awk, bc isn't everywhere
+calc() { awk "BEGIN { printf \"%.6g\", $1 }"; }
+
+# Start the fixture as a coprocess and parse its ready line
+fixture_start() {
+    local half=$(( $1 / 2 )) flags=""
+    [ "$NETNS" = 1 ] && flags="-n"
+    coproc FIX { exec $FIXTURE $flags -t $half -u $(( $1 - half )); }
+    local ready
+    if ! read -r -t 600 ready <&"${FIX[0]}"; then
+        log "fixture failed to start with $1 connections"
+        return 1
+    fi
+    FPID=$(echo "$ready" | sed 's/.*pid=\([0-9]*\).*/\1/')
+    SINK=$(echo "$ready" | sed 's/.*sink=\([0-9]*\).*/\1/')
+    USINK=$(echo "$ready" | sed 's/.*usink=\([0-9]*\).*/\1/')
+    SOURCE=$(echo "$ready" | sed 's/.*source=\([0-9]*\).*/\1/')
+}
+
+fixture_stop() {
+    eval "exec ${FIX[1]}>&-"
+    wait "$FIX_PID" 2>/dev/null
+}
+
+# search <conns> <backend> <format>: end-to-end time of a js5 process
+bench_search() {
+    local conns=$1 backend=$2 format=$3 times=() found=0 match="PID=$FPID "
+    [ "$format" = jsonl ] && match="\"pid\":$FPID,"
+    for ((r = 0; r < RUNS; r++)); do
+        local t0=$(now)
+        found=$($JS5 -b "$backend" -o "$format" search "$FPID" | grep -c "$match")
+        times+=($(( $(now) - t0 )))
+    done
+    local sorted=($(printf '%s\n' "${times[@]}" | sort -n))
+    local min=${sorted[0]} med=${sorted[$(( RUNS / 2 ))]}
+    log "search $backend/$format $conns conns: min $(( min / 1000000 )) ms, $found sockets"
+    results+=("{\"bench\":\"search\",\"conns\":$conns,\"backend\":\"$backend\",\"format\":\"$format\",\"runs\":$RUNS,\"found\":$found,\"min_s\":$(calc "$min / 1e9"),\"median_s\":$(calc "$med / 1e9")}")
+}
+
+# send <socket name> <fd> <batch>: load mode, throughput and latency
+bench_send() {
+    local sock=$1 fd=$2 batch=$3 payload out
+    payload=$(head -c "$MSG" /dev/zero | tr '\0' x)
+    out=$($JS5 -p "$FPID" -s "$fd" --send "$payload" --repeat "$MSGS" --batch "$batch" 2>/dev/null)
+    local secs=$(echo "$out" | sed -n 's/.* in \([0-9.]*\) s .*/\1/p' | head -1)
+    local mbs=$(echo "$out" | sed -n 's/.*(\([0-9.]*\) MB\/s.*/\1/p' | head -1)
+    local msgs=$(echo "$out" | sed -n 's/.*MB\/s, \([0-9.]*\) msg\/s.*/\1/p' | head -1)
+    local p50=$(echo "$out" | field p50) p99=$(echo "$out" | field p99) max=$(echo "$out" | field max)
+    log "send $sock batch $batch: ${mbs:-?} MB/s, p99 ${p99:-?} us"
+    results+=("{\"bench\":\"send\",\"socket\":\"$sock\",\"batch\":$batch,\"msg_size\":$MSG,\"msgs\":$MSGS,\"seconds\":${secs:-null},\"mb_s\":${mbs:-null},\"msg_s\":${msgs:-null},\"p50_us\":${p50:-null},\"p99_us\":${p99:-null},\"max_us\":${max:-null}}")
+}
+
+# sendf <engine>: a BENCH_BYTES file into the drained TCP sink
+bench_sendf() {
+    local engine=$1 out
+    out=$($JS5 -e "$engine" -p "$FPID" -s "$SINK" --sendf "$TMP/payload" 2>/dev/null)
+    local bytes=$(echo "$out" | field Sent) secs=$(echo "$out" | sed -n 's/.* in \([0-9.]*\) s .*/\1/p')
+    local mbs=null
+    [ -n "$bytes" ] && [ -n "$secs" ] && mbs=$(calc "$bytes / $secs / 1e6")
+    log "sendf $engine: $mbs MB/s"
+    results+=("{\"bench\":\"sendf\",\"engine\":\"$engine\",\"bytes\":${bytes:-null},\"seconds\":${secs:-null},\"mb_s\":$mbs}")
+}
+
+# rec <engine> <output name> <path>: the fixture fills the source socket
+# while js5 captures it; the idle timeout ends the run and isn't counted
+bench_rec() {
+    local engine=$1 sink=$2 path=$3 out filled
+    echo "fill $BYTES" >&"${FIX[1]}"
+    out=$($JS5 -e "$engine" -T 300ms -p "$FPID" -s "$SOURCE" --rec "$path" 2>/dev/null)
+    read -r -t 30 filled <&"${FIX[0]}"
+    local bytes=$(echo "$out" | field Captured) secs=$(echo "$out" | sed -n 's/^Captured .* in \([0-9.]*\) s .*/\1/p')
+    local mbs=null
+    [ -n "$bytes" ] && [ -n "$secs" ] && mbs=$(calc "$bytes / $secs / 1e6")
+    log "rec $engine/$sink: $mbs MB/s"
+    results+=("{\"bench\":\"rec\",\"engine\":\"$engine\",\"output\":\"$sink\",\"bytes\":${bytes:-null},\"seconds\":${secs:-null},\"mb_s\":$mbs}")
+}
+
+if [ "$(id -u)" != 0 ]; then
+    log "needs root to duplicate the fixture's sockets"
+    exit 1
+fi
+[ "$NETNS" = 1 ] && ! unshare -n true 2>/dev/null && { log "no network namespaces, using loopback"; NETNS=0; }
+
+first=1
+for n in $CONNS; do
+    fixture_start "$n" || continue
+    for backend in netlink proc; do
+        for format in text jsonl; do
+            bench_search "$n" "$backend" "$format"
+        done
+    done
+    if [ "$first" = 1 ]; then
+        # The I/O paths don't depend on the connection count: run them once
+        first=0
+        head -c "$BYTES" /dev/zero > "$TMP/payload"
+        for batch in 1 64; do
+            bench_send tcp "$SINK" $batch
+            bench_send unix "$USINK" $batch
+        done
+        for engine in sync uring; do
+            bench_sendf "$engine"
+            bench_rec "$engine" file "$TMP/capture"
+            rm -f "$TMP/capture"
+            bench_rec "$engine" devnull /dev/null
+        done
+        rm -f "$TMP/payload"
+    fi
+    fixture_stop
+done
+
+json=$(
+    printf '{"version":1,"date":"%s","kernel":"%s","cpus":%d,"netns":%s,"results":[\n' \
+        "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -r)" "$(nproc)" "$([ "$NETNS" = 1 ] && echo true || echo false)"
+    sep=""
+    for r in "${results[@]}"; do
+        printf '%s  %s' "$sep" "$r"
+        sep=$',\n'
+    done
+    printf '\n]}\n'
+)
+echo "$json"
+[ -n "${BENCH_OUT:-}" ] && echo "$json" > "$BENCH_OUT"
+exit 0
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+// Benchmark fixture: a process holding many idle connections for js5 to
+// search, plus a few busy ones for the I/O benchmarks.
+//   fixture [-n] [-t TCP] [-u UNIX]
+// -n moves it to a fresh network namespace first (needs root), so the
+// socket tables hold nothing but the fixture. Both ends of every
+// connection live here. Once set up it prints
+//   ready pid=<pid> tcp=<n> unix=<n> sink=<fd> usink=<fd> source=<fd>
+// sink and usink are the client ends of a TCP and a UNIX stream whose
+// other ends are drained continuously: targets for send and sendf.
+// source is the client end of a TCP stream filled on demand: reading
+// "fill <bytes>" on stdin writes that many bytes into it (for rec), then
+// prints "filled <bytes>". Exits at end of stdin.
+
+#define PER_LISTENER 20000      // connections per listening port, well under the ephemeral range
+
+static void *drain(void *arg) {
+    int fd = (int)(long)arg;
+    static char buf[1 << 20];   // contents are discarded, sharing is fine
+    while (read(fd, buf, sizeof(buf)) > 0) ;
+    return NULL;
+}
+
+// lo is down in a new namespace
+static int loopback_up(void) {
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (s < 0) return -1;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    strcpy(ifr.ifr_name, "lo");
+    int rv = ioctl(s, SIOCGIFFLAGS, &ifr);
+    if (rv == 0) {
+        ifr.ifr_flags |= IFF_UP;
+        rv = ioctl(s, SIOCSIFFLAGS, &ifr);
+    }
+    close(s);
+    return rv;
+}
+
+static int tcp_listener(struct sockaddr_in *addr) {
+    int l = socket(AF_INET, SOCK_STREAM, 0);
+    if (l < 0) return -1;
+    socklen_t len = sizeof(*addr);
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(l, (struct sockaddr *)addr, len) < 0 || listen(l, 1024) < 0 ||
+        getsockname(l, (struct sockaddr *)addr, &len) < 0) {
+        close(l);
+        return -1;
+    }
+    return l;
+}
+
+// One connected TCP pair through listener l: *client and *server
+static int tcp_pair(int l, const struct sockaddr_in *addr, int *client, int *server) {
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if (*client < 0) return -1;
+    if (connect(*client, (const struct sockaddr *)addr, sizeof(*addr)) < 0) return -1;
+    *server = accept(l, NULL, NULL);
+    return *server < 0 ? -1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+    long ntcp = 1000, nunix = 1000;
+    int netns = 0, opt;
+    while ((opt = getopt(argc, argv, "nt:u:")) != -1) {
+        switch (opt) {
+            case 'n': netns = 1; break;
+            case 't': ntcp = atol(optarg); break;
+            case 'u': nunix = atol(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n] [-t TCP] [-u UNIX]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (netns && (unshare(CLONE_NEWNET) < 0 || loopback_up() < 0)) {
+        perror("network namespace");
+        return 1;
+    }
+
+    // Two fds per connection, plus slack
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rlim_t want = (rlim_t)(ntcp + nunix) * 2 + 64;
+    if (rl.rlim_cur < want) {
+        rl.rlim_cur = want < rl.rlim_max ? want : rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < want) {
+            fprintf(stderr, "fixture: need %llu fds, limit is %llu\n",
+                    (unsigned long long)want, (unsigned long long)rl.rlim_cur);
+            return 1;
+        }
+    }
+
+    struct sockaddr_in addr;
+    int l = -1, c, s;
+    for (long i = 0; i < ntcp; i++) {
+        // The 4-tuple only has to be unique: a new port every PER_LISTENER
+        // connections keeps clear of ephemeral port exhaustion
+        if (i % PER_LISTENER == 0) {
+            if (l >= 0) close(l);
+            if ((l = tcp_listener(&addr)) < 0) {
+                perror("listen");
+                return 1;
+            }
+        }
+        if (tcp_pair(l, &addr, &c, &s) < 0) {
+            fprintf(stderr, "fixture: tcp connection %ld: %s\n", i, strerror(errno));
+            return 1;
+        }
+    }
+    for (long i = 0; i < nunix; i++) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+            fprintf(stderr, "fixture: unix connection %ld: %s\n", i, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (l >= 0) close(l);
+    if ((l = tcp_listener(&addr)) < 0) {
+        perror("listen");
+        return 1;
+    }
+    int sink, sink_srv, source, source_srv, usv[2];
+    if (tcp_pair(l, &addr, &sink, &sink_srv) < 0 || tcp_pair(l, &addr, &source, &source_srv) < 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, usv) < 0) {
+        perror("busy connections");
+        return 1;
+    }
+    close(l);
+    // A fill nobody reads gives up instead of wedging the next benchmark
+    struct timeval tv = { 5, 0 };
+    setsockopt(source_srv, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    pthread_t t;
+    if (pthread_create(&t, NULL, drain, (void *)(long)sink_srv) != 0 ||
+        pthread_create(&t, NULL, drain, (void *)(long)usv[1]) != 0) {
+        fprintf(stderr, "fixture: cannot start drain threads\n");
+        return 1;
+    }
+
+    printf("ready pid=%d tcp=%ld unix=%ld sink=%d usink=%d source=%d\n",
+           getpid(), ntcp, nunix, sink, usv[0], source);
+    fflush(stdout);
+
+    char line[64], *buf = malloc(1 << 20);
+    if (!buf) return 1;
+    memset(buf, 'x', 1 << 20);
+    while (fgets(line, sizeof(line), stdin)) {
+        long long want_bytes, sent = 0;
+        if (sscanf(line, "fill %lld", &want_bytes) != 1) continue;
+        while (sent < want_bytes) {
+            size_t n = want_bytes - sent < (1 << 20) ? want_bytes - sent : (1 << 20);
+            ssize_t w = write(source_srv, buf, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                perror("fill");
+                break;
+            }
+            sent += w;
+        }
+        printf("filled %lld\n", sent);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,265 @@
+#define _GNU_SOURCE
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <linux/limits.h>
+#include <sys/un.h>
+
+// bridge: put a duplicated stream socket behind a local listener, so any
+// client (curl, redis-cli, psql...) can drive the connection. Bytes move
+// both ways with splice(2) through one pipe per direction and never enter
+// userspace. A full pipe stops reading from its source, so a slow side
+// holds the other back through the kernel's own flow control.
+//
+// The duplicate shares its file description with the owner: it can't be
+// made non-blocking, so it is only read after poll says so, and a write
+// into it waits for room like send does. Clients come one at a time until
+// Ctrl-C or until the stolen connection is closed by its peer; a client
+// leaving never closes or shuts down the stolen socket.
+
+#define BRIDGE_PIPE (1 << 20)       // per direction, asked for
+#define BRIDGE_WRITE (256 * 1024)   // at most per splice into the stolen socket
+
+typedef struct {
+    int from, to;
+    int pipefd[2];
+    size_t cap;                 // pipe capacity, as F_GETPIPE_SZ reports it
+    size_t pending;             // in the pipe, read from `from`, not yet in `to`
+    int full;                   // a fill found no room: wait for a drain
+    int eof;
+    long long bytes;            // delivered to `to`, this client
+} BridgeDir;
+
+static volatile sig_atomic_t bridge_interrupted;
+
+static void bridge_sigint(int sig) {
+    (void)sig;
+    bridge_interrupted = 1;
+}
+
+// The resize may be refused (pipe-max-size, per-user pipe quota): the
+// loop goes by the size the pipe really got
+static int bridge_pipe(BridgeDir *d) {
+    if (pipe2(d->pipefd, O_CLOEXEC | O_NONBLOCK) < 0) return -1;
+    fcntl(d->pipefd[1], F_SETPIPE_SZ, BRIDGE_PIPE);
+    int cap = fcntl(d->pipefd[1], F_GETPIPE_SZ);
+    if (cap <= 0) return -1;
+    d->cap = cap;
+    return 0;
+}
+
+// Move what the source has ready into the pipe. 0 on EOF, -1 on error.
+static ssize_t bridge_fill(BridgeDir *d) {
+    long long t0 = prof_begin();
+    ssize_t n = splice(d->from, NULL, d->pipefd[1], NULL, d->cap - d->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    prof_end(PROF_SPLICE, t0, n);
+    if (n > 0) d->pending += n;
+    else if (n == 0) d->eof = 1;
+    // Pipe slots are pages, so small segments fill it before pending
+    // reaches cap; reading again before a drain would spin on EAGAIN
+    else if (errno == EAGAIN && d->pending) d->full = 1;
+    return n;
+}
+
+// Move the pipe into the destination, as far as it takes without waiting
+// (the client) or up to BRIDGE_WRITE (the stolen socket)
+static ssize_t bridge_drain(BridgeDir *d, size_t max) {
+    size_t len = d->pending < max ? d->pending : max;
+    // MSG_MORE only while the pipe holds more than this call moves: a
+    // reply's last segment must leave now, not when the cork timer fires
+    unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+    if (d->pending > len) flags |= SPLICE_F_MORE;
+    long long t0 = prof_begin();
+    ssize_t n = splice(d->pipefd[0], NULL, d->to, NULL, len, flags);
+    prof_end(PROF_SPLICE, t0, n);
+    if (n > 0) {
+        d->pending -= n;
+        d->bytes += n;
+        d->full = 0;
+    }
+    return n;
+}
+
+static int bridge_listen(const char *addr, struct sockaddr_storage *ss, socklen_t *len) {
+    char buf[128];
+    // A bare port listens on loopback
+    if (addr[strspn(addr, "0123456789")] == 0) {
+        snprintf(buf, sizeof(buf), "127.0.0.1:%s", addr);
+        addr = buf;
+    }
+    if (parse_sockaddr(addr, ss, len) < 0) {
+        fprintf(stderr, "Invalid listen address: %s\n", addr);
+        return -1;
+    }
+    int l = socket(ss->ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (l < 0) {
+        perror("socket");
+        return -1;
+    }
+    int one = 1;
+    if (ss->ss_family != AF_UNIX) setsockopt(l, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(l, (struct sockaddr *)ss, *len) < 0 || listen(l, 1) < 0) {
+        perror(addr);
+        close(l);
+        return -1;
+    }
+    return l;
+}
+
+// Shuttle bytes between one client and the stolen socket until either
+// side is done. Returns 1 when the stolen connection has ended, 0 when
+// only the client has, -1 on Ctrl-C.
+static int bridge_session(const SockHandle *h, int client, BridgeDir *up, BridgeDir *down) {
+    // down: stolen -> client, up: client -> stolen
+    down->from = up->to = h->sockfd;
+    down->to = up->from = client;
+    down->bytes = up->bytes = 0;
+    up->eof = 0;
+    int done = 0, ret = 0;
+    while (!done) {
+        // Flush what an earlier round (or client) left in the pipes first
+        if (down->pending && bridge_drain(down, down->cap) < 0 && errno != EAGAIN) break;
+        if (down->eof && down->pending == 0) {
+            shutdown(client, SHUT_WR);
+            if (up->eof) {
+                ret = 1;
+                break;
+            }
+        }
+        struct pollfd pfd[2] = {
+            { .fd = h->sockfd, .events = 0 },
+            { .fd = client, .events = 0 }
+        };
+        if (!down->eof && down->pending < down->cap && !down->full) pfd[0].events |= POLLIN;
+        if (up->pending) pfd[0].events |= POLLOUT;
+        if (!up->eof && up->pending < up->cap && !up->full) pfd[1].events |= POLLIN;
+        if (down->pending) pfd[1].events |= POLLOUT;
+        // Nothing wanted from the stolen socket: its POLLHUP would spin
+        if (!pfd[0].events) pfd[0].fd = -1;
+        long long t0 = prof_begin();
+        // A closed client and a half-closed one look the same from here,
+        // and the stolen socket must not be shut down to find out: once the
+        // client has stopped sending, replies are forwarded until the
+        // socket has been quiet for the receive timeout
+        int rv = poll(pfd, 2, up->eof ? recv_timeout_ms : -1);
+        prof_end(PROF_POLL, t0, 0);
+        if (bridge_interrupted) {
+            ret = -1;
+            break;
+        }
+        if (rv == 0) break;
+        if (rv < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        // Read the stolen socket only when poll says it won't block
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR) && pfd[0].events & POLLIN) {
+            if (bridge_fill(down) < 0 && errno != EAGAIN) {
+                perror("bridge: socket");
+                ret = 1;
+                break;
+            }
+        }
+        if (pfd[1].revents & (POLLIN | POLLHUP | POLLERR) && pfd[1].events & POLLIN) {
+            // The client is ours and non-blocking: take all it has
+            ssize_t n;
+            while (up->pending < up->cap && (n = bridge_fill(up)) > 0)
+                ;
+        }
+        if (up->pending && pfd[0].revents & (POLLOUT | POLLERR)) {
+            if (bridge_drain(up, BRIDGE_WRITE) < 0 && errno != EAGAIN) {
+                perror("bridge: socket");
+                ret = 1;
+                break;
+            }
+        }
+        if (down->pending && bridge_drain(down, down->cap) < 0 && errno != EAGAIN) break;
+        // A client that closed for good (not just its sending side) is gone
+        if (pfd[1].revents & (POLLHUP | POLLERR)) done = 1;
+        if (up->eof && up->pending == 0 && down->eof) done = 1;
+    }
+    // What the client sent still goes out; what it didn't get waits for the next one
+    while (up->pending && !bridge_interrupted) {
+        if (wait_fd(h->sockfd, POLLOUT, recv_timeout_ms) < 0 || (bridge_drain(up, BRIDGE_WRITE) < 0 && errno != EAGAIN))
+            break;
+    }
+    return ret;
+}
+
+int dup_socket_and_bridge(int pid, int fd, unsigned long long inode, const char *listen_addr) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    if (h->type != SOCK_STREAM) {
+        printf("bridge needs a stream socket: splice would merge datagrams\n");
+        return -1;
+    }
+    struct sockaddr_storage ss;
+    socklen_t sslen;
+    int l = bridge_listen(listen_addr, &ss, &sslen);
+    if (l < 0) return -1;
+    BridgeDir up = { .pipefd = { -1, -1 } }, down = { .pipefd = { -1, -1 } };
+    if (bridge_pipe(&up) < 0 || bridge_pipe(&down) < 0) {
+        perror("pipe");
+        close(l);
+        return -1;
+    }
+
+    char where[PATH_MAX];
+    format_sockaddr(&ss, sslen, where, sizeof(where));
+    printf("Bridging PID %d FD %d on %s, Ctrl-C to stop\n", pid, fd, where);
+    fflush(stdout);
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = bridge_sigint;
+    sigaction(SIGINT, &sa, &old);
+    bridge_interrupted = 0;
+
+    long long to_client = 0, to_socket = 0;
+    int clients = 0, ended = 0;
+    while (!bridge_interrupted && !ended) {
+        struct pollfd lp = { .fd = l, .events = POLLIN };
+        if (poll(&lp, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+        int c = accept4(l, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (c < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept");
+            break;
+        }
+        clients++;
+        long long start = now_ns();
+        int rv = bridge_session(h, c, &up, &down);
+        close(c);
+        printf("Client %d: %lld bytes to client, %lld bytes to socket in %.3f s\n", clients, down.bytes, up.bytes,
+               (now_ns() - start) / 1e9);
+        fflush(stdout);
+        to_client += down.bytes;
+        to_socket += up.bytes;
+        if (rv == 1) {
+            printf("Connection closed by peer\n");
+            ended = 1;
+        }
+    }
+    sigaction(SIGINT, &old, NULL);
+
+    if (down.pending) printf("%zu byte(s) read from the socket were not delivered\n", down.pending);
+    printf("Bridge closed after %d client(s): %lld bytes to clients, %lld bytes to socket\n", clients, to_client,
+           to_socket);
+    close(up.pipefd[0]);
+    close(up.pipefd[1]);
+    close(down.pipefd[0]);
+    close(down.pipefd[1]);
+    close(l);
+    if (ss.ss_family == AF_UNIX && ((struct sockaddr_un *)&ss)->sun_path[0]) unlink(((struct sockaddr_un *)&ss)->sun_path);
+    return 0;
+}
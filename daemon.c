@@ -0,0 +1,765 @@
+#define _GNU_SOURCE
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+// Daemon mode (js5 --daemon PATH): keep everything a search or a transfer
+// needs warm between requests and serve them over a UNIX socket.
+//  - the socket snapshot, pid names and namespace tables live in a
+//    WatchCache, rescanned incrementally every interval (and on demand);
+//    searches are answered from memory;
+//  - pidfds and duplicated sockets stay in the handle cache (handles.c).
+// One epoll loop serves every client and never blocks: answers the client
+// isn't reading yet are queued, and a send or rec the socket can't satisfy
+// right away waits in the epoll set, up to its deadline, while the others
+// are served. The protocol is described with DaemonReq in jinsock.h;
+// --connect PATH makes js5 itself a client.
+
+#define DAEMON_REC_DEFAULT (64 * 1024)
+// Queued answers past which a client's next requests wait for it to read
+#define DAEMON_OUT_HIGH (1 << 20)
+
+#define DAEMON_WAIT_DGRAM 1
+#define DAEMON_WAIT_EOF_ON_EMPTY 2
+
+typedef struct DaemonClient DaemonClient;
+
+// epoll data for a client: its connection, or the socket its send or rec
+// waits on (the listener has NULL)
+typedef struct {
+    DaemonClient *client;
+    int waiting;
+} DaemonTag;
+
+struct DaemonClient {
+    int fd;
+    uint32_t events;            // registered for fd
+    int dead;                   // closed, freed once the event batch is done
+    char *buf;                  // unparsed input
+    size_t len, cap;
+    char *out;                  // answers not written yet
+    size_t out_off, out_len, out_cap;
+    // A send or rec waiting for its socket. The client's next requests
+    // stay unparsed until it is answered, so answers keep their order.
+    int wait_op;                // 0, DAEMON_SEND or DAEMON_REC
+    int wait_fd;                // own dup of the socket: epoll takes each fd once
+    int wait_flags;
+    long long deadline;
+    size_t rec_max;
+    char *send_data;
+    size_t send_len, send_off;
+    DaemonTag conn_tag, wait_tag;
+    DaemonClient *prev, *next;
+};
+
+typedef struct {
+    WatchCache *cache;
+    int interval_ms;
+    int ep;
+    long long scanned_at;
+    double scan_ms;
+    long scans, requests;
+    char *filter_src;           // text of the last filter, compiled once
+    Filter *filter;
+    size_t *match;              // search scratch
+    size_t match_cap;
+    char *recbuf;
+    size_t recbuf_cap;
+    DaemonClient *clients;
+} Daemon;
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_signal(int sig) {
+    (void)sig;
+    daemon_stop = 1;
+}
+
+static void daemon_scan(Daemon *d) {
+    WatchTick tick;
+    long long t0 = now_ns();
+    watch_cache_update(d->cache, &tick);
+    exit_if_netns_stuck();
+    d->scanned_at = now_ns();
+    d->scan_ms = (d->scanned_at - t0) / 1e6;
+    d->scans++;
+}
+
+// Write queued answers until the connection is full; -1 drops the client
+static int daemon_flush(DaemonClient *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        c->out_off += n;
+    }
+    c->out_off = c->out_len = 0;
+    return 0;
+}
+
+static int daemon_queue(DaemonClient *c, const void *data, size_t len) {
+    if (c->out_off && c->out_len + len > c->out_cap) {
+        memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+    }
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 4096;
+        while (cap < c->out_len + len) cap *= 2;
+        char *b = realloc(c->out, cap);
+        if (!b) return -1;
+        c->out = b;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    return 0;
+}
+
+// Header and payload in one writev when the connection takes it and
+// nothing is queued before them; what it doesn't take is queued
+static int daemon_reply(DaemonClient *c, int status, uint32_t count, const void *data, size_t len) {
+    DaemonResp r = { .magic = DAEMON_MAGIC, .status = status, .count = count, .len = (uint32_t)len };
+    ssize_t n = 0;
+    if (c->out_off == c->out_len) {
+        struct iovec iov[2] = { { &r, sizeof(r) }, { (void *)data, len } };
+        n = writev(c->fd, iov, len ? 2 : 1);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) return -1;
+            n = 0;
+        }
+    }
+    if ((size_t)n < sizeof(r)) {
+        if (daemon_queue(c, (const char *)&r + n, sizeof(r) - n) < 0) return -1;
+        n = sizeof(r);
+    }
+    n -= sizeof(r);
+    return daemon_queue(c, (const char *)data + n, len - n);
+}
+
+static int daemon_error(DaemonClient *c, int err, const char *what) {
+    char msg[256];
+    int n = snprintf(msg, sizeof(msg), "%s: %s", what, strerror(err));
+    return daemon_reply(c, -err, 0, msg, n);
+}
+
+static int daemon_do_search(Daemon *d, DaemonClient *c, const DaemonReq *rq, const char *payload) {
+    const char *pattern = payload;
+    size_t plen = strlen(pattern);
+    const char *filter = plen + 1 < rq->len ? payload + plen + 1 : "";
+    if (rq->format > OUTPUT_BIN) return daemon_error(c, EINVAL, "format");
+
+    if (!d->filter_src || strcmp(d->filter_src, filter) != 0) {
+        char err[128] = "";
+        Filter *f = *filter ? filter_compile(filter, err, sizeof(err)) : NULL;
+        if (*filter && !f) {
+            char msg[200];
+            int n = snprintf(msg, sizeof(msg), "filter: %s", err);
+            return daemon_reply(c, -EINVAL, 0, msg, n);
+        }
+        filter_free(d->filter);
+        free(d->filter_src);
+        d->filter = f;
+        d->filter_src = strdup(filter);
+        // The first filter on rtt, cwnd... needs the tables read again
+        if (filter_wants_tcpinfo(f) && watch_cache_want_tcpinfo(d->cache)) daemon_scan(d);
+    }
+    if (rq->flags & DAEMON_FRESH) daemon_scan(d);
+
+    const ResultStore *rs = watch_cache_results(d->cache);
+    if (rs->count > d->match_cap) {
+        size_t *m = realloc(d->match, rs->count * sizeof(size_t));
+        if (!m) return daemon_error(c, ENOMEM, "search");
+        d->match = m;
+        d->match_cap = rs->count;
+    }
+    size_t n = 0;
+    pid_t last = -1;
+    const NetnsIndex *ns = NULL;
+    for (size_t i = 0; i < rs->count; i++) {
+        const SocketEntry *e = &rs->items[i];
+        const char *name = entry_proc_name(rs, e);
+        if (!search_match(*pattern ? pattern : NULL, e->pid, name)) continue;
+        if (d->filter) {
+            if (e->pid != last) {
+                ns = watch_cache_netns(d->cache, e->pid);
+                last = e->pid;
+            }
+            FilterCtx fc = {
+                .known = FILTER_KNOW_PID | FILTER_KNOW_FD | FILTER_KNOW_SOCK,
+                .pid = e->pid, .comm = name, .fd = e->fd, .inode = e->inode,
+                .si = netns_index_lookup(ns, e->inode), .path = entry_path(rs, e)
+            };
+            if (filter_eval(d->filter, &fc) != FILTER_YES) continue;
+        }
+        d->match[n++] = i;
+    }
+
+    // Same bytes as js5 -o <format> search, less the "Found" line of the
+    // text table: the count is in the reply header
+    OutBuf ob = { .hold = 1 };
+    output_header(&ob, rq->format);
+    last = -1;
+    for (size_t k = 0; k < n; k++) {
+        const SocketEntry *e = &rs->items[d->match[k]];
+        if (rq->format == OUTPUT_TEXT) {
+            output_text_entry(&ob, k, rs, e);
+            continue;
+        }
+        if (e->pid != last) {
+            ns = watch_cache_netns(d->cache, e->pid);
+            last = e->pid;
+        }
+        output_entry(&ob, rq->format, e->pid, e->fd, e->inode, entry_proc_name(rs, e),
+                     netns_index_lookup(ns, e->inode), entry_path(rs, e));
+    }
+    int rv = daemon_reply(c, 0, (uint32_t)n, ob.buf, ob.len);
+    free(ob.buf);
+    return rv;
+}
+
+// Park the client's send or rec until sockfd is ready or timeout_ms passes
+static int daemon_wait(Daemon *d, DaemonClient *c, int op, int sockfd, int flags, int timeout_ms) {
+    int wfd = fcntl(sockfd, F_DUPFD_CLOEXEC, 0);
+    struct epoll_event ev = { .events = op == DAEMON_REC ? EPOLLIN : EPOLLOUT, .data.ptr = &c->wait_tag };
+    if (wfd < 0 || epoll_ctl(d->ep, EPOLL_CTL_ADD, wfd, &ev) < 0) {
+        int err = errno;
+        if (wfd >= 0) close(wfd);
+        return daemon_error(c, err, op == DAEMON_REC ? "rec" : "send");
+    }
+    c->wait_op = op;
+    c->wait_fd = wfd;
+    c->wait_flags = flags;
+    c->deadline = now_ns() + timeout_ms * 1000000LL;
+    return 0;
+}
+
+static void daemon_wait_end(Daemon *d, DaemonClient *c) {
+    // Before close: the socket's other fds would keep the registration
+    epoll_ctl(d->ep, EPOLL_CTL_DEL, c->wait_fd, NULL);
+    close(c->wait_fd);
+    c->wait_op = 0;
+    free(c->send_data);
+    c->send_data = NULL;
+}
+
+// Write what is left of the send payload without blocking; 1 while the
+// socket has no room for it
+static int daemon_send_more(DaemonClient *c, int sockfd) {
+    while (c->send_off < c->send_len) {
+        long long t0 = prof_begin();
+        ssize_t n = send(sockfd, c->send_data + c->send_off, c->send_len - c->send_off,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+        prof_end(PROF_WRITE, t0, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return 1;
+            return daemon_error(c, errno, "send");
+        }
+        c->send_off += n;
+    }
+    return daemon_reply(c, 0, (uint32_t)c->send_off, NULL, 0);
+}
+
+static int daemon_do_send(Daemon *d, DaemonClient *c, const DaemonReq *rq, const char *payload) {
+    SockHandle *h;
+    int rv = handle_find(rq->pid, rq->fd, rq->inode, &h);
+    if (rv < 0) return daemon_error(c, -rv, "handle");
+    c->send_data = (char *)payload;
+    c->send_len = rq->len;
+    c->send_off = 0;
+    rv = daemon_send_more(c, h->sockfd);
+    c->send_data = NULL;
+    if (rv != 1) return rv;
+    // The socket is full: keep the payload, the input buffer moves on
+    c->send_data = malloc(rq->len);
+    if (!c->send_data) return daemon_error(c, ENOMEM, "send");
+    memcpy(c->send_data, payload, rq->len);
+    return daemon_wait(d, c, DAEMON_SEND, h->sockfd, 0, recv_timeout_ms);
+}
+
+// Take what is queued up to max (one datagram on message sockets); 1 when
+// there is nothing yet
+static int daemon_rec_take(Daemon *d, DaemonClient *c, int sockfd, size_t max, int flags) {
+    size_t got = 0;
+    int eof = 0, any = 0;
+    while (got < max) {
+        long long t0 = prof_begin();
+        ssize_t n = recv(sockfd, d->recbuf + got, max - got, MSG_DONTWAIT);
+        prof_end(PROF_RECV, t0, n);
+        if (n > 0) {
+            any = 1;
+            got += n;
+            if (flags & DAEMON_WAIT_DGRAM) break;
+            continue;
+        }
+        if (n == 0) {
+            // An empty datagram is an answer too
+            any = 1;
+            eof = (flags & DAEMON_WAIT_EOF_ON_EMPTY) != 0;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN) break;
+        if (got == 0) return daemon_error(c, errno, "rec");
+        break;
+    }
+    if (!any) return 1;
+    return daemon_reply(c, 0, eof, d->recbuf, got);
+}
+
+static int daemon_do_rec(Daemon *d, DaemonClient *c, const DaemonReq *rq) {
+    SockHandle *h;
+    int rv = handle_find(rq->pid, rq->fd, rq->inode, &h);
+    if (rv < 0) return daemon_error(c, -rv, "handle");
+    size_t max = rq->max_bytes ? rq->max_bytes : DAEMON_REC_DEFAULT;
+    if (max > DAEMON_MAX_PAYLOAD) max = DAEMON_MAX_PAYLOAD;
+    if (max > d->recbuf_cap) {
+        char *b = realloc(d->recbuf, max);
+        if (!b) return daemon_error(c, ENOMEM, "rec");
+        d->recbuf = b;
+        d->recbuf_cap = max;
+    }
+    int flags = (handle_is_dgram(h) ? DAEMON_WAIT_DGRAM : 0) |
+                (handle_eof_on_empty(h) ? DAEMON_WAIT_EOF_ON_EMPTY : 0);
+    rv = daemon_rec_take(d, c, h->sockfd, max, flags);
+    if (rv != 1) return rv;
+    int timeout = rq->timeout_ms == 0 ? recv_timeout_ms
+                  : rq->timeout_ms > INT_MAX ? INT_MAX : (int)rq->timeout_ms;
+    c->rec_max = max;
+    return daemon_wait(d, c, DAEMON_REC, h->sockfd, flags, timeout);
+}
+
+// The socket a send or rec waits on is ready
+static int daemon_wait_ready(Daemon *d, DaemonClient *c) {
+    int rv;
+    if (c->wait_op == DAEMON_REC) {
+        // recbuf is shared but only grows: rec_max still fits
+        rv = daemon_rec_take(d, c, c->wait_fd, c->rec_max, c->wait_flags);
+    } else {
+        rv = daemon_send_more(c, c->wait_fd);
+    }
+    if (rv != 1) daemon_wait_end(d, c);
+    return rv == 1 ? 0 : rv;
+}
+
+static int daemon_do_stats(Daemon *d, DaemonClient *c) {
+    char line[256];
+    int n = snprintf(line, sizeof(line),
+                     "sockets=%zu pids=%zu handles=%zu scans=%ld last_scan_ms=%.2f age_ms=%lld requests=%ld\n",
+                     watch_cache_results(d->cache)->count, watch_cache_pids(d->cache), handle_cached(),
+                     d->scans, d->scan_ms, (now_ns() - d->scanned_at) / 1000000, d->requests);
+    return daemon_reply(c, 0, 0, line, n);
+}
+
+static int daemon_serve(Daemon *d, DaemonClient *c, const DaemonReq *rq, const char *payload) {
+    switch (rq->op) {
+        case DAEMON_SEARCH: return daemon_do_search(d, c, rq, payload);
+        case DAEMON_SEND: return daemon_do_send(d, c, rq, payload);
+        case DAEMON_REC: return daemon_do_rec(d, c, rq);
+        case DAEMON_RELEASE: {
+            int n = rq->pid > 0 ? handle_release(rq->pid, rq->fd) : handle_release_all();
+            return daemon_reply(c, 0, n, NULL, 0);
+        }
+        case DAEMON_STATS: return daemon_do_stats(d, c);
+        default: return daemon_error(c, EINVAL, "request");
+    }
+}
+
+// Serve the complete requests buffered, unless the client waits on a socket
+// or has too many answers unread; then listen for what it needs. -1 drops it
+static int daemon_client_step(Daemon *d, DaemonClient *c) {
+    size_t off = 0;
+    while (!c->wait_op && c->out_len - c->out_off < DAEMON_OUT_HIGH && c->len - off >= sizeof(DaemonReq)) {
+        DaemonReq rq;
+        memcpy(&rq, c->buf + off, sizeof(rq));
+        if (rq.magic != DAEMON_MAGIC || rq.len > DAEMON_MAX_PAYLOAD) {
+            daemon_error(c, EPROTO, "request");
+            daemon_flush(c);
+            return -1;
+        }
+        if (c->len - off - sizeof(rq) < rq.len) break;
+        char *payload = c->buf + off + sizeof(rq);
+        char saved = payload[rq.len];
+        payload[rq.len] = 0;
+        int rv = daemon_serve(d, c, &rq, payload);
+        payload[rq.len] = saved;
+        d->requests++;
+        if (rv < 0) return -1;
+        off += sizeof(rq) + rq.len;
+    }
+    memmove(c->buf, c->buf + off, c->len - off);
+    c->len -= off;
+    if (daemon_flush(c) < 0) return -1;
+
+    uint32_t events = 0;
+    if (!c->wait_op && c->out_len - c->out_off < DAEMON_OUT_HIGH) events |= EPOLLIN;
+    if (c->out_off < c->out_len) events |= EPOLLOUT;
+    if (events != c->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = &c->conn_tag };
+        if (epoll_ctl(d->ep, EPOLL_CTL_MOD, c->fd, &ev) < 0) return -1;
+        c->events = events;
+    }
+    return 0;
+}
+
+// Read what the client sent; -1 drops it
+static int daemon_client_input(DaemonClient *c) {
+    // One spare byte: payloads are NUL terminated in place
+    if (c->cap - c->len < 2) {
+        size_t newcap = c->cap ? c->cap * 2 : 4096;
+        if (newcap > sizeof(DaemonReq) + DAEMON_MAX_PAYLOAD + 1) newcap = sizeof(DaemonReq) + DAEMON_MAX_PAYLOAD + 1;
+        if (newcap <= c->cap) return -1;
+        char *b = realloc(c->buf, newcap);
+        if (!b) return -1;
+        c->buf = b;
+        c->cap = newcap;
+    }
+    ssize_t n = read(c->fd, c->buf + c->len, c->cap - c->len - 1);
+    if (n == 0) return -1;
+    if (n < 0) return errno == EAGAIN || errno == EINTR ? 0 : -1;
+    c->len += n;
+    return 0;
+}
+
+// Closed now, freed by daemon_client_sweep once no event can refer to it
+static void daemon_client_close(Daemon *d, DaemonClient *c) {
+    if (c->dead) return;
+    if (c->wait_op) daemon_wait_end(d, c);
+    epoll_ctl(d->ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->dead = 1;
+}
+
+static void daemon_client_sweep(Daemon *d) {
+    DaemonClient *c = d->clients;
+    while (c) {
+        DaemonClient *next = c->next;
+        if (c->dead) {
+            if (c->prev) c->prev->next = c->next;
+            else d->clients = c->next;
+            if (c->next) c->next->prev = c->prev;
+            free(c->buf);
+            free(c->out);
+            free(c);
+        }
+        c = next;
+    }
+}
+
+// Bind path, replacing a socket file left by a daemon that is gone
+static int daemon_listen(const char *path) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    int l = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (l < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int live = probe >= 0 && connect(probe, (struct sockaddr *)&sa, sizeof(sa)) == 0;
+        if (probe >= 0) close(probe);
+        if (live) {
+            fprintf(stderr, "A daemon is already listening on %s\n", path);
+            close(l);
+            return -1;
+        }
+        unlink(path);
+    }
+    // Only our user may connect: the daemon holds other processes' sockets
+    mode_t old = umask(0177);
+    int rv = bind(l, (struct sockaddr *)&sa, sizeof(sa));
+    umask(old);
+    if (rv < 0 || listen(l, 64) < 0) {
+        perror(path);
+        close(l);
+        return -1;
+    }
+    return l;
+}
+
+int daemon_run(const char *path, int interval_ms) {
+    int l = daemon_listen(path);
+    if (l < 0) return -1;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, l, &ev) < 0) {
+        perror("epoll");
+        if (ep >= 0) close(ep);
+        close(l);
+        unlink(path);
+        return -1;
+    }
+
+    Daemon d;
+    memset(&d, 0, sizeof(d));
+    d.interval_ms = interval_ms;
+    d.ep = ep;
+    d.cache = watch_cache_new(discovery_backend);
+    if (!d.cache) {
+        perror("calloc");
+        close(ep);
+        close(l);
+        unlink(path);
+        return -1;
+    }
+    daemon_scan(&d);
+    printf("Listening on %s: %zu socket(s) in %zu pid(s), scan %.1f ms, rescan every %d ms\n", path,
+           watch_cache_results(d.cache)->count, watch_cache_pids(d.cache), d.scan_ms, interval_ms);
+    fflush(stdout);
+
+    // No SA_RESTART: the signal has to break epoll_wait
+    struct sigaction sa, oldint, oldterm;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_signal;
+    sigaction(SIGINT, &sa, &oldint);
+    sigaction(SIGTERM, &sa, &oldterm);
+    daemon_stop = 0;
+
+    struct epoll_event events[64];
+    while (!daemon_stop) {
+        // Up to the next scan or the first send or rec deadline
+        long long due = d.scanned_at + interval_ms * 1000000LL, now = now_ns();
+        for (DaemonClient *c = d.clients; c; c = c->next)
+            if (c->wait_op && c->deadline < due) due = c->deadline;
+        long long left = due > now ? (due - now) / 1000000 + 1 : 0;
+        int nev = epoll_wait(ep, events, 64, left > INT_MAX ? INT_MAX : (int)left);
+        if (nev < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nev; i++) {
+            DaemonTag *t = events[i].data.ptr;
+            if (t) {
+                DaemonClient *c = t->client;
+                if (c->dead) continue;
+                int rv = 0;
+                if (t->waiting) {
+                    // Stale once the wait was answered in this batch
+                    if (c->wait_op) rv = daemon_wait_ready(&d, c);
+                } else {
+                    uint32_t e = events[i].events;
+                    if (e & EPOLLOUT) rv = daemon_flush(c);
+                    if (rv == 0 && (e & EPOLLIN)) rv = daemon_client_input(c);
+                    // Hung up while its input is not being read
+                    if (rv == 0 && (e & (EPOLLHUP | EPOLLERR)) && !(e & EPOLLIN)) rv = -1;
+                }
+                if (rv < 0 || daemon_client_step(&d, c) < 0) daemon_client_close(&d, c);
+                continue;
+            }
+            int cfd;
+            while ((cfd = accept4(l, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                DaemonClient *c = calloc(1, sizeof(DaemonClient));
+                struct epoll_event cev = { .events = EPOLLIN, .data.ptr = c ? &c->conn_tag : NULL };
+                if (!c || epoll_ctl(ep, EPOLL_CTL_ADD, cfd, &cev) < 0) {
+                    free(c);
+                    close(cfd);
+                    continue;
+                }
+                c->fd = cfd;
+                c->events = EPOLLIN;
+                c->conn_tag = (DaemonTag){ c, 0 };
+                c->wait_tag = (DaemonTag){ c, 1 };
+                c->next = d.clients;
+                if (c->next) c->next->prev = c;
+                d.clients = c;
+            }
+        }
+        now = now_ns();
+        for (DaemonClient *c = d.clients; c; c = c->next) {
+            if (c->dead || !c->wait_op || now < c->deadline) continue;
+            int op = c->wait_op;
+            daemon_wait_end(&d, c);
+            if (daemon_error(c, ETIMEDOUT, op == DAEMON_REC ? "rec" : "send") < 0 ||
+                daemon_client_step(&d, c) < 0)
+                daemon_client_close(&d, c);
+        }
+        daemon_client_sweep(&d);
+        if (now_ns() >= d.scanned_at + interval_ms * 1000000LL) daemon_scan(&d);
+    }
+    sigaction(SIGINT, &oldint, NULL);
+    sigaction(SIGTERM, &oldterm, NULL);
+
+    printf("Stopped after %ld request(s), %ld scan(s)\n", d.requests, d.scans);
+    for (DaemonClient *c = d.clients; c; c = c->next) daemon_client_close(&d, c);
+    daemon_client_sweep(&d);
+    close(ep);
+    close(l);
+    unlink(path);
+    watch_cache_free(d.cache);
+    filter_free(d.filter);
+    free(d.filter_src);
+    free(d.match);
+    free(d.recbuf);
+    handle_release_all();
+    return 0;
+}
+
+// Client side: send one request and read its answer. *data gets the
+// payload (NUL terminated, caller frees) or NULL when empty.
+int daemon_request(const char *path, const DaemonReq *rq, const void *payload, DaemonResp *resp, char **data) {
+    struct sockaddr_un sa = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(sa.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(sa.sun_path, path);
+    int s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (s < 0) return -1;
+    if (connect(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+        write_all(s, rq, sizeof(*rq)) < 0 || write_all(s, payload, rq->len) < 0) {
+        close(s);
+        return -1;
+    }
+    char *buf = NULL;
+    size_t want = sizeof(*resp), got = 0;
+    while (got < want) {
+        ssize_t n = got < sizeof(*resp) ? read(s, (char *)resp + got, sizeof(*resp) - got)
+                                        : read(s, buf + got - sizeof(*resp), want - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = ECONNRESET;
+            free(buf);
+            close(s);
+            return -1;
+        }
+        got += n;
+        if (got == sizeof(*resp) && want == sizeof(*resp)) {
+            if (resp->magic != DAEMON_MAGIC || resp->len > DAEMON_MAX_PAYLOAD) {
+                errno = EPROTO;
+                close(s);
+                return -1;
+            }
+            if (!resp->len) break;
+            buf = malloc(resp->len + 1);
+            if (!buf) {
+                close(s);
+                return -1;
+            }
+            want += resp->len;
+        }
+    }
+    close(s);
+    if (buf) buf[resp->len] = 0;
+    *data = buf;
+    return 0;
+}
+
+// Request, reporting failures of the transport and of the request itself
+static int daemon_call(const char *path, const DaemonReq *rq, const void *payload, DaemonResp *resp, char **data) {
+    if (daemon_request(path, rq, payload, resp, data) < 0) {
+        perror(path);
+        return -1;
+    }
+    if (resp->status < 0) {
+        fprintf(stderr, "Daemon: %s\n", *data ? *data : strerror(-resp->status));
+        free(*data);
+        *data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int daemon_search(const char *path, const char *pattern, const char *filter) {
+    if (!pattern) pattern = "";
+    if (!filter) filter = "";
+    size_t plen = strlen(pattern), flen = strlen(filter);
+    char *payload = malloc(plen + flen + 2);
+    if (!payload) {
+        perror("malloc");
+        return -1;
+    }
+    memcpy(payload, pattern, plen + 1);
+    memcpy(payload + plen + 1, filter, flen + 1);
+    DaemonReq rq = { .magic = DAEMON_MAGIC, .op = DAEMON_SEARCH, .format = output_format,
+                     .len = (uint32_t)(plen + flen + 2) };
+    DaemonResp resp;
+    char *data;
+    int rv = daemon_call(path, &rq, payload, &resp, &data);
+    free(payload);
+    if (rv < 0) return -1;
+    if (output_format == OUTPUT_TEXT) printf("Found %u socket(s):\n", resp.count);
+    fflush(stdout);
+    if (data && write_all(STDOUT_FILENO, data, resp.len) < 0 && errno != EPIPE) perror("write");
+    free(data);
+    return 0;
+}
+
+int daemon_send(const char *path, pid_t pid, int fd, const char *data, size_t len) {
+    if (len > DAEMON_MAX_PAYLOAD) {
+        fprintf(stderr, "At most %d bytes per request\n", DAEMON_MAX_PAYLOAD);
+        return -1;
+    }
+    DaemonReq rq = { .magic = DAEMON_MAGIC, .op = DAEMON_SEND, .pid = pid, .fd = fd, .len = (uint32_t)len };
+    DaemonResp resp;
+    char *answer;
+    if (daemon_call(path, &rq, data, &resp, &answer) < 0) return -1;
+    free(answer);
+    printf("Data sent: %u bytes\n", resp.count);
+    return 0;
+}
+
+// Receive until the idle timeout or EOF, like --rec
+int daemon_recv(const char *path, pid_t pid, int fd, const char *outfile) {
+    int out = STDOUT_FILENO;
+    if (outfile) {
+        out = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0) {
+            perror(outfile);
+            return -1;
+        }
+    }
+    DaemonReq rq = { .magic = DAEMON_MAGIC, .op = DAEMON_REC, .pid = pid, .fd = fd,
+                     .timeout_ms = recv_timeout_ms, .max_bytes = 1 << 20 };
+    long long total = 0;
+    int ret = 0;
+    while (1) {
+        DaemonResp resp;
+        char *data;
+        if (daemon_request(path, &rq, NULL, &resp, &data) < 0) {
+            perror(path);
+            ret = -1;
+            break;
+        }
+        if (resp.status == -ETIMEDOUT) {
+            free(data);
+            break;
+        }
+        if (resp.status < 0) {
+            fprintf(stderr, "Daemon: %s\n", data ? data : strerror(-resp.status));
+            free(data);
+            ret = -1;
+            break;
+        }
+        if (data && write_all(out, data, resp.len) < 0) {
+            perror("write output");
+            free(data);
+            ret = -1;
+            break;
+        }
+        free(data);
+        total += resp.len;
+        if (resp.count) break;
+    }
+    if (outfile) close(out);
+    fprintf(stderr, "Received %lld bytes\n", total);
+    return ret;
+}
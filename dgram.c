@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <linux/limits.h>
+
+// Datagram sockets (UDP, raw, UNIX dgram and seqpacket) keep message
+// boundaries, which the stream paths would lose: writev glues a batch into
+// a single datagram and a short recv truncates one. Sends go out one
+// message per datagram through sendmmsg, and rec reads whole datagrams
+// with recvmmsg. Captured to a file, each datagram is framed like a tap
+// record:
+//   [<realtime sec.nsec> len=<n> from=<addr>]
+// followed by the n payload bytes and a newline.
+
+#define DGRAM_BATCH 64              // messages per sendmmsg/recvmmsg
+#define DGRAM_MAX (64 * 1024)       // larger datagrams are truncated
+
+// "1.2.3.4:53", "[::1]:53", "/run/x.sock" or "@abstract"
+int parse_sockaddr(const char *arg, struct sockaddr_storage *ss, socklen_t *len) {
+    memset(ss, 0, sizeof(*ss));
+    if (arg[0] == '/' || arg[0] == '@') {
+        struct sockaddr_un *un = (struct sockaddr_un *)ss;
+        size_t n = strlen(arg);
+        if (n >= sizeof(un->sun_path)) return -1;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, arg, n);
+        if (arg[0] == '@') {
+            un->sun_path[0] = 0;        // abstract: no trailing NUL counted
+            *len = offsetof(struct sockaddr_un, sun_path) + n;
+        } else {
+            *len = offsetof(struct sockaddr_un, sun_path) + n + 1;
+        }
+        return 0;
+    }
+    char host[INET6_ADDRSTRLEN + 2];
+    const char *colon = strrchr(arg, ':');
+    if (!colon || (size_t)(colon - arg) >= sizeof(host)) return -1;
+    memcpy(host, arg, colon - arg);
+    host[colon - arg] = 0;
+    char *end;
+    long port = strtol(colon + 1, &end, 10);
+    if (end == colon + 1 || *end || port < 0 || port > 65535) return -1;
+
+    size_t hl = strlen(host);
+    if (hl > 2 && host[0] == '[' && host[hl - 1] == ']') {
+        host[hl - 1] = 0;
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *)ss;
+        if (inet_pton(AF_INET6, host + 1, &in6->sin6_addr) != 1) return -1;
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        *len = sizeof(*in6);
+        return 0;
+    }
+    struct sockaddr_in *in = (struct sockaddr_in *)ss;
+    if (inet_pton(AF_INET, host, &in->sin_addr) != 1) return -1;
+    in->sin_family = AF_INET;
+    in->sin_port = htons(port);
+    *len = sizeof(*in);
+    return 0;
+}
+
+// Sender of a received datagram, "-" when unnamed
+void format_sockaddr(const struct sockaddr_storage *ss, socklen_t len, char *buf, size_t buflen) {
+    char addr[INET6_ADDRSTRLEN];
+    if (ss->ss_family == AF_INET) {
+        const struct sockaddr_in *in = (const struct sockaddr_in *)ss;
+        inet_ntop(AF_INET, &in->sin_addr, addr, sizeof(addr));
+        snprintf(buf, buflen, "%s:%d", addr, ntohs(in->sin_port));
+    } else if (ss->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)ss;
+        inet_ntop(AF_INET6, &in6->sin6_addr, addr, sizeof(addr));
+        snprintf(buf, buflen, "[%s]:%d", addr, ntohs(in6->sin6_port));
+    } else if (ss->ss_family == AF_UNIX && len > offsetof(struct sockaddr_un, sun_path)) {
+        const struct sockaddr_un *un = (const struct sockaddr_un *)ss;
+        size_t n = len - offsetof(struct sockaddr_un, sun_path);
+        if (un->sun_path[0] == 0) snprintf(buf, buflen, "@%.*s", (int)n - 1, un->sun_path + 1);
+        else snprintf(buf, buflen, "%.*s", (int)strnlen(un->sun_path, n), un->sun_path);
+    } else {
+        snprintf(buf, buflen, "-");
+    }
+}
+
+// Send every iovec as its own datagram, to the connected peer when to is
+// NULL. Returns the payload bytes sent or -1.
+ssize_t dgram_sendv(int sockfd, const struct sockaddr *to, socklen_t tolen, struct iovec *iov, int cnt) {
+    struct mmsghdr msgs[DGRAM_BATCH];
+    ssize_t total = 0;
+    while (cnt > 0) {
+        int n = cnt < DGRAM_BATCH ? cnt : DGRAM_BATCH;
+        memset(msgs, 0, n * sizeof(msgs[0]));
+        for (int i = 0; i < n; i++) {
+            msgs[i].msg_hdr.msg_name = (void *)to;
+            msgs[i].msg_hdr.msg_namelen = to ? tolen : 0;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        long long t0 = prof_begin();
+        int sent = sendmmsg(sockfd, msgs, n, 0);
+        prof_end(PROF_SENDMMSG, t0, sent);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && wait_fd(sockfd, POLLOUT, recv_timeout_ms) == 0) continue;
+            return -1;
+        }
+        for (int i = 0; i < sent; i++) total += msgs[i].msg_len;
+        iov += sent;
+        cnt -= sent;
+    }
+    return total;
+}
+
+ssize_t dup_socket_and_sendto(int pid, int fd, unsigned long long inode, const char *dest, const char *data, size_t len) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    struct sockaddr_storage ss;
+    socklen_t sl;
+    if (parse_sockaddr(dest, &ss, &sl) < 0) {
+        fprintf(stderr, "Invalid address: %s\n", dest);
+        return -1;
+    }
+    struct iovec iov = { (void *)data, len };
+    ssize_t sent = dgram_sendv(h->sockfd, (struct sockaddr *)&ss, sl, &iov, 1);
+    if (sent < 0) perror("sendto");
+    return sent;
+}
+
+// Send count messages laid end to end in buf: one write on a stream
+// socket, one datagram each otherwise
+ssize_t dup_socket_and_send_msgs(int pid, int fd, unsigned long long inode, const char *buf, const size_t *lens, int count) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    if (!handle_is_dgram(h)) {
+        size_t total = 0;
+        for (int i = 0; i < count; i++) total += lens[i];
+        return dup_socket_and_send(pid, fd, inode, buf, total);
+    }
+    struct iovec *iov = malloc(count * sizeof(struct iovec));
+    if (!iov) {
+        perror("malloc");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = (void *)buf;
+        iov[i].iov_len = lens[i];
+        buf += lens[i];
+    }
+    ssize_t sent = dgram_sendv(h->sockfd, NULL, 0, iov, count);
+    if (sent < 0) perror("send");
+    free(iov);
+    return sent;
+}
+
+// Write one received datagram into the sink, framed or not
+static int dgram_sink_put(RecvSink *sink, int framed, const struct sockaddr_storage *from, socklen_t fromlen,
+                          const char *data, size_t len) {
+    if (framed) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        char addr[PATH_MAX], hdr[PATH_MAX + 96];
+        format_sockaddr(from, fromlen, addr, sizeof(addr));
+        int hl = snprintf(hdr, sizeof(hdr), "[%lld.%09ld len=%zu from=%s]\n",
+                          (long long)ts.tv_sec, ts.tv_nsec, len, addr);
+        if (recv_sink_frame(sink, hdr, hl) < 0) return -1;
+    }
+    if (recv_sink_push(sink, data, len) < 0) return -1;
+    return framed ? recv_sink_frame(sink, "\n", 1) : 0;
+}
+
+// rec on a datagram socket: whole datagrams, DGRAM_BATCH per syscall,
+// framed when framed is set. A zero-length read only means EOF on
+// seqpacket sockets; elsewhere it is an empty datagram.
+int dgram_recv_to_sink(const SockHandle *h, RecvSink *sink, int framed, long long *last, long long *count) {
+    char *bufs = malloc((size_t)DGRAM_BATCH * DGRAM_MAX);
+    struct mmsghdr *msgs = calloc(DGRAM_BATCH, sizeof(struct mmsghdr));
+    struct iovec *iov = calloc(DGRAM_BATCH, sizeof(struct iovec));
+    struct sockaddr_storage *from = calloc(DGRAM_BATCH, sizeof(struct sockaddr_storage));
+    int why = RECV_ERROR, done = 0;
+    long long truncated = 0;
+    if (!bufs || !msgs || !iov || !from) {
+        perror("malloc");
+        done = 1;
+    }
+    while (!done) {
+        if (wait_fd(h->sockfd, POLLIN, recv_timeout_ms) < 0) {
+            if (errno == ETIMEDOUT) why = RECV_TIMEOUT;
+            else perror("poll");
+            break;
+        }
+        for (int i = 0; i < DGRAM_BATCH; i++) {
+            iov[i].iov_base = bufs + (size_t)i * DGRAM_MAX;
+            iov[i].iov_len = DGRAM_MAX;
+            memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+        }
+        long long t0 = prof_begin();
+        int n = recvmmsg(h->sockfd, msgs, DGRAM_BATCH, MSG_DONTWAIT, NULL);
+        prof_end(PROF_RECVMMSG, t0, n);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            perror("recvmmsg");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (msgs[i].msg_len == 0 && h->type == SOCK_SEQPACKET) {
+                why = RECV_CLOSED;
+                done = 1;
+                break;
+            }
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) truncated++;
+            if (dgram_sink_put(sink, framed, &from[i], msgs[i].msg_hdr.msg_namelen,
+                               iov[i].iov_base, msgs[i].msg_len) < 0) {
+                perror("write output");
+                done = 1;
+                break;
+            }
+            (*count)++;
+        }
+        *last = now_ns();
+    }
+    if (truncated) fprintf(stderr, "%lld datagram(s) truncated to %d bytes\n", truncated, DGRAM_MAX);
+    free(bufs);
+    free(msgs);
+    free(iov);
+    free(from);
+    return why;
+}
@@ -0,0 +1,497 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+// Search filter expressions, e.g.
+//   rport=5432 and state=ESTABLISHED and raddr in 10.0.0.0/8
+// compiled once into a flat node array. Evaluation is three-valued so the
+// walker can ask early: with only the pid and name known, "comm~nginx and
+// state=LISTEN" already rejects every other process before its fd
+// directory is opened; with the fd number known, fd predicates reject a
+// descriptor before it is stat()ed; the full predicate runs on each socket
+// before anything is formatted.
+
+#define FILTER_MAX_NODES 128
+#define FILTER_MAX_DEPTH 32     // nested not/parentheses, bounds the parser's recursion
+
+enum {
+    N_AND,
+    N_OR,
+    N_NOT,
+    N_CMP
+};
+
+enum {
+    F_PID,
+    F_COMM,
+    F_FD,
+    F_INODE,
+    F_UID,
+    F_STATE,
+    F_LPORT,
+    F_RPORT,
+    F_PORT,         // local or remote
+    F_LADDR,
+    F_RADDR,
+    F_ADDR,         // local or remote
+    F_TXQ,
+    F_RXQ,
+    F_TYPE,
+    F_PATH,         // UNIX path
+    F_PEER,         // UNIX peer inode
+    F_RTT,          // tcp_info, microseconds
+    F_RTTVAR,
+    F_CWND,
+    F_RETRANS
+};
+
+enum {
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_SUB,         // comm~text, path~text
+    OP_IN           // addr in cidr
+};
+
+// type values: SOCK_PROTO_* * 10 + IP version, 0 meaning either
+#define TYPE_VALUE(proto, ver) ((proto) * 10 + (ver))
+
+typedef struct {
+    int kind;
+    int a, b;                   // children of AND/OR (a only for NOT)
+    int field, op;
+    long long num;
+    char str[64];
+    JsAddr net;                 // address or network for addr fields
+    int prefix;                 // CIDR length, full length for a plain address
+} FilterNode;
+
+struct Filter {
+    FilterNode nodes[FILTER_MAX_NODES];
+    int count;
+    int root;
+};
+
+static const struct {
+    const char *name;
+    int field;
+    int level;                  // what must be known to evaluate it
+} filter_fields[] = {
+    { "pid", F_PID, FILTER_KNOW_PID },
+    { "comm", F_COMM, FILTER_KNOW_PID },
+    { "name", F_COMM, FILTER_KNOW_PID },
+    { "fd", F_FD, FILTER_KNOW_FD },
+    { "inode", F_INODE, FILTER_KNOW_SOCK },
+    { "uid", F_UID, FILTER_KNOW_SOCK },
+    { "state", F_STATE, FILTER_KNOW_SOCK },
+    { "lport", F_LPORT, FILTER_KNOW_SOCK },
+    { "rport", F_RPORT, FILTER_KNOW_SOCK },
+    { "port", F_PORT, FILTER_KNOW_SOCK },
+    { "laddr", F_LADDR, FILTER_KNOW_SOCK },
+    { "raddr", F_RADDR, FILTER_KNOW_SOCK },
+    { "addr", F_ADDR, FILTER_KNOW_SOCK },
+    { "txq", F_TXQ, FILTER_KNOW_SOCK },
+    { "rxq", F_RXQ, FILTER_KNOW_SOCK },
+    { "type", F_TYPE, FILTER_KNOW_SOCK },
+    { "proto", F_TYPE, FILTER_KNOW_SOCK },
+    { "path", F_PATH, FILTER_KNOW_SOCK },
+    { "peer", F_PEER, FILTER_KNOW_SOCK },
+    { "rtt", F_RTT, FILTER_KNOW_SOCK },
+    { "rttvar", F_RTTVAR, FILTER_KNOW_SOCK },
+    { "cwnd", F_CWND, FILTER_KNOW_SOCK },
+    { "retrans", F_RETRANS, FILTER_KNOW_SOCK },
+};
+
+static int field_level(int field) {
+    for (size_t i = 0; i < sizeof(filter_fields) / sizeof(filter_fields[0]); i++)
+        if (filter_fields[i].field == field) return filter_fields[i].level;
+    return FILTER_KNOW_SOCK;
+}
+
+// Parser state: a cursor over the expression text
+typedef struct {
+    const char *p;
+    Filter *f;
+    char *err;
+    size_t errlen;
+    int depth;
+} Parser;
+
+static void skip_ws(Parser *ps) {
+    while (isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+static int fail(Parser *ps, const char *msg) {
+    if (ps->err && !ps->err[0]) snprintf(ps->err, ps->errlen, "%s near '%.20s'", msg, ps->p);
+    return -1;
+}
+
+static int is_word_char(char c) {
+    return c && !isspace((unsigned char)c) && !strchr("()=!<>~&|", c);
+}
+
+// Read a word (identifier or value) into buf, 0 if there is none
+static size_t read_word(Parser *ps, char *buf, size_t buflen) {
+    skip_ws(ps);
+    size_t n = 0;
+    while (is_word_char(*ps->p)) {
+        if (n + 1 < buflen) buf[n++] = *ps->p;
+        ps->p++;
+    }
+    buf[n] = 0;
+    return n;
+}
+
+// Consume keyword kw (or its symbol) if it comes next
+static int accept_kw(Parser *ps, const char *kw, const char *sym) {
+    skip_ws(ps);
+    size_t n = strlen(kw);
+    if (strncasecmp(ps->p, kw, n) == 0 && !is_word_char(ps->p[n])) {
+        ps->p += n;
+        return 1;
+    }
+    if (sym && strncmp(ps->p, sym, strlen(sym)) == 0) {
+        ps->p += strlen(sym);
+        return 1;
+    }
+    return 0;
+}
+
+static int new_node(Parser *ps, int kind) {
+    if (ps->f->count == FILTER_MAX_NODES) return fail(ps, "expression too long");
+    FilterNode *n = &ps->f->nodes[ps->f->count];
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    return ps->f->count++;
+}
+
+static int parse_state(const char *v) {
+    for (int st = 1; st <= 12; st++)
+        if (strcasecmp(v, tcp_state_name(st)) == 0) return st;
+    char *end;
+    long n = strtol(v, &end, 10);
+    return (end != v && *end == 0 && n > 0) ? (int)n : -1;
+}
+
+// tcp, udp, raw (with an optional 4 or 6), unix or unknown
+static int parse_type(const char *v) {
+    if (strcasecmp(v, "unknown") == 0) return TYPE_VALUE(SOCK_PROTO_NONE, 0);
+    if (strcasecmp(v, "unix") == 0) return TYPE_VALUE(SOCK_PROTO_UNIX, 0);
+    for (int proto = SOCK_PROTO_TCP; proto <= SOCK_PROTO_RAW; proto++) {
+        const char *name = sock_proto_name(proto);
+        size_t n = strlen(name);
+        if (strncasecmp(v, name, n) != 0) continue;
+        if (v[n] == 0) return TYPE_VALUE(proto, 0);
+        if (strcmp(v + n, "4") == 0) return TYPE_VALUE(proto, 4);
+        if (strcmp(v + n, "6") == 0) return TYPE_VALUE(proto, 6);
+    }
+    return -1;
+}
+
+// "10.0.0.0/8", "::1" or "fe80::/10"
+static int parse_cidr(const char *v, JsAddr *net, int *prefix) {
+    char buf[INET6_ADDRSTRLEN + 8];
+    snprintf(buf, sizeof(buf), "%s", v);
+    char *slash = strchr(buf, '/');
+    if (slash) *slash++ = 0;
+    memset(net, 0, sizeof(*net));
+    int max;
+    if (inet_pton(AF_INET, buf, net->addr) == 1) {
+        net->family = AF_INET;
+        max = 32;
+    } else if (inet_pton(AF_INET6, buf, net->addr) == 1) {
+        net->family = AF_INET6;
+        max = 128;
+    } else {
+        return -1;
+    }
+    *prefix = max;
+    if (slash) {
+        char *end;
+        long p = strtol(slash, &end, 10);
+        if (end == slash || *end || p < 0 || p > max) return -1;
+        *prefix = (int)p;
+    }
+    return 0;
+}
+
+static int parse_cmp(Parser *ps) {
+    char name[32], val[64];
+    const char *start = ps->p;
+    if (read_word(ps, name, sizeof(name)) == 0) return fail(ps, "expected a field");
+    int field = -1;
+    for (size_t i = 0; i < sizeof(filter_fields) / sizeof(filter_fields[0]); i++)
+        if (strcasecmp(name, filter_fields[i].name) == 0) field = filter_fields[i].field;
+    if (field < 0) {
+        ps->p = start;
+        return fail(ps, "unknown field");
+    }
+
+    int op;
+    skip_ws(ps);
+    if (accept_kw(ps, "in", NULL)) op = OP_IN;
+    else if (strncmp(ps->p, "!=", 2) == 0) { op = OP_NE; ps->p += 2; }
+    else if (strncmp(ps->p, "<=", 2) == 0) { op = OP_LE; ps->p += 2; }
+    else if (strncmp(ps->p, ">=", 2) == 0) { op = OP_GE; ps->p += 2; }
+    else if (strncmp(ps->p, "==", 2) == 0) { op = OP_EQ; ps->p += 2; }
+    else if (*ps->p == '=') { op = OP_EQ; ps->p++; }
+    else if (*ps->p == '<') { op = OP_LT; ps->p++; }
+    else if (*ps->p == '>') { op = OP_GT; ps->p++; }
+    else if (*ps->p == '~') { op = OP_SUB; ps->p++; }
+    else return fail(ps, "expected an operator");
+
+    if (read_word(ps, val, sizeof(val)) == 0) return fail(ps, "expected a value");
+    int id = new_node(ps, N_CMP);
+    if (id < 0) return -1;
+    FilterNode *n = &ps->f->nodes[id];
+    n->field = field;
+    n->op = op;
+
+    int ordered = op == OP_LT || op == OP_LE || op == OP_GT || op == OP_GE;
+    switch (field) {
+        case F_COMM: case F_PATH:
+            if (ordered || op == OP_IN) return fail(ps, "strings take =, != or ~");
+            snprintf(n->str, sizeof(n->str), "%s", val);
+            break;
+        case F_LADDR: case F_RADDR: case F_ADDR:
+            if (ordered || op == OP_SUB) return fail(ps, "addresses take =, != or in");
+            if (parse_cidr(val, &n->net, &n->prefix) < 0) return fail(ps, "bad address");
+            break;
+        case F_STATE:
+            if (op != OP_EQ && op != OP_NE) return fail(ps, "state takes = or !=");
+            if ((n->num = parse_state(val)) < 0) return fail(ps, "unknown state");
+            break;
+        case F_TYPE:
+            if (op != OP_EQ && op != OP_NE) return fail(ps, "type takes = or !=");
+            if ((n->num = parse_type(val)) < 0) return fail(ps, "unknown type");
+            break;
+        default: {
+            if (op == OP_SUB || op == OP_IN) return fail(ps, "numbers take = != < <= > >=");
+            char *end;
+            n->num = strtoll(val, &end, 0);
+            if (end == val || *end) return fail(ps, "expected a number");
+        }
+    }
+    return id;
+}
+
+static int parse_or(Parser *ps);
+
+static int parse_unary(Parser *ps) {
+    if (ps->depth == FILTER_MAX_DEPTH) return fail(ps, "too deeply nested");
+    if (accept_kw(ps, "not", "!")) {
+        ps->depth++;
+        int a = parse_unary(ps);
+        ps->depth--;
+        if (a < 0) return -1;
+        int id = new_node(ps, N_NOT);
+        if (id >= 0) ps->f->nodes[id].a = a;
+        return id;
+    }
+    skip_ws(ps);
+    if (*ps->p == '(') {
+        ps->p++;
+        ps->depth++;
+        int a = parse_or(ps);
+        ps->depth--;
+        if (a < 0) return -1;
+        skip_ws(ps);
+        if (*ps->p != ')') return fail(ps, "expected ')'");
+        ps->p++;
+        return a;
+    }
+    return parse_cmp(ps);
+}
+
+static int parse_and(Parser *ps) {
+    int a = parse_unary(ps);
+    while (a >= 0 && accept_kw(ps, "and", "&&")) {
+        int b = parse_unary(ps);
+        if (b < 0) return -1;
+        int id = new_node(ps, N_AND);
+        if (id < 0) return -1;
+        ps->f->nodes[id].a = a;
+        ps->f->nodes[id].b = b;
+        a = id;
+    }
+    return a;
+}
+
+static int parse_or(Parser *ps) {
+    int a = parse_and(ps);
+    while (a >= 0 && accept_kw(ps, "or", "||")) {
+        int b = parse_and(ps);
+        if (b < 0) return -1;
+        int id = new_node(ps, N_OR);
+        if (id < 0) return -1;
+        ps->f->nodes[id].a = a;
+        ps->f->nodes[id].b = b;
+        a = id;
+    }
+    return a;
+}
+
+// Compile expr; on error returns NULL with a message in err
+Filter *filter_compile(const char *expr, char *err, size_t errlen) {
+    Filter *f = calloc(1, sizeof(Filter));
+    if (!f) {
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+    if (err && errlen) err[0] = 0;
+    Parser ps = { .p = expr, .f = f, .err = err, .errlen = errlen };
+    f->root = parse_or(&ps);
+    skip_ws(&ps);
+    if (f->root >= 0 && *ps.p) f->root = fail(&ps, "unexpected text");
+    if (f->root < 0) {
+        free(f);
+        return NULL;
+    }
+    return f;
+}
+
+void filter_free(Filter *f) {
+    free(f);
+}
+
+static int cmp_num(long long v, int op, long long want) {
+    switch (op) {
+        case OP_EQ: return v == want;
+        case OP_NE: return v != want;
+        case OP_LT: return v < want;
+        case OP_LE: return v <= want;
+        case OP_GT: return v > want;
+        case OP_GE: return v >= want;
+    }
+    return 0;
+}
+
+static int addr_in(const JsAddr *a, const JsAddr *net, int prefix) {
+    if (a->family != net->family) return 0;
+    int full = prefix / 8, bits = prefix % 8;
+    if (memcmp(a->addr, net->addr, full) != 0) return 0;
+    if (bits == 0) return 1;
+    unsigned char mask = (unsigned char)(0xFF << (8 - bits));
+    return (a->addr[full] & mask) == (net->addr[full] & mask);
+}
+
+static int cmp_addr(const JsAddr *a, const FilterNode *n) {
+    int in = addr_in(a, &n->net, n->prefix);
+    return n->op == OP_NE ? !in : in;
+}
+
+static int socket_type(const SockInfo *si) {
+    if (!si) return TYPE_VALUE(SOCK_PROTO_NONE, 0);
+    if (si->local.family == AF_INET) return TYPE_VALUE(si->proto, 4);
+    if (si->local.family == AF_INET6) return TYPE_VALUE(si->proto, 6);
+    return TYPE_VALUE(si->proto, 0);
+}
+
+static int is_tcpinfo_field(int field) {
+    return field == F_RTT || field == F_RTTVAR || field == F_CWND || field == F_RETRANS;
+}
+
+// Whether f compares a tcp_info field: the index must then ask sock_diag
+// for it (SockIndex.want_tcpinfo)
+int filter_wants_tcpinfo(const Filter *f) {
+    if (!f) return 0;
+    for (int i = 0; i < f->count; i++)
+        if (f->nodes[i].kind == N_CMP && is_tcpinfo_field(f->nodes[i].field)) return 1;
+    return 0;
+}
+
+static int eval_cmp(const FilterNode *n, const FilterCtx *c) {
+    if (!(c->known & field_level(n->field))) return FILTER_MAYBE;
+    const SockInfo *si = c->si;
+    // Sockets missing from the tables only answer pid, comm, fd, inode and type
+    if (!si && n->field != F_PID && n->field != F_COMM && n->field != F_FD &&
+        n->field != F_INODE && n->field != F_TYPE)
+        return FILTER_NO;
+    // Nor does tcp_info exist for anything but TCP read through sock_diag
+    if (is_tcpinfo_field(n->field) && !si->has_tcpinfo) return FILTER_NO;
+    int r = 0;
+    switch (n->field) {
+        case F_PID: r = cmp_num(c->pid, n->op, n->num); break;
+        case F_FD: r = cmp_num(c->fd, n->op, n->num); break;
+        case F_INODE: r = cmp_num((long long)c->inode, n->op, n->num); break;
+        case F_UID: r = cmp_num(si->uid, n->op, n->num); break;
+        case F_STATE: r = cmp_num(si->state, n->op, n->num); break;
+        case F_LPORT: r = cmp_num(si->local.port, n->op, n->num); break;
+        case F_RPORT: r = cmp_num(si->remote.port, n->op, n->num); break;
+        case F_TXQ: r = cmp_num(si->tx_queue, n->op, n->num); break;
+        case F_RXQ: r = cmp_num(si->rx_queue, n->op, n->num); break;
+        case F_PORT:
+            r = n->op == OP_NE
+                ? si->local.port != n->num && si->remote.port != n->num
+                : cmp_num(si->local.port, n->op, n->num) || cmp_num(si->remote.port, n->op, n->num);
+            break;
+        case F_LADDR: r = cmp_addr(&si->local, n); break;
+        case F_RADDR: r = cmp_addr(&si->remote, n); break;
+        case F_ADDR:
+            r = n->op == OP_NE ? cmp_addr(&si->local, n) && cmp_addr(&si->remote, n)
+                               : cmp_addr(&si->local, n) || cmp_addr(&si->remote, n);
+            break;
+        case F_PEER: r = cmp_num((long long)si->peer, n->op, n->num); break;
+        case F_RTT: r = cmp_num(si->rtt_us, n->op, n->num); break;
+        case F_RTTVAR: r = cmp_num(si->rttvar_us, n->op, n->num); break;
+        case F_CWND: r = cmp_num(si->snd_cwnd, n->op, n->num); break;
+        case F_RETRANS: r = cmp_num(si->total_retrans, n->op, n->num); break;
+        case F_TYPE: {
+            int t = socket_type(si);
+            int eq = t == n->num || (n->num % 10 == 0 && t / 10 == n->num / 10);
+            r = n->op == OP_NE ? !eq : eq;
+            break;
+        }
+        case F_COMM: case F_PATH: {
+            const char *str = n->field == F_COMM ? c->comm : c->path;
+            if (!str) str = "";
+            if (n->op == OP_SUB) r = strstr(str, n->str) != NULL;
+            else r = (strcmp(str, n->str) == 0) == (n->op == OP_EQ);
+            break;
+        }
+    }
+    return r ? FILTER_YES : FILTER_NO;
+}
+
+// Kleene logic: MAYBE stays MAYBE unless the other side decides
+static int eval_node(const Filter *f, int id, const FilterCtx *c) {
+    const FilterNode *n = &f->nodes[id];
+    switch (n->kind) {
+        case N_AND: {
+            int a = eval_node(f, n->a, c);
+            if (a == FILTER_NO) return FILTER_NO;
+            int b = eval_node(f, n->b, c);
+            if (b == FILTER_NO) return FILTER_NO;
+            return a == FILTER_YES && b == FILTER_YES ? FILTER_YES : FILTER_MAYBE;
+        }
+        case N_OR: {
+            int a = eval_node(f, n->a, c);
+            if (a == FILTER_YES) return FILTER_YES;
+            int b = eval_node(f, n->b, c);
+            if (b == FILTER_YES) return FILTER_YES;
+            return a == FILTER_NO && b == FILTER_NO ? FILTER_NO : FILTER_MAYBE;
+        }
+        case N_NOT: {
+            int a = eval_node(f, n->a, c);
+            return a == FILTER_MAYBE ? FILTER_MAYBE : (a == FILTER_YES ? FILTER_NO : FILTER_YES);
+        }
+        default:
+            return eval_cmp(n, c);
+    }
+}
+
+// FILTER_NO / FILTER_YES, or FILTER_MAYBE when it depends on what c->known
+// doesn't cover yet. A NULL filter accepts everything.
+int filter_eval(const Filter *f, const FilterCtx *c) {
+    if (!f) return FILTER_YES;
+    return eval_node(f, f->root, c);
+}
@@ -0,0 +1,160 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+// Cache of duplicated sockets keyed by (pid, fd, inode).
+// The pidfd and our duplicate stay open across commands, so repeated
+// send/rec cost no pidfd_open/pidfd_getfd and are immune to the target
+// recycling the fd number: the inode pins the socket we looked at.
+
+static SockHandle **handles;   // individually allocated, pointers stay valid
+static size_t handle_count;
+static size_t handle_cap;
+
+void handle_close(SockHandle *h) {
+    if (h->sockfd >= 0) close(h->sockfd);
+    if (h->pidfd >= 0) close(h->pidfd);
+}
+
+static void handle_remove(size_t i) {
+    handle_close(handles[i]);
+    free(handles[i]);
+    handles[i] = handles[--handle_count];
+}
+
+// A pidfd polls readable once the process has exited
+int handle_exited(const SockHandle *h) {
+    struct pollfd pfd = { .fd = h->pidfd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Duplicate pid's fd into h, uncached. inode 0 means "whatever socket the
+// fd refers to right now". Returns 0, or -errno: EINVAL for a bad pid/fd,
+// ESRCH for no such process, ENOTSOCK when the fd is no socket, ESTALE
+// when it no longer is the socket with that inode, else what
+// pidfd_open/pidfd_getfd failed with.
+int handle_open(SockHandle *h, pid_t pid, int fd, unsigned long long inode) {
+    if (pid <= 0 || fd < 0) return -EINVAL;
+    if (inode == 0 && get_socket_inode_from_fd(pid, fd, &inode) < 0)
+        return kill(pid, 0) < 0 && errno == ESRCH ? -ESRCH : -ENOTSOCK;
+    int pidfd = pidfd_open(pid, 0);
+    if (pidfd < 0) return -errno;
+    int sockfd = pidfd_getfd(pidfd, fd, 0);
+    if (sockfd < 0) {
+        int e = errno;
+        close(pidfd);
+        return -e;
+    }
+    struct stat st;
+    if (fstat(sockfd, &st) < 0 || !S_ISSOCK(st.st_mode) || st.st_ino != inode) {
+        close(sockfd);
+        close(pidfd);
+        return -ESTALE;
+    }
+    h->pid = pid;
+    h->fd = fd;
+    h->inode = inode;
+    h->pidfd = pidfd;
+    h->sockfd = sockfd;
+    socklen_t len = sizeof(h->type);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_TYPE, &h->type, &len) < 0) h->type = SOCK_STREAM;
+    return 0;
+}
+
+// Find or open the cached duplicate of pid's fd. inode 0 means "whatever
+// socket the fd refers to right now". Returns 0, or -errno as handle_open
+// does, ESRCH also when a cached handle's process has exited.
+int handle_find(pid_t pid, int fd, unsigned long long inode, SockHandle **out) {
+    if (pid <= 0 || fd < 0) return -EINVAL;
+    if (inode == 0 && get_socket_inode_from_fd(pid, fd, &inode) < 0)
+        return kill(pid, 0) < 0 && errno == ESRCH ? -ESRCH : -ENOTSOCK;
+    for (size_t i = 0; i < handle_count; i++) {
+        SockHandle *h = handles[i];
+        if (h->pid != pid || h->fd != fd) continue;
+        if (h->inode == inode) {
+            if (!handle_exited(h)) {
+                *out = h;
+                return 0;
+            }
+            handle_remove(i);
+            return -ESRCH;
+        }
+        // Same fd number now names another socket: the old one is stale
+        handle_remove(i);
+        break;
+    }
+
+    SockHandle *h = calloc(1, sizeof(SockHandle));
+    if (h && handle_count == handle_cap) {
+        size_t newcap = handle_cap ? handle_cap * 2 : 16;
+        SockHandle **hs = realloc(handles, newcap * sizeof(SockHandle *));
+        if (hs) {
+            handles = hs;
+            handle_cap = newcap;
+        }
+    }
+    if (!h || handle_count == handle_cap) {
+        free(h);
+        return -ENOMEM;
+    }
+    int rv = handle_open(h, pid, fd, inode);
+    if (rv < 0) {
+        free(h);
+        return rv;
+    }
+    handles[handle_count++] = h;
+    *out = h;
+    return 0;
+}
+
+// handle_find, telling why on stderr when it fails
+SockHandle *handle_get(pid_t pid, int fd, unsigned long long inode) {
+    SockHandle *h = NULL;
+    int rv = handle_find(pid, fd, inode, &h);
+    if (rv == 0) return h;
+    if (rv == -EINVAL)
+        fprintf(stderr, "Invalid pid/fd\n");
+    else if (rv == -ENOTSOCK)
+        fprintf(stderr, "PID %d FD %d is not a socket\n", pid, fd);
+    else if (rv == -ESRCH)
+        fprintf(stderr, "PID %d has exited\n", pid);
+    else if (rv == -ESTALE)
+        fprintf(stderr, "PID %d FD %d no longer refers to socket inode %llu\n", pid, fd, inode);
+    else
+        fprintf(stderr, "Cannot duplicate PID %d FD %d: %s\n", pid, fd, strerror(-rv));
+    return NULL;
+}
+
+// Number of cached handles
+size_t handle_cached(void) {
+    return handle_count;
+}
+
+// Drop the cached handle of pid's fd, returns the number released
+int handle_release(pid_t pid, int fd) {
+    for (size_t i = 0; i < handle_count; i++) {
+        if (handles[i]->pid == pid && handles[i]->fd == fd) {
+            handle_remove(i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int handle_release_all(void) {
+    int n = (int)handle_count;
+    for (size_t i = 0; i < handle_count; i++) {
+        handle_close(handles[i]);
+        free(handles[i]);
+    }
+    free(handles);
+    handles = NULL;
+    handle_count = handle_cap = 0;
+    return n;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include "jinsock.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -9,7 +10,7 @@
 #include <ctype.h>
 #include <sys/socket.h>
 #include <sys/types.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <linux/limits.h>
 #include <linux/net.h>
 #include <sys/stat.h>
@@ -25,344 +26,364 @@
 #define __NR_pidfd_getfd 438
 #endif
 
-SocketEntry entries[MAX_ENTRIES];
-int entry_count = 0;
-
-
-void trim_newline(char *s) {
-    size_t len = strlen(s);
-    if (len > 0 && s[len-1] == '\n') s[len-1] = 0;
-}
+ResultStore results;
 
 void cmd_help() {
     printf(
         "Commands:\n"
         "  help                 - Show this help\n"
         "  search [pattern]     - List sockets, optionally filter by pid or process name\n"
+        "  watch [pattern] [--interval ms] [--count n]\n"
+        "                       - Repeat search, print only opened/closed/changed sockets\n"
         "  select <index>       - Select a socket from the search results\n"
+        "  attach <pid> <fd>    - Select a socket by pid and fd, without searching\n"
         "  send <string>        - Send string to selected socket\n"
-        "  sendf <file>         - Send file content to selected socket\n"
+        "  send [--repeat N] [--rate R] [--batch K] <string>\n"
+        "                       - Load mode: N copies paced at R (50M = bytes/s, 1000msg =\n"
+        "                         msg/s), K per writev; prints throughput and latency\n"
+        "  sendx <string>       - Send string with \\n \\r \\t \\0 \\xHH escapes decoded\n"
+        "  sendto [opts] <addr> <string>\n"
+        "                       - Send one datagram (escapes decoded) to ip:port, [ip6]:port,\n"
+        "                         /unix/path or @abstract; opts as for send\n"
+        "  sendf [--rate R] <file> - Send file content to selected socket, paced at R bytes/s\n"
         "  rec [file]           - Receive from socket with timeout, output to stdout or file\n"
-        "  timeout <seconds>    - Set receive timeout (default 5 sec)\n"
+        "  record [on|off]      - rec writes timestamped chunks (a record) instead of raw bytes\n"
+        "  ring [NxSIZE|off]    - rec <prefix> fills N preallocated SIZE-byte files in rotation\n"
+        "                         from a writer thread, e.g. ring 8x256M\n"
+        "  replay [--speed X] [--from T] <file>\n"
+        "                       - Send a record again with its original timing, X times\n"
+        "                         faster (0 = no waits), starting T into the capture\n"
+        "  peek [--interval T] [--count N] [--bytes SIZE] [file]\n"
+        "                       - Sample queue depths and the receive queue head (MSG_PEEK),\n"
+        "                         consuming nothing; new heads go to file if given\n"
+        "  expect <string>      - Read until string (escapes decoded) arrives, within timeout\n"
+        "  wait-for-bytes <n>   - Read and discard exactly n bytes (k/M/G suffixes)\n"
+        "  sleep <t>            - Pause: seconds, or with ms/s suffix\n"
+        "  timeout <t>          - Set receive timeout: seconds, or with ms/s suffix (default 5s)\n"
+        "  flush <mode>         - rec output flushing: auto, chunk, end\n"
+        "  fsync <mode>         - rec file fsync: none, close, or every N bytes (e.g. 64M)\n"
+        "  bridge [index] <addr>\n"
+        "                       - Serve a search result (default: selected) on a local\n"
+        "                         listener (port, ip:port, /path, @name): clients talk\n"
+        "                         through it, bytes spliced both ways\n"
+        "  tap <sel> [dir]      - Receive from many sockets at once (sel: all, pid=N, 0,2,5-9)\n"
+        "                         as tagged records on stdout or one file per socket in dir\n"
+        "  stats [--interval T] [--count N] [sel]\n"
+        "                       - Sample TCP_INFO, queue depths and SO_MEMINFO of the selected\n"
+        "                         socket or of search results (sel as for tap)\n"
+        "  release [index|all]  - Close cached socket handle(s), default: selected\n"
+        "  backend [name]       - Show or set discovery backend: auto, netlink, proc\n"
+        "  engine [name]        - Show or set I/O engine: sync, uring\n"
+        "  filter [expr|off]    - Show or set the search/watch filter, e.g.\n"
+        "                         rport=5432 and state=ESTABLISHED and raddr in 10.0.0.0/8\n"
+        "  format [name]        - Show or set search output: text, jsonl, csv, bin\n"
+        "                         (all but text stream as found and keep no results)\n"
+        "  threads <n>          - Set search worker threads (0 = one per cpu)\n"
+        "  profile [on|off|reset] - Show profiling counters (calls, time, bytes per search\n"
+        "                         phase and syscall), or switch them on/off, or zero them\n"
         "  quit                 - Exit\n"
     );
 }
 
-int parse_ip_port(const char *hexipport, char *ipbuf, size_t ipbuflen, int *port) {
-    // hexipport format: "0100007F:1F90" (IP:port in hex)
-    unsigned int p;
-    if (strlen(hexipport) < 13) return -1;
-    char ip_hex[9] = {0};
-    strncpy(ip_hex, hexipport, 8);
-    sscanf(hexipport, "%8X:%X", &p, &p);
-    if (sscanf(hexipport, "%8X:%X", &p, &p) != 2) return -1;
-
-    // Parse IP and port:
-    unsigned int ipval, portval;
-    if (sscanf(hexipport, "%8X:%X", &ipval, &portval) != 2) return -1;
-
-    // ipval is in little endian hex, convert to IP string:
-    unsigned char bytes[4];
-    bytes[0] = (ipval >> 0) & 0xFF;
-    bytes[1] = (ipval >> 8) & 0xFF;
-    bytes[2] = (ipval >> 16) & 0xFF;
-    bytes[3] = (ipval >> 24) & 0xFF;
-
-    snprintf(ipbuf, ipbuflen, "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
-    *port = portval;
-    return 0;
-}
-
-int parse_ipv6_port(const char *hexipport, char *ipbuf, size_t ipbuflen, int *port) {
-    // Format: 32 hex digits for IPv6 + :port (e.g. "00000000000000000000000000000001:1F90")
-    if (strlen(hexipport) < 37) return -1;
-    char iphex[33];
-    strncpy(iphex, hexipport, 32);
-    iphex[32] = 0;
-    sscanf(hexipport + 33, "%X", port);
-
-    unsigned char ip[16];
-    for (int i=0; i<16; i++) {
-        char bytehex[3] = {iphex[i*2], iphex[i*2+1], 0};
-        ip[15-i] = (unsigned char)strtol(bytehex, NULL, 16);
+// Extract remote IP/port of a single socket inode from pid's namespace tables.
+// One-off lookup: cmd_search shares a SockIndex across pids instead.
+int get_remote_addr_from_inode(pid_t pid, unsigned long long inode, char *ipbuf, size_t ipbuflen, int *port) {
+    NetnsIndex ns;
+    memset(&ns, 0, sizeof(ns));
+    if (netns_index_load(&ns, pid, discovery_backend, 0) < 0) return -1;
+    const SockInfo *si = netns_index_lookup(&ns, inode);
+    int ret = -1;
+    if (si) {
+        ret = format_addr(&si->remote, ipbuf, ipbuflen);
+        *port = si->remote.port;
     }
-    inet_ntop(AF_INET6, ip, ipbuf, ipbuflen);
-    return 0;
+    netns_index_free(&ns);
+    return ret;
 }
 
-// Check if the socket inode matches one from /proc/pid/fd/<fd>
-int get_socket_inode_from_fd(pid_t pid, int fd, unsigned long long *inode) {
-    char fdlink[PATH_MAX];
-    char linktarget[PATH_MAX];
-    snprintf(fdlink, sizeof(fdlink), "/proc/%d/fd/%d", pid, fd);
-    ssize_t r = readlink(fdlink, linktarget, sizeof(linktarget)-1);
-    if (r < 0) return -1;
-    linktarget[r] = 0;
-    // Expected format: "socket:[1234567]"
-    unsigned long long ino = 0;
-    if (sscanf(linktarget, "socket:[%llu]", &ino) == 1) {
-        *inode = ino;
-        return 0;
+// Parse a selection of search results into result indices:
+//   all | pid=<pid> | comma separated indices and ranges ("0,3,7-9")
+int parse_selection(const ResultStore *rs, const char *spec, size_t **out, size_t *nout) {
+    size_t *idx = NULL, n = 0, cap = 0;
+    int ok = 1;
+    int all = strcmp(spec, "all") == 0;
+    pid_t pid;
+    int used = 0;
+    if (all || (sscanf(spec, "pid=%d%n", &pid, &used) == 1 && spec[used] == 0)) {
+        for (size_t i = 0; i < rs->count; i++) {
+            if (!all && rs->items[i].pid != pid) continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 16;
+                size_t *np = realloc(idx, cap * sizeof(size_t));
+                if (!np) { ok = 0; break; }
+                idx = np;
+            }
+            idx[n++] = i;
+        }
+    } else {
+        const char *p = spec;
+        while (ok && *p) {
+            char *end;
+            long lo = strtol(p, &end, 10), hi = lo;
+            if (end == p) { ok = 0; break; }
+            p = end;
+            if (*p == '-') {
+                hi = strtol(p + 1, &end, 10);
+                if (end == p + 1) { ok = 0; break; }
+                p = end;
+            }
+            if (lo < 0 || hi < lo || (size_t)hi >= rs->count) { ok = 0; break; }
+            for (long i = lo; ok && i <= hi; i++) {
+                if (n == cap) {
+                    cap = cap ? cap * 2 : 16;
+                    size_t *np = realloc(idx, cap * sizeof(size_t));
+                    if (!np) { ok = 0; break; }
+                    idx = np;
+                }
+                idx[n++] = i;
+            }
+            if (*p == ',') p++;
+            else if (*p) ok = 0;
+        }
     }
-    return -1;
-}
-
-int load_proc_name(pid_t pid, char *buf, size_t buflen) {
-    char path[PATH_MAX];
-    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
-    FILE *f = fopen(path, "r");
-    if (!f) return -1;
-    if (!fgets(buf, buflen, f)) {
-        fclose(f);
+    if (!ok || n == 0) {
+        free(idx);
         return -1;
     }
-    trim_newline(buf);
-    fclose(f);
+    *out = idx;
+    *nout = n;
     return 0;
 }
 
-// Extract remote IP/port from /proc/<pid>/net/tcp or tcp6 by inode
-int get_remote_addr_from_inode(pid_t pid, unsigned long long inode, char *ipbuf, size_t ipbuflen, int *port) {
-    char path[PATH_MAX];
-    snprintf(path, sizeof(path), "/proc/%d/net/tcp", pid);
-    FILE *f = fopen(path, "r");
-    if (!f) {
-        // Try tcp6
-        snprintf(path, sizeof(path), "/proc/%d/net/tcp6", pid);
-        f = fopen(path, "r");
-        if (!f) return -1;
-    }
-    char line[512];
-    fgets(line, sizeof(line), f); // skip header
-    while (fgets(line, sizeof(line), f)) {
-        unsigned int sl;
-        char local_addr[64], rem_addr[64], st[8], tx_queue[16], rx_queue[16], tr[8], tm_when[16], retrnsmt[16];
-        unsigned long long local_inode;
-        // Format from /proc/net/tcp:
-        // sl  local_address rem_address st tx_queue rx_queue tr tm->when retrnsmt   uid  timeout inode
-        // We only need rem_address, inode
-        if (sscanf(line,
-            "%u: %63s %63s %7s %15s %15s %7s %15s %15s %*u %*u %llu",
-            &sl, local_addr, rem_addr, st, tx_queue, rx_queue, tr, tm_when, retrnsmt, &local_inode) == 10) {
-            if (local_inode == inode) {
-                fclose(f);
-                // Parse rem_address: port is hex after ':'
-                if (strlen(rem_addr) == 13) {
-                    // IPv4 case
-                    return parse_ip_port(rem_addr, ipbuf, ipbuflen, port);
-                } else if (strlen(rem_addr) == 37) {
-                    return parse_ipv6_port(rem_addr, ipbuf, ipbuflen, port);
-                }
-                return -1;
-            }
-        }
-    }
-    fclose(f);
-    return -1;
+// The library only reports a thread stuck in another network namespace
+// after a netlink query; js5 can't go on, its later sockets (bridge,
+// daemon) would be opened in that namespace
+void exit_if_netns_stuck(void) {
+    int err = sockdiag_netns_stuck();
+    if (!err) return;
+    fprintf(stderr, "setns restore: %s\n", strerror(err));
+    exit(1);
 }
 
 void cmd_search(const char *pattern) {
-    entry_count = 0;
-    DIR *proc = opendir("/proc");
-    if (!proc) {
-        perror("opendir /proc");
-        return;
-    }
-    struct dirent *dent;
-    while ((dent = readdir(proc)) != NULL) {
-        if (!isdigit(dent->d_name[0])) continue;
-        pid_t pid = atoi(dent->d_name);
-
-        char proc_name[256] = {0};
-        load_proc_name(pid, proc_name, sizeof(proc_name));
-
-        if (pattern && *pattern) {
-            // Filter by pid or process name substring (case-insensitive)
-            int match = 0;
-            if (strstr(proc_name, pattern)) match = 1;
-            else {
-                char pidstr[32];
-                snprintf(pidstr, sizeof(pidstr), "%d", pid);
-                if (strstr(pidstr, pattern)) match = 1;
-            }
-            if (!match) continue;
-        }
-
-        // List fd entries
-        char fd_dir[PATH_MAX];
-        snprintf(fd_dir, sizeof(fd_dir), "/proc/%d/fd", pid);
-        DIR *fdp = opendir(fd_dir);
-        if (!fdp) continue;
-        struct dirent *fdent;
-        while ((fdent = readdir(fdp)) != NULL) {
-            if (fdent->d_name[0] == '.') continue;
-            int fd = atoi(fdent->d_name);
-            unsigned long long inode;
-            if (get_socket_inode_from_fd(pid, fd, &inode) == 0) {
-                if (entry_count >= MAX_ENTRIES) {
-                    closedir(fdp);
-                    closedir(proc);
-                    printf("Too many entries, truncated\n");
-                    return;
-                }
-                SocketEntry *e = &entries[entry_count];
-                e->pid = pid;
-                e->fd = fd;
-                strncpy(e->proc_name, proc_name, sizeof(e->proc_name)-1);
-                e->proc_name[sizeof(e->proc_name)-1] = 0;
-                if (get_remote_addr_from_inode(pid, inode, e->rem_addr, sizeof(e->rem_addr), &e->rem_port) == 0) {
-                    // Success, leave rem_addr, rem_port set
-                } else {
-                    strncpy(e->rem_addr, "?", sizeof(e->rem_addr));
-                    e->rem_port = 0;
-                }
-                entry_count++;
-            }
-        }
-        closedir(fdp);
+    // A selection indexes the old results
+    selected_fd = -1;
+    result_store_free(&results);
+    SearchOpts o = {
+        .pattern = pattern,
+        .filter = search_filter,
+        .backend = discovery_backend,
+        .threads = search_threads,
+        .format = output_format
+    };
+    if (search_run(&o, &results) < 0) {
+        perror("search");
+        exit_if_netns_stuck();
     }
-    closedir(proc);
+    // Streamed formats were written during the walk
+    if (output_format == OUTPUT_TEXT) print_results();
+}
 
-    printf("Found %d socket(s):\n", entry_count);
-    for (int i=0; i<entry_count; i++) {
-        SocketEntry *e = &entries[i];
-        printf("[%d] PID=%d (%s) FD=%d -> %s:%d\n", i, e->pid, e->proc_name, e->fd, e->rem_addr, e->rem_port);
-    }
+void print_results(void) {
+    long long t0 = prof_begin();
+    printf("Found %zu socket(s):\n", results.count);
+    fflush(stdout);
+    OutBuf ob = { 0 };
+    for (size_t i = 0; i < results.count; i++)
+        output_text_entry(&ob, i, &results, &results.items[i]);
+    output_free(&ob);
+    prof_end(PROF_PRINT, t0, results.count);
 }
 
-int dup_socket_and_send(int pid, int fd, const char *data, size_t datalen) {
-    if (pid <= 0 || fd < 0) {
-        fprintf(stderr, "Invalid pid/fd\n");
-        return -1;
-    }
-    int pidfd = pidfd_open(pid, 0);
-    if (pidfd < 0) {
-        perror("pidfd_open");
-        return -1;
-    }
-    int sockfd = pidfd_getfd(pidfd, fd, 0);
-    if (sockfd < 0) {
-        perror("pidfd_getfd");
-        close(pidfd);
-        return -1;
-    }
-    ssize_t sent = send(sockfd, data, datalen, 0);
+ssize_t dup_socket_and_send(int pid, int fd, unsigned long long inode, const char *data, size_t datalen) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    ssize_t sent = XFER_UNSUPPORTED;
+    if (io_engine == ENGINE_URING) sent = uring_send(h->sockfd, data, datalen);
+    if (sent == XFER_UNSUPPORTED) sent = write_all(h->sockfd, data, datalen);
     if (sent < 0) perror("send");
-    close(sockfd);
-    close(pidfd);
     return sent;
 }
 
-int dup_socket_and_sendfile(int pid, int fd, const char *filepath) {
-    int f = open(filepath, O_RDONLY);
-    if (f < 0) {
-        perror("open file");
-        return -1;
-    }
-    int pidfd = pidfd_open(pid, 0);
-    if (pidfd < 0) {
-        perror("pidfd_open");
-        close(f);
+// rate > 0 paces the transfer in bytes per second
+ssize_t dup_socket_and_sendfile(int pid, int fd, unsigned long long inode, const char *filepath, double rate) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    if (handle_is_dgram(h)) {
+        fprintf(stderr, "sendf needs a stream socket, use send or sendto on datagram sockets\n");
         return -1;
     }
-    int sockfd = pidfd_getfd(pidfd, fd, 0);
-    if (sockfd < 0) {
-        perror("pidfd_getfd");
-        close(f);
-        close(pidfd);
+    int f = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (f < 0) {
+        perror("open file");
         return -1;
     }
-    char buf[4096];
-    ssize_t n;
-    ssize_t total_sent = 0;
-    while ((n = read(f, buf, sizeof(buf))) > 0) {
-        ssize_t sent = send(sockfd, buf, n, 0);
-        if (sent < 0) {
-            perror("send");
-            close(f);
-            close(sockfd);
-            close(pidfd);
-            return -1;
-        }
-        total_sent += sent;
-    }
+    long long start = now_ns();
+    ssize_t total_sent = XFER_UNSUPPORTED;
+    if (rate > 0) total_sent = xfer_file_paced(h->sockfd, f, rate);
+    else if (io_engine == ENGINE_URING) total_sent = uring_file_to_socket(h->sockfd, f);
+    if (total_sent == XFER_UNSUPPORTED) total_sent = xfer_file_to_socket(h->sockfd, f);
+    if (total_sent < 0) perror("sendf");
+    else print_throughput("Sent", total_sent, now_ns() - start);
     close(f);
-    close(sockfd);
-    close(pidfd);
     return total_sent;
 }
 
-int dup_socket_and_recv(int pid, int fd, const char *outfile) {
-    int pidfd = pidfd_open(pid, 0);
-    if (pidfd < 0) {
-        perror("pidfd_open");
-        return -1;
+// Sync engine receive loop: poll, then splice/recv whatever is ready
+static int poll_recv_to_sink(int sockfd, RecvSink *sink, long long *last) {
+    // recv_timeout_ms is an idle timeout: every chunk restarts it
+    while (1) {
+        if (wait_fd(sockfd, POLLIN, recv_timeout_ms) < 0) {
+            if (errno == ETIMEDOUT) return RECV_TIMEOUT;
+            perror("poll");
+            return RECV_ERROR;
+        }
+        ssize_t n = recv_sink_pull(sink, sockfd);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            perror("recv");
+            return RECV_ERROR;
+        } else if (n == 0) {
+            return RECV_CLOSED;
+        }
+        *last = now_ns();
     }
-    int sockfd = pidfd_getfd(pidfd, fd, 0);
-    if (sockfd < 0) {
-        perror("pidfd_getfd");
-        close(pidfd);
+}
+
+int dup_socket_and_recv(int pid, int fd, unsigned long long inode, const char *outfile) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    int sockfd = h->sockfd;
+
+    RecvSink sink;
+    if (recv_sink_open(&sink, outfile) < 0) return -1;
+    if (rec_record && recv_sink_record(&sink, h) < 0) {
+        perror("write output");
+        recv_sink_close(&sink);
         return -1;
     }
+    long long start = now_ns(), last = start, datagrams = -1;
 
-    fd_set readfds;
-    struct timeval tv;
-    tv.tv_sec = recv_timeout_sec;
-    tv.tv_usec = 0;
-
-    FILE *outf = NULL;
-    if (outfile) {
-        outf = fopen(outfile, "wb");
-        if (!outf) {
-            perror("fopen output");
-            close(sockfd);
-            close(pidfd);
-            return -1;
-        }
+    int why = XFER_UNSUPPORTED;
+    if (handle_is_dgram(h)) {
+        // Files get one framed record per datagram, unless --record already
+        // keeps the boundaries; no io_uring path here
+        datagrams = 0;
+        why = dgram_recv_to_sink(h, &sink, outfile != NULL && !rec_record, &last, &datagrams);
+    } else if (io_engine == ENGINE_URING) {
+        why = uring_recv_to_sink(sockfd, &sink, &last);
+    }
+    if (why == XFER_UNSUPPORTED) why = poll_recv_to_sink(sockfd, &sink, &last);
+    if (why == RECV_TIMEOUT) {
+        char t[32];
+        format_timeout(recv_timeout_ms, t, sizeof(t));
+        printf("Timeout expired (%s)\n", t);
+    } else if (why == RECV_CLOSED) {
+        printf("Connection closed by peer\n");
     }
+    recv_sink_close(&sink);
+
+    if (datagrams >= 0) printf("Received %lld bytes in %lld datagram(s)\n", sink.total, datagrams);
+    else printf("Received %lld bytes\n", sink.total);
+    // Rate up to the last chunk, the trailing idle timeout isn't transfer time
+    if (outfile) print_throughput("Captured", sink.total, last - start);
+    return 0;
+}
 
-    ssize_t total_received = 0;
+#define EXPECT_BUF (64 * 1024)
 
+// Consume input up to and including the first occurrence of pat, within one
+// receive timeout. Queued data is peeked and only the bytes up to the match
+// are read, so whatever follows it is left for the next command. The tail of
+// the consumed data is carried over to catch a match split across chunks.
+// Datagrams are consumed whole: reading part of one would drop the rest.
+long long dup_socket_and_expect(int pid, int fd, unsigned long long inode, const char *pat, size_t patlen) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    char *buf = malloc(EXPECT_BUF + patlen);
+    if (!buf) {
+        perror("malloc");
+        return -1;
+    }
+    size_t carry = 0;
+    long long consumed = 0, matched = -1;
+    long long deadline = now_ns() + recv_timeout_ms * 1000000LL;
     while (1) {
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
-        int rv = select(sockfd + 1, &readfds, NULL, NULL, &tv);
-        if (rv == 0) {
-            printf("Timeout expired (%d seconds)\n", recv_timeout_sec);
+        long long left = (deadline - now_ns()) / 1000000;
+        if (wait_fd(h->sockfd, POLLIN, left > 0 ? (int)left : 0) < 0) {
+            if (errno == ETIMEDOUT) {
+                char t[32];
+                format_timeout(recv_timeout_ms, t, sizeof(t));
+                printf("Timeout expired (%s) after %lld bytes without a match\n", t, consumed);
+            } else {
+                perror("poll");
+            }
+            break;
+        }
+        ssize_t n = recv(h->sockfd, buf + carry, EXPECT_BUF, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            perror("recv");
             break;
-        } else if (rv < 0) {
-            perror("select");
+        }
+        if (n == 0 && handle_eof_on_empty(h)) {
+            printf("Connection closed by peer\n");
+            break;
+        }
+        // The carry is shorter than pat, so a match always ends in new data
+        char *m = memmem(buf, carry + n, pat, patlen);
+        size_t take = m && !handle_is_dgram(h) ? (size_t)(m - buf) + patlen - carry : (size_t)n;
+        ssize_t r = recv(h->sockfd, buf + carry, take, MSG_DONTWAIT);
+        if (r != (ssize_t)take) {
+            // The owner read the peeked bytes before we could
+            printf("Input consumed concurrently by PID %d\n", pid);
+            break;
+        }
+        consumed += take;
+        if (m) {
+            matched = consumed;
             break;
         }
-        if (FD_ISSET(sockfd, &readfds)) {
-            char buf[4096];
-            ssize_t n = recv(sockfd, buf, sizeof(buf), 0);
-            if (n < 0) {
-                perror("recv");
-                break;
-            } else if (n == 0) {
-                printf("Connection closed by peer\n");
-                break;
+        size_t keep = carry + n < patlen - 1 ? carry + n : patlen - 1;
+        memmove(buf, buf + carry + n - keep, keep);
+        carry = keep;
+    }
+    free(buf);
+    return matched;
+}
+
+// Read and discard exactly want bytes, each chunk restarting the timeout
+long long dup_socket_and_drain(int pid, int fd, unsigned long long inode, long long want) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    static char buf[EXPECT_BUF];
+    long long got = 0;
+    while (got < want) {
+        if (wait_fd(h->sockfd, POLLIN, recv_timeout_ms) < 0) {
+            if (errno == ETIMEDOUT) {
+                char t[32];
+                format_timeout(recv_timeout_ms, t, sizeof(t));
+                printf("Timeout expired (%s) after %lld of %lld bytes\n", t, got, want);
             } else {
-                total_received += n;
-                if (outf) {
-                    fwrite(buf, 1, n, outf);
-                    fflush(outf);
-                } else {
-                    fwrite(buf, 1, n, stdout);
-                    fflush(stdout);
-                }
-                tv.tv_sec = recv_timeout_sec;
-                tv.tv_usec = 0;
+                perror("poll");
             }
+            return -1;
         }
+        // Datagrams count whole, possibly past want
+        size_t chunk = want - got < (long long)sizeof(buf) && !handle_is_dgram(h) ? (size_t)(want - got) : sizeof(buf);
+        ssize_t n = recv(h->sockfd, buf, chunk, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) continue;
+            perror("recv");
+            return -1;
+        }
+        if (n == 0 && handle_eof_on_empty(h)) {
+            printf("Connection closed by peer after %lld of %lld bytes\n", got, want);
+            return -1;
+        }
+        got += n;
     }
-    if (outf) fclose(outf);
-    close(sockfd);
-    close(pidfd);
-
-    printf("Received %zd bytes\n", total_received);
-    return 0;
+    return got;
 }
 
 void print_usage() {
@@ -375,10 +396,46 @@ void print_usage() {
         "  -S, --send STRING       Send string to socket\n"
         "  -F, --sendf FILE        Send file content to socket\n"
         "  -r, --rec [FILE]        Receive from socket, output to stdout or FILE if specified\n"
+        "      --peek [FILE]       Sample queue depths and the queue head without reading,\n"
+        "                          every --interval, --count times; new heads to FILE\n"
+        "      --peek-bytes SIZE   Bytes sampled per --peek (default 4k, k/M/G suffixes)\n"
+        "      --stats             Sample TCP_INFO, queue depths and socket memory every\n"
+        "                          --interval, --count times (text, or -o jsonl/csv)\n"
         "  search [pattern]        Search sockets optionally filtering by pattern\n"
+        "  -f, --filter EXPR       search/watch filter (see README), e.g. 'lport=22 and uid=0'\n"
+        "  -o, --format NAME       search output: text (default), jsonl, csv, bin\n"
+        "  watch [pattern]         Search repeatedly and print only changes (Ctrl-C stops)\n"
+        "      --interval T        watch/peek/stats period: milliseconds, or with ms/s suffix (default 1000)\n"
+        "      --count N           Stop watch after N scans\n"
+        "      --repeat N          Send the --send string N times\n"
+        "      --rate R            Pace --send (50M = bytes/s, 1000msg = msg/s) or --sendf\n"
+        "      --batch K           Messages per writev with --repeat (default 64, 1 if paced)\n"
+        "      --to ADDR           Send --send as datagram(s) to ADDR (ip:port, [ip6]:port, path)\n"
+        "  -T, --timeout T         Receive timeout: seconds, or with ms/s suffix (default 5s)\n"
+        "  -b, --backend NAME      Socket discovery backend: auto (default), netlink, proc\n"
+        "  -e, --engine NAME       I/O engine for send/sendf/rec: sync (default), uring\n"
+        "  -t, --threads N         Search worker threads, 0 = one per cpu (default)\n"
+        "      --script FILE       Run shell commands from FILE (- for stdin), stop on error\n"
+        "      --flush MODE        rec output flushing: auto (default), chunk, end\n"
+        "      --fsync MODE        rec file fsync: none (default), close, or every N bytes\n"
+        "      --record            rec writes timestamped chunks (replayable) instead of raw bytes\n"
+        "      --replay FILE       Send a --record capture with its original timing\n"
+        "      --speed X           --replay X times faster, 0 = no waits (default 1)\n"
+        "      --from T            --replay from T into the capture: seconds, or with ms/s suffix\n"
+        "      --ring NxSIZE       rec FILE rotates over N preallocated SIZE-byte files FILE.0..\n"
+        "                          written by a background thread (bounded disk use)\n"
+        "      --ring-cat PREFIX   Write the data of PREFIX.* ring segments to stdout, oldest first\n"
+        "      --bridge ADDR       Serve the socket on a local listener (port, ip:port, /path,\n"
+        "                          @name), splicing bytes between it and each client\n"
+        "      --profile           Count calls, time and bytes per search phase and syscall,\n"
+        "                          report on stderr at exit\n"
+        "      --daemon PATH       Keep the socket snapshot and handles warm, serve requests\n"
+        "                          on the UNIX socket PATH, rescan every --interval\n"
+        "      --connect PATH      Run search, --send or --rec through the daemon at PATH\n"
         "  -h, --help              Show this help\n"
         "\n"
-        "If no arguments are provided, starts interactive shell.\n",
+        "Without --send, --sendf, --rec, --peek, --stats, --replay, --bridge, --script, --daemon, search or watch, starts\n"
+        "the interactive shell.\n",
         "program"
     );
 }
@@ -1,9 +1,14 @@
 #ifndef JINSOCK_H
 #define JINSOCK_H
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <stdio.h>
 
 #ifndef __NR_pidfd_getfd
 #define __NR_pidfd_getfd 438
@@ -20,32 +25,573 @@ static inline int pidfd_getfd(int pidfd, int targetfd, unsigned int flags) {
 static inline int pidfd_open(pid_t pid, unsigned int flags) {
     return syscall(__NR_pidfd_open, pid, flags);
 }
-#define MAX_ENTRIES 1024
+#define MAX_SEARCH_THREADS 256
 
+// Binary endpoint as found in the kernel tables, addr in network byte order
+typedef struct {
+    unsigned short family;
+    unsigned short port;
+    unsigned char addr[16];
+} JsAddr;
+
+// Kernel table a socket was found in
+enum {
+    SOCK_PROTO_NONE,    // in none: netlink, packet, vsock...
+    SOCK_PROTO_TCP,
+    SOCK_PROTO_UDP,
+    SOCK_PROTO_RAW,
+    SOCK_PROTO_UNIX
+};
+
+#define PROTO_BIT(p) (1 << (p))
+#define SOCK_PROTO_ALL (PROTO_BIT(SOCK_PROTO_TCP) | PROTO_BIT(SOCK_PROTO_UDP) | \
+                        PROTO_BIT(SOCK_PROTO_RAW) | PROTO_BIT(SOCK_PROTO_UNIX))
+
+// One row of a namespace's socket tables. States use the TCP numbering for
+// every protocol, as the kernel does: UDP and raw sockets are CLOSE until
+// connected, UNIX ones LISTEN, ESTABLISHED or CLOSE.
+typedef struct {
+    unsigned long long inode;
+    int proto;
+    JsAddr local;               // raw sockets: port is the IP protocol
+    JsAddr remote;
+    unsigned long long peer;    // UNIX peer inode, 0 when unknown
+    unsigned int path;          // UNIX bound path: offset in NetnsIndex.paths, 0 = none
+    int state;
+    unsigned int tx_queue;
+    unsigned int rx_queue;
+    uid_t uid;
+    int has_tcpinfo;            // fields below only valid when set (sock_diag backend)
+    unsigned int rtt_us;
+    unsigned int rttvar_us;
+    unsigned int snd_cwnd;
+    unsigned int total_retrans;
+} SockInfo;
+
+// Open-addressing hash map inode -> SockInfo for one network namespace
+typedef struct NetnsIndex {
+    unsigned long long netns;
+    SockInfo *slots;
+    size_t cap;
+    size_t count;
+    int ready;                  // set once filled, guarded by SockIndex.lock
+    char *paths;                // UNIX paths, offset 0 is the empty string
+    size_t paths_len, paths_cap;
+    pid_t owner;                // pid the tables were read through
+    unsigned long long sig;     // procfs table signature at load (SockIndex.track)
+    unsigned long long digest;  // of the records, maintained by netns_index_insert
+    struct NetnsIndex *next;
+} NetnsIndex;
+
+typedef struct {
+    NetnsIndex *head;
+    int backend;                // DISCOVERY_*
+    int want_tcpinfo;           // ask sock_diag for tcp_info (filter on rtt, cwnd...)
+    int track;                  // record table signatures for sock_index_refresh
+    int error;                  // a loader thread is stuck in another netns (errno)
+    pthread_mutex_t lock;
+    pthread_cond_t built;
+} SockIndex;
+
+// One search result. Addresses stay binary until printed and the process
+// name is interned once per pid in the owning ResultStore.
 typedef struct {
     pid_t pid;
     int fd;
-    char proc_name[256];
-    char local_addr[64];
-    char rem_addr[64];
-    int rem_port;
+    unsigned int name;          // offset of the process name in ResultStore.names
+    int state;
+    int proto;
+    unsigned long long inode;
+    JsAddr local;
+    JsAddr remote;
+    unsigned long long peer;    // UNIX peer inode
+    int path;                   // offset of the UNIX path in ResultStore.names, -1 = none
 } SocketEntry;
 
-extern SocketEntry entries[MAX_ENTRIES];
-extern int entry_count;
-extern int recv_timeout_sec;
+// Growable search result set
+typedef struct {
+    SocketEntry *items;
+    size_t count;
+    size_t cap;
+    char *names;                // NUL separated process names
+    size_t names_len;
+    size_t names_cap;
+} ResultStore;
+
+// Cached duplicate of a target's socket, see handles.c
+typedef struct {
+    pid_t pid;
+    int fd;                     // fd number in the target
+    unsigned long long inode;
+    int pidfd;
+    int sockfd;                 // our duplicate
+    int type;                   // SOCK_STREAM, SOCK_DGRAM...
+} SockHandle;
+
+// Message-oriented sockets: sends and receives keep datagram boundaries
+static inline int handle_is_dgram(const SockHandle *h) {
+    return h->type == SOCK_DGRAM || h->type == SOCK_SEQPACKET || h->type == SOCK_RAW;
+}
+
+// A zero-length read is EOF, except for an empty datagram
+static inline int handle_eof_on_empty(const SockHandle *h) {
+    return h->type == SOCK_STREAM || h->type == SOCK_SEQPACKET;
+}
+
+// rec --record capture file (record.c): a RecFileHeader, then one
+// RecChunk and its payload per chunk received, then the index and a
+// RecTrailer when the capture ended cleanly. Native byte order.
+#define REC_MAGIC 0x5235534AU           // "JS5R"
+#define REC_INDEX_MAGIC 0x4935534AU     // "JS5I"
+#define REC_VERSION 1
+#define REC_INDEX_STEP (1 << 20)        // an index entry per MiB of file
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_len;        // sizeof(RecFileHeader), chunks start there
+    int32_t pid, fd;
+    int32_t type;               // SOCK_STREAM, SOCK_DGRAM...
+    uint32_t local_len, remote_len;
+    uint32_t reserved;
+    uint64_t start_realtime_ns; // wall clock of t_ns = 0
+    struct sockaddr_storage local, remote;
+} RecFileHeader;
+
+typedef struct {
+    uint64_t t_ns;              // monotonic, since the start of the capture
+    uint32_t len;
+    uint32_t flags;             // reserved
+} RecChunk;
+
+typedef struct {
+    uint64_t t_ns;
+    uint64_t offset;            // of a RecChunk
+} RecIndexEntry;
+
+typedef struct {
+    uint32_t magic;             // REC_INDEX_MAGIC
+    uint32_t count;             // index entries, right before the trailer
+    uint64_t index_offset;      // = end of the chunks
+    uint64_t chunks, bytes;
+} RecTrailer;
+
+typedef struct RecvRing RecvRing;
+
+// rec output, see xfer.c
+typedef struct {
+    int outfd;
+    int is_file;                // regular file: splice and fsync apply
+    int pipefd[2];              // splice staging pipe, -1 when copying
+    int flush_each;
+    char *buf;
+    size_t buflen, bufcap;
+    long long total;
+    long long unsynced;
+    RecvRing *ring;             // --ring: buffers go to the ring writer (ring.c)
+    // --record: every chunk gets a RecChunk, no splice
+    int record;
+    long long rec_start;        // now_ns() of t_ns = 0
+    long long rec_offset;       // file offset of the next RecChunk
+    long long rec_next_index;
+    long long rec_chunks;
+    RecIndexEntry *rec_index;
+    size_t rec_nindex, rec_index_cap;
+} RecvSink;
+
+// replay --speed/--from
+typedef struct {
+    double speed;       // 1 = original timing, 2 = twice as fast, 0 = no waits
+    long long from_ns;  // skip what was captured before this offset
+} ReplayOpts;
+
+enum {
+    FLUSH_AUTO,         // every chunk on stdout/pipes, at the end for files
+    FLUSH_CHUNK,
+    FLUSH_END
+};
+
+#define FSYNC_CLOSE (-1LL)  // rec_fsync: 0 never, > 0 every N bytes
+
+// send --repeat/--rate/--batch, sendf --rate
+typedef struct {
+    long long repeat;   // messages to send, 0 = once
+    double rate;        // per second, 0 = unpaced
+    int rate_msgs;      // rate counts messages instead of bytes
+    int batch;          // messages per writev, 0 = default
+    const char *to;     // sendto destination, NULL = the connected peer
+} LoadOpts;
+
+// peek --interval/--count/--bytes
+typedef struct {
+    int interval_ms;    // between samples
+    long count;         // samples to take, 0 = until Ctrl-C
+    long long bytes;    // MSG_PEEK sample size, 0 = default
+} PeekOpts;
+
+enum {
+    OUTPUT_TEXT,        // indexed table once the walk is done, kept for select
+    OUTPUT_JSONL,       // streamed while walking, nothing kept
+    OUTPUT_CSV,
+    OUTPUT_BIN
+};
+
+// Per-thread output buffer of the streamed formats
+typedef struct {
+    char *buf;
+    size_t len, cap;
+    int hold;           // collect only: adding entries never flushes to stdout
+} OutBuf;
+
+// --format bin: one BinHeader, then one BinRecord per socket, host endian
+#define BIN_MAGIC "JS5S"
+#define BIN_VERSION 2
+
+typedef struct {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+} BinHeader;
+
+typedef struct {
+    uint32_t pid;
+    int32_t fd;
+    uint64_t inode;
+    uint8_t state;              // TCP state numbering, 0 when in no table
+    uint8_t family;             // AF_INET / AF_INET6 / AF_UNIX, 0 likewise
+    uint16_t lport;
+    uint16_t rport;
+    uint8_t proto;              // SOCK_PROTO_*, since version 2
+    uint8_t reserved;
+    uint8_t laddr[16];          // network byte order
+    uint8_t raddr[16];
+    uint32_t txq;
+    uint32_t rxq;
+    uint32_t uid;               // (uint32_t)-1 when unknown
+    char comm[16];              // not NUL terminated when 16 long
+    uint32_t reserved2;
+} BinRecord;
+
+_Static_assert(sizeof(BinRecord) == 88, "BinRecord layout is part of the format");
+
+// Daemon control protocol (daemon.c), over a UNIX stream socket, host
+// endian: each request is a DaemonReq followed by len payload bytes and is
+// answered, in order, by a DaemonResp followed by len payload bytes.
+#define DAEMON_MAGIC 0x4435534AU        // "JS5D"
+#define DAEMON_MAX_PAYLOAD (16 << 20)
+
+enum {
+    DAEMON_SEARCH = 1,  // payload "pattern\0filter", both optional; answer: the
+                        // lines or records of search -o format, count = sockets
+    DAEMON_SEND,        // payload: the data; count = bytes sent
+    DAEMON_REC,         // answer: up to max_bytes queued within timeout_ms,
+                        // count = 1 once the stream reached EOF
+    DAEMON_RELEASE,     // close cached handles (pid 0 = all); count = closed
+    DAEMON_STATS        // answer: one text line about the caches
+};
+
+#define DAEMON_FRESH 1  // flags: rescan before answering a search
+
+typedef struct {
+    uint32_t magic;
+    uint8_t op;
+    uint8_t format;             // search: OUTPUT_*
+    uint16_t flags;
+    int32_t pid;
+    int32_t fd;
+    uint64_t inode;             // 0 = whatever socket fd is now
+    uint32_t timeout_ms;        // rec: 0 = the daemon's receive timeout
+    uint32_t max_bytes;         // rec: 0 = 64k
+    uint32_t len;
+    uint32_t reserved;
+} DaemonReq;
+
+typedef struct {
+    uint32_t magic;
+    int32_t status;             // 0, or -errno and the payload says why
+    uint32_t count;
+    uint32_t len;
+} DaemonResp;
+
+_Static_assert(sizeof(DaemonReq) == 40 && sizeof(DaemonResp) == 16, "daemon protocol layout");
+
+// Compiled search filter (filter.c)
+typedef struct Filter Filter;
+
+enum {
+    FILTER_NO,
+    FILTER_YES,
+    FILTER_MAYBE        // depends on fields not known yet
+};
+
+// What the walker knows so far about a candidate socket
+#define FILTER_KNOW_PID  1   // pid, comm
+#define FILTER_KNOW_FD   2   // fd number
+#define FILTER_KNOW_SOCK 4   // inode and table row (si may be NULL)
+
+typedef struct {
+    int known;
+    pid_t pid;
+    const char *comm;
+    int fd;
+    unsigned long long inode;
+    const SockInfo *si;
+    const char *path;           // UNIX path (see netns_index_unix_path)
+} FilterCtx;
+
+// search_run parameters: what the globals hold for the shell, a JsCtx for
+// the library
+typedef struct {
+    const char *pattern;        // pid or process name substring, NULL = all
+    const Filter *filter;       // NULL = everything
+    int backend;                // DISCOVERY_*
+    int threads;                // walker threads, 0 = one per cpu
+    int format;                 // OUTPUT_TEXT collects, the others stream to stdout
+} SearchOpts;
+
+// How a receive loop ended
+enum {
+    RECV_ERROR = -1,
+    RECV_TIMEOUT,
+    RECV_CLOSED
+};
+
+enum {
+    ENGINE_SYNC,        // poll + splice/sendfile/recv
+    ENGINE_URING
+};
+
+// shell_exec results
+enum {
+    SHELL_OK,
+    SHELL_ERR,
+    SHELL_QUIT
+};
+
+enum {
+    DISCOVERY_AUTO,     // sock_diag, falling back to procfs
+    DISCOVERY_NETLINK,
+    DISCOVERY_PROC
+};
+
+extern ResultStore results;
+extern int selected_fd;
+extern int recv_timeout_ms;
+extern int discovery_backend;
+extern int search_threads;
+extern int rec_flush;
+extern long long rec_fsync;
+extern int rec_record;
+extern int rec_ring_count;
+extern long long rec_ring_size;
+extern int io_engine;
+extern int output_format;
+extern Filter *search_filter;
 void trim_newline(char *s);
 void print_usage();
 void cmd_help();
-int parse_ip_port(const char *hexipport, char *ipbuf, size_t ipbuflen, int *port);
-int parse_ipv6_port(const char *hexipport, char *ipbuf, size_t ipbuflen, int *port);
+int parse_hex_addr(const char *hex, JsAddr *out);
+int format_addr(const JsAddr *a, char *buf, size_t buflen);
 int get_socket_inode_from_fd(pid_t pid, int fd, unsigned long long *inode);
 int load_proc_name(pid_t pid, char *buf, size_t buflen);
 int get_remote_addr_from_inode(pid_t pid, unsigned long long inode, char *ipbuf, size_t ipbuflen, int *port);
 void cmd_search(const char *pattern);
+void exit_if_netns_stuck(void);
+long search_run(const SearchOpts *o, ResultStore *out);
+void print_results(void);
+const char *tcp_state_name(int st);
+const char *sock_proto_name(int proto);
+void format_remote(const ResultStore *rs, const SocketEntry *e, char *buf, size_t buflen);
+Filter *filter_compile(const char *expr, char *err, size_t errlen);
+void filter_free(Filter *f);
+int filter_eval(const Filter *f, const FilterCtx *c);
+int filter_wants_tcpinfo(const Filter *f);
+int parse_format(const char *name);
+void output_header(OutBuf *ob, int format);
+void output_begin(int format);
+void output_text_entry(OutBuf *ob, size_t i, const ResultStore *rs, const SocketEntry *e);
+void output_entry(OutBuf *ob, int format, pid_t pid, int fd, unsigned long long inode, const char *name,
+                  const SockInfo *si, const char *path);
+void output_flush(OutBuf *ob);
+void output_free(OutBuf *ob);
+int search_match(const char *pattern, pid_t pid, const char *proc_name);
+void cmd_watch(const char *pattern, int interval_ms, long count);
+
+// One watch scan: what was looked at and what changed
+typedef struct {
+    size_t pids, rescanned;     // pids looked at, pids whose fds were all stat()ed
+    int netns_dirty;
+    size_t opened, closed, changed;
+} WatchTick;
+
+typedef struct WatchCache WatchCache;
+WatchCache *watch_cache_new(int backend);
+void watch_cache_update(WatchCache *c, WatchTick *tick);
+int watch_cache_want_tcpinfo(WatchCache *c);
+const ResultStore *watch_cache_results(const WatchCache *c);
+const NetnsIndex *watch_cache_netns(const WatchCache *c, pid_t pid);
+size_t watch_cache_pids(const WatchCache *c);
+void watch_cache_free(WatchCache *c);
+
+int parse_selection(const ResultStore *rs, const char *spec, size_t **out, size_t *nout);
+SocketEntry *result_store_push(ResultStore *rs);
+long result_store_intern(ResultStore *rs, const char *name);
+int result_store_fill(ResultStore *rs, SocketEntry *e, const NetnsIndex *ns, const SockInfo *si);
+int result_store_merge(ResultStore *dst, ResultStore *src);
+void result_store_free(ResultStore *rs);
+static inline const char *entry_proc_name(const ResultStore *rs, const SocketEntry *e) {
+    return rs->names + e->name;
+}
+static inline const char *entry_path(const ResultStore *rs, const SocketEntry *e) {
+    return e->path >= 0 ? rs->names + e->path : NULL;
+}
+
+void sock_index_init(SockIndex *idx, int backend);
+void sock_index_free(SockIndex *idx);
+NetnsIndex *sock_index_for_pid(SockIndex *idx, pid_t pid);
+int sock_index_refresh(SockIndex *idx);
+unsigned long long netns_table_signature(pid_t pid);
+int netns_index_load(NetnsIndex *ns, pid_t pid, int backend, int want_tcpinfo);
+int netns_index_load_proc(NetnsIndex *ns, pid_t pid, int protos);
+int netns_index_load_diag(NetnsIndex *ns, pid_t pid, int want_tcpinfo);
+int sockdiag_netns_stuck(void);
+int parse_backend(const char *name);
+int netns_index_insert(NetnsIndex *ns, const SockInfo *si);
+long netns_index_add_path(NetnsIndex *ns, const char *path, size_t len);
+const char *netns_index_unix_path(const NetnsIndex *ns, const SockInfo *si);
+const SockInfo *netns_index_lookup(const NetnsIndex *ns, unsigned long long inode);
+void netns_index_free(NetnsIndex *ns);
+
+int shell_exec(char *line);
+int shell_attach(pid_t pid, int fd);
+void shell_run(void);
+int shell_run_script(const char *path);
+
+int handle_open(SockHandle *h, pid_t pid, int fd, unsigned long long inode);
+void handle_close(SockHandle *h);
+int handle_exited(const SockHandle *h);
+int handle_find(pid_t pid, int fd, unsigned long long inode, SockHandle **out);
+SockHandle *handle_get(pid_t pid, int fd, unsigned long long inode);
+size_t handle_cached(void);
+int handle_release(pid_t pid, int fd);
+int handle_release_all(void);
+
+#define XFER_UNSUPPORTED (-2)
+
+int wait_fd(int fd, short events, int timeout_ms);
+ssize_t write_all(int fd, const void *buf, size_t len);
+ssize_t writev_all(int fd, struct iovec *iov, int cnt);
+ssize_t xfer_file_to_socket(int sockfd, int f);
+void print_throughput(const char *what, long long bytes, long long elapsed_ns);
+int recv_sink_open(RecvSink *s, const char *outfile);
+ssize_t recv_sink_pull(RecvSink *s, int sockfd);
+int recv_sink_push(RecvSink *s, const char *data, size_t n);
+int recv_sink_frame(RecvSink *s, const char *data, size_t n);
+int recv_sink_close(RecvSink *s);
+int recv_sink_record(RecvSink *s, const SockHandle *h);
+void recv_sink_chunk(RecvSink *s, RecChunk *c, size_t len);
+int recv_sink_finish_record(RecvSink *s);
+int recv_ring_open(RecvSink *s, const char *prefix);
+int recv_ring_publish(RecvSink *s);
+int recv_ring_close(RecvSink *s);
+int parse_ring(const char *arg, int *count, long long *size);
+int ring_cat(const char *prefix, int fd);
+int parse_flush_mode(const char *name);
+int parse_fsync_mode(const char *arg, long long *out);
+int parse_size(const char *arg, long long *out);
+int parse_timeout_ms(const char *arg, int *out);
+int parse_interval_ms(const char *arg, int *out);
+
+int uring_recv_to_sink(int sockfd, RecvSink *sink, long long *last);
+ssize_t uring_file_to_socket(int sockfd, int f);
+ssize_t uring_send(int sockfd, const void *data, size_t len);
+int parse_engine(const char *name);
+void format_timeout(int ms, char *buf, size_t buflen);
+
+ssize_t dup_socket_and_send(int pid, int fd, unsigned long long inode, const char *data, size_t datalen);
+ssize_t dup_socket_and_sendfile(int pid, int fd, unsigned long long inode, const char *filepath, double rate);
+ssize_t dup_socket_and_send_load(int pid, int fd, unsigned long long inode, const char *data, size_t len, const LoadOpts *o);
+ssize_t xfer_file_paced(int sockfd, int f, double rate);
+int parse_rate(const char *arg, double *rate, int *msgs);
+int parse_load_opts(char **argp, LoadOpts *o);
+long long dup_socket_and_expect(int pid, int fd, unsigned long long inode, const char *pat, size_t patlen);
+long long dup_socket_and_drain(int pid, int fd, unsigned long long inode, long long want);
+int dup_socket_and_recv(int pid, int fd, unsigned long long inode, const char *outfile);
+ssize_t dup_socket_and_sendto(int pid, int fd, unsigned long long inode, const char *dest, const char *data, size_t len);
+ssize_t dup_socket_and_send_msgs(int pid, int fd, unsigned long long inode, const char *buf, const size_t *lens, int count);
+int parse_sockaddr(const char *arg, struct sockaddr_storage *ss, socklen_t *len);
+void format_sockaddr(const struct sockaddr_storage *ss, socklen_t len, char *buf, size_t buflen);
+ssize_t dgram_sendv(int sockfd, const struct sockaddr *to, socklen_t tolen, struct iovec *iov, int cnt);
+int dgram_recv_to_sink(const SockHandle *h, RecvSink *sink, int framed, long long *last, long long *count);
+int dup_socket_and_peek(int pid, int fd, unsigned long long inode, const char *outfile, const PeekOpts *o);
+int parse_peek_opts(char **argp, PeekOpts *o);
+ssize_t dup_socket_and_replay(int pid, int fd, unsigned long long inode, const char *path, const ReplayOpts *o);
+int parse_replay_opts(char **argp, ReplayOpts *o);
+int dup_socket_and_bridge(int pid, int fd, unsigned long long inode, const char *listen_addr);
+int sock_queue_depth(int sockfd, unsigned long req);
+int dup_socket_and_stats(int pid, int fd, unsigned long long inode, int interval_ms, long count);
+int stats_sockets(const ResultStore *rs, const size_t *idx, size_t n, int interval_ms, long count);
+int tap_sockets(const ResultStore *rs, const size_t *idx, size_t n, const char *outdir);
+int daemon_run(const char *path, int interval_ms);
+int daemon_request(const char *path, const DaemonReq *rq, const void *payload, DaemonResp *resp, char **data);
+int daemon_search(const char *path, const char *pattern, const char *filter);
+int daemon_send(const char *path, pid_t pid, int fd, const char *data, size_t len);
+int daemon_recv(const char *path, pid_t pid, int fd, const char *outfile);
+
+// Profiling counters (prof.c): calls, time and an amount (bytes, fds...)
+// per search phase and per syscall of the I/O loops. Off by default; when
+// off a probe costs one branch, when on two clock reads and three relaxed
+// atomic adds (search workers share the counters).
+enum {
+    PROF_SEARCH,        // whole cmd_search, amount = sockets found
+    PROF_PROC_SCAN,     // /proc readdir and sort, amount = pids
+    PROF_COMM,          // /proc/<pid>/comm reads
+    PROF_FD_DIR,        // /proc/<pid>/fd opendir + readdir, amount = fds
+    PROF_FD_STAT,       // get_socket_inode_from_fd, amount = sockets
+    PROF_NETNS_LOAD,    // netns_index_load, amount = table rows
+    PROF_DIAG_RECV,     // sock_diag netlink recv, amount = bytes
+    PROF_PROC_TABLE,    // one /proc/<pid>/net table parsed, amount = rows
+    PROF_PRINT,         // text results printed, amount = lines
+    PROF_POLL,          // poll waits
+    PROF_WRITE,         // write(2): sends, stdout, rec output, amount = bytes
+    PROF_WRITEV,        // load mode writev
+    PROF_SENDFILE,
+    PROF_SPLICE,
+    PROF_RECV,          // rec recv(2)
+    PROF_SENDMMSG,
+    PROF_RECVMMSG,
+    PROF_URING_ENTER,   // io_uring_enter, amount = SQEs submitted
+    PROF_COUNT
+};
+
+typedef struct {
+    unsigned long long calls, ns, amount;
+} __attribute__((aligned(64))) ProfCounter;
+
+extern int prof_enabled;
+extern ProfCounter prof_counters[PROF_COUNT];
+
+long long now_ns(void);
+
+static inline long long prof_begin(void) {
+    return prof_enabled ? now_ns() : 0;
+}
+
+// One call of ns nanoseconds, for time accumulated by the caller
+static inline void prof_add(int id, long long ns, long long amount) {
+    if (!prof_enabled) return;
+    ProfCounter *c = &prof_counters[id];
+    __atomic_fetch_add(&c->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->ns, ns, __ATOMIC_RELAXED);
+    if (amount > 0) __atomic_fetch_add(&c->amount, amount, __ATOMIC_RELAXED);
+}
+
+static inline void prof_end(int id, long long t0, long long amount) {
+    if (prof_enabled) prof_add(id, now_ns() - t0, amount);
+}
 
-int dup_socket_and_send(int pid, int fd, const char *data, size_t datalen);
-int dup_socket_and_sendfile(int pid, int fd, const char *filepath);
-int dup_socket_and_recv(int pid, int fd, const char *outfile);
+void prof_report(FILE *out);
+void prof_reset(void);
+void prof_report_at_exit(void);
 
 #endif
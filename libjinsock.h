@@ -0,0 +1,103 @@
+#ifndef LIBJINSOCK_H
+#define LIBJINSOCK_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// libjinsock: socket search and pidfd_getfd duplication as a library, for
+// programs that would otherwise spawn js5 and parse its output.
+//
+// Everything hangs off a JsCtx: settings, the last error and the handles
+// opened through it. Nothing is global, several contexts can be used from
+// different threads at once; one context must not be used by two threads
+// at the same time. Functions return JS_OK (0) or a negative JS_ERR_*
+// code, sizes where they return one, and never print. js_ctx_error() has
+// the detail of the last failure.
+//
+// Link with -ljinsock -pthread. Duplicating another process's sockets
+// needs the same privileges as js5 (root, or CAP_SYS_PTRACE over the
+// target).
+
+#define JS_API __attribute__((visibility("default")))
+
+enum {
+    JS_OK = 0,
+    JS_ERR_NOMEM = -1,
+    JS_ERR_INVAL = -2,      // bad argument, unknown backend, filter syntax
+    JS_ERR_PERM = -3,       // not allowed to duplicate the target's fds
+    JS_ERR_NOSOCK = -4,     // no such fd, or not a socket
+    JS_ERR_EXITED = -5,     // the target process is gone
+    JS_ERR_STALE = -6,      // the fd now refers to another socket
+    JS_ERR_TIMEOUT = -7,
+    JS_ERR_CLOSED = -8,     // the peer closed the connection
+    JS_ERR_IO = -9          // any other system error, see js_ctx_error
+};
+
+// Kernel table a socket was found in
+enum {
+    JS_PROTO_NONE,          // in none: netlink, packet, vsock...
+    JS_PROTO_TCP,
+    JS_PROTO_UDP,
+    JS_PROTO_RAW,
+    JS_PROTO_UNIX
+};
+
+typedef struct JsCtx JsCtx;
+typedef struct JsResults JsResults;
+typedef struct JsHandle JsHandle;
+
+// One search result. Strings stay valid until js_results_free.
+typedef struct {
+    pid_t pid;
+    int fd;
+    unsigned long long inode;
+    const char *comm;               // process name
+    int proto;                      // JS_PROTO_*
+    int state;                      // TCP state numbering, 0 when in no table
+    int family;                     // AF_INET, AF_INET6, AF_UNIX, 0 when unknown
+    unsigned short lport, rport;    // raw sockets: lport is the IP protocol
+    unsigned char laddr[16];        // network byte order
+    unsigned char raddr[16];
+    const char *path;               // UNIX bound path, NULL when none
+    unsigned long long peer;        // UNIX peer inode, 0 when unknown
+} JsSocket;
+
+JS_API JsCtx *js_ctx_new(void);
+JS_API void js_ctx_free(JsCtx *ctx);                // closes its handles too
+JS_API const char *js_ctx_error(const JsCtx *ctx);
+JS_API const char *js_strerror(int err);
+
+// Settings, same meaning as the js5 options of the same name
+JS_API int js_set_backend(JsCtx *ctx, const char *name);    // auto, netlink, proc
+JS_API int js_set_threads(JsCtx *ctx, int threads);         // 0 = one per cpu
+JS_API int js_set_filter(JsCtx *ctx, const char *expr);     // NULL or "" clears
+JS_API int js_set_timeout(JsCtx *ctx, int ms);              // send/recv, default 5000
+
+// Sockets of the processes whose pid or name contains pattern (NULL = all)
+// that pass the filter, sorted by pid and fd. Other network namespaces are
+// queried from inside them; should the calling thread fail to get back to
+// its own, the search fails (js_ctx_error says so) and sockets that thread
+// opens from then on would belong to the wrong namespace.
+JS_API int js_search(JsCtx *ctx, const char *pattern, JsResults **out);
+JS_API size_t js_results_count(const JsResults *res);
+JS_API int js_results_get(const JsResults *res, size_t i, JsSocket *out);
+// "ip:port", "[ip6]:port", a UNIX path or peer, as js5 prints it
+JS_API int js_results_remote(const JsResults *res, size_t i, char *buf, size_t buflen);
+JS_API void js_results_free(JsResults *res);
+
+// Duplicate pid's fd. inode 0 takes whatever socket the fd is now; a
+// search result's inode makes sure it is still that socket.
+JS_API int js_open(JsCtx *ctx, pid_t pid, int fd, unsigned long long inode, JsHandle **out);
+JS_API void js_close(JsHandle *h);
+JS_API int js_handle_fd(const JsHandle *h);     // our duplicate, for the caller's own poll loops
+
+// Send all of buf (one datagram on message sockets), waiting up to the
+// context timeout for room. Returns len, or the bytes sent before a
+// timeout, or an error when nothing was sent.
+JS_API ssize_t js_send(JsHandle *h, const void *buf, size_t len);
+// Receive what is queued, up to buflen bytes (one datagram on message
+// sockets), waiting up to timeout_ms (-1 = the context timeout). The data
+// is taken from the queue: the owner of the socket won't see it.
+JS_API ssize_t js_recv(JsHandle *h, void *buf, size_t buflen, int timeout_ms);
+
+#endif
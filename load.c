@@ -0,0 +1,326 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// Load generation through a duplicated socket: send --repeat / --rate /
+// --batch and sendf --rate. Messages are paced by a token bucket and
+// coalesced with writev (the same payload repeated in the iovec, so a
+// batch costs one syscall and no copy), or sendmmsg on datagram sockets
+// where every message must stay its own datagram. Every write is timed
+// into a log-linear histogram for the latency percentiles of the summary.
+
+#define LOAD_MAX_BATCH 1024         // IOV_MAX on Linux
+#define LOAD_REPORT_NS 1000000000LL // live progress line period
+#define PACED_MAX_CHUNK (1 << 20)
+
+// Latency histogram: 16 linear sub-buckets per power of two (~6% error)
+#define HIST_SUB 16
+#define HIST_SLOTS (64 * HIST_SUB)
+
+typedef struct {
+    unsigned long long slots[HIST_SLOTS];
+    unsigned long long count;
+    long long max;
+} LatHist;
+
+static int hist_slot(long long ns) {
+    if (ns < HIST_SUB) return ns < 0 ? 0 : (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    return e * HIST_SUB + (int)((ns >> (e - 4)) - HIST_SUB);
+}
+
+// Upper bound of the values counted in slot i
+static long long hist_slot_max(int i) {
+    if (i < HIST_SUB) return i;
+    int e = i / HIST_SUB, sub = i % HIST_SUB;
+    return ((long long)(HIST_SUB + sub + 1) << (e - 4)) - 1;
+}
+
+static void hist_add(LatHist *h, long long ns) {
+    h->slots[hist_slot(ns)]++;
+    h->count++;
+    if (ns > h->max) h->max = ns;
+}
+
+static long long hist_percentile(const LatHist *h, double p) {
+    if (h->count == 0) return 0;
+    unsigned long long rank = (unsigned long long)(p / 100.0 * h->count);
+    if (rank >= h->count) rank = h->count - 1;
+    unsigned long long seen = 0;
+    for (int i = 0; i < HIST_SLOTS; i++) {
+        seen += h->slots[i];
+        if (seen > rank) return hist_slot_max(i) < h->max ? hist_slot_max(i) : h->max;
+    }
+    return h->max;
+}
+
+// Token bucket in bytes or messages per second; bursts up to 50 ms of
+// rate (or one batch when that is larger)
+typedef struct {
+    double rate;
+    double tokens;
+    double burst;
+    long long last;
+} Bucket;
+
+static void bucket_init(Bucket *b, double rate, double cost) {
+    b->rate = rate;
+    b->burst = rate / 20 > cost ? rate / 20 : cost;
+    b->tokens = cost;
+    b->last = now_ns();
+}
+
+// Wait until cost tokens are there, without taking them
+static void bucket_wait(Bucket *b, double cost) {
+    while (1) {
+        long long now = now_ns();
+        b->tokens += (now - b->last) * b->rate / 1e9;
+        if (b->tokens > b->burst) b->tokens = b->burst;
+        b->last = now;
+        if (b->tokens >= cost) break;
+        long long wait = (long long)((cost - b->tokens) / b->rate * 1e9) + 1;
+        struct timespec ts = { wait / 1000000000LL, wait % 1000000000LL };
+        nanosleep(&ts, NULL);
+    }
+}
+
+static void bucket_take(Bucket *b, double cost) {
+    bucket_wait(b, cost);
+    b->tokens -= cost;
+}
+
+// Write a whole iovec array, resuming after short writes
+ssize_t writev_all(int fd, struct iovec *iov, int cnt) {
+    ssize_t total = 0;
+    while (cnt > 0) {
+        long long t0 = prof_begin();
+        ssize_t n = writev(fd, iov, cnt);
+        prof_end(PROF_WRITEV, t0, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && wait_fd(fd, POLLOUT, recv_timeout_ms) == 0) continue;
+            return -1;
+        }
+        total += n;
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            cnt--;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return total;
+}
+
+static void print_rate(const char *prefix, long long bytes, long long msgs, long long ns) {
+    double secs = ns / 1e9;
+    double bps = secs > 0 ? bytes / secs : 0;
+    printf("%s%lld msg(s), %lld bytes in %.3f s (%.2f MB/s, %.0f msg/s)\n",
+            prefix, msgs, bytes, secs, bps / 1e6, secs > 0 ? msgs / secs : 0);
+}
+
+static void print_latency(const char *what, const LatHist *h) {
+    printf("%s latency: p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+           what, hist_percentile(h, 50) / 1e3, hist_percentile(h, 90) / 1e3,
+           hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+}
+
+// One progress line per second on stderr, rates over the last period
+typedef struct {
+    const char *unit;   // what msgs counts
+    long long start, last;
+    long long last_bytes, last_msgs;
+} Progress;
+
+static void progress_tick(Progress *p, long long bytes, long long msgs, const LatHist *h) {
+    long long now = now_ns();
+    if (now - p->last < LOAD_REPORT_NS) return;
+    double dt = (now - p->last) / 1e9;
+    fprintf(stderr, "[%6.1f s] %lld %s(s), %lld bytes, %.2f MB/s, %.0f %s/s, p99 %.1f us\n",
+            (now - p->start) / 1e9, msgs, p->unit, bytes, (bytes - p->last_bytes) / dt / 1e6,
+            (msgs - p->last_msgs) / dt, p->unit, hist_percentile(h, 99) / 1e3);
+    p->last = now;
+    p->last_bytes = bytes;
+    p->last_msgs = msgs;
+}
+
+ssize_t dup_socket_and_send_load(int pid, int fd, unsigned long long inode, const char *data, size_t len, const LoadOpts *o) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    LatHist *hist = calloc(1, sizeof(LatHist));
+    struct iovec *iov = malloc(LOAD_MAX_BATCH * sizeof(struct iovec));
+    if (!hist || !iov) {
+        perror("malloc");
+        free(hist);
+        free(iov);
+        return -1;
+    }
+    struct sockaddr_storage to;
+    socklen_t tolen = 0;
+    if (o->to && parse_sockaddr(o->to, &to, &tolen) < 0) {
+        fprintf(stderr, "Invalid address: %s\n", o->to);
+        free(hist);
+        free(iov);
+        return -1;
+    }
+    int dgram = handle_is_dgram(h) || o->to;
+    long long repeat = o->repeat > 0 ? o->repeat : 1;
+    int batch = o->batch > 0 ? o->batch : (o->rate > 0 ? 1 : 64);
+    if (batch > LOAD_MAX_BATCH) batch = LOAD_MAX_BATCH;
+    if (batch > repeat) batch = (int)repeat;
+
+    Bucket bucket;
+    if (o->rate > 0) bucket_init(&bucket, o->rate, o->rate_msgs ? batch : (double)batch * len);
+    Progress prog = { .unit = "msg" };
+    prog.start = prog.last = now_ns();
+    long long msgs = 0, bytes = 0;
+    ssize_t ret = 0;
+    while (msgs < repeat) {
+        int n = repeat - msgs < batch ? (int)(repeat - msgs) : batch;
+        if (o->rate > 0) bucket_take(&bucket, o->rate_msgs ? n : (double)n * len);
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = (void *)data;
+            iov[i].iov_len = len;
+        }
+        long long t0 = now_ns();
+        ssize_t w = dgram ? dgram_sendv(h->sockfd, o->to ? (struct sockaddr *)&to : NULL, tolen, iov, n)
+                          : writev_all(h->sockfd, iov, n);
+        if (w < 0) {
+            perror("send");
+            ret = -1;
+            break;
+        }
+        hist_add(hist, now_ns() - t0);
+        msgs += n;
+        bytes += w;
+        progress_tick(&prog, bytes, msgs, hist);
+    }
+    print_rate("Sent ", bytes, msgs, now_ns() - prog.start);
+    if (hist->count) print_latency(batch > 1 ? "Batch write" : "Write", hist);
+    free(iov);
+    free(hist);
+    return ret < 0 ? -1 : bytes;
+}
+
+// sendf --rate: bucket-sized chunks, sendfile for regular files and a
+// read/write copy otherwise. Returns bytes sent or -1.
+ssize_t xfer_file_paced(int sockfd, int f, double rate) {
+    struct stat st;
+    if (fstat(f, &st) < 0) return -1;
+    // ~100 chunks per second keeps the pacing smooth without tiny writes
+    size_t chunk = rate / 100 > PACED_MAX_CHUNK ? PACED_MAX_CHUNK : (size_t)(rate / 100);
+    if (chunk < 4096) chunk = 4096;
+    int use_sendfile = S_ISREG(st.st_mode);
+    char *buf = malloc(chunk);
+    LatHist *hist = calloc(1, sizeof(LatHist));
+    if (!buf || !hist) {
+        free(buf);
+        free(hist);
+        return -1;
+    }
+    Bucket bucket;
+    bucket_init(&bucket, rate, chunk);
+    Progress prog = { .unit = "chunk" };
+    prog.start = prog.last = now_ns();
+    long long total = 0, chunks = 0;
+    while (1) {
+        // Only what was written is charged: retries after EAGAIN, the
+        // sendfile fallback and short writes cost nothing
+        bucket_wait(&bucket, chunk);
+        long long t0 = now_ns();
+        ssize_t n;
+        if (use_sendfile) {
+            n = sendfile(sockfd, f, NULL, chunk);
+            prof_end(PROF_SENDFILE, t0, n);
+            if (n < 0 && errno == EAGAIN && wait_fd(sockfd, POLLOUT, recv_timeout_ms) == 0) continue;
+            if (n < 0 && total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+                use_sendfile = 0;
+                continue;
+            }
+        } else {
+            n = read(f, buf, chunk);
+            if (n > 0) n = write_all(sockfd, buf, n);
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            total = -1;
+            break;
+        }
+        if (n == 0) break;
+        bucket.tokens -= n;
+        hist_add(hist, now_ns() - t0);
+        total += n;
+        chunks++;
+        progress_tick(&prog, total, chunks, hist);
+    }
+    if (total >= 0 && hist->count) print_latency("Chunk write", hist);
+    free(buf);
+    free(hist);
+    return total;
+}
+
+// "50M" or "50M/s" is bytes per second, "1000msg" or "1000msg/s" messages
+int parse_rate(const char *arg, double *rate, int *msgs) {
+    char tmp[64];
+    size_t n = strlen(arg);
+    if (n == 0 || n >= sizeof(tmp)) return -1;
+    memcpy(tmp, arg, n + 1);
+    if (n > 2 && strcmp(tmp + n - 2, "/s") == 0) tmp[n -= 2] = 0;
+    *msgs = 0;
+    if (n > 3 && strcmp(tmp + n - 3, "msg") == 0) {
+        tmp[n - 3] = 0;
+        *msgs = 1;
+        char *end;
+        *rate = strtod(tmp, &end);
+        return (end == tmp || *end || *rate <= 0) ? -1 : 0;
+    }
+    long long v;
+    if (parse_size(tmp, &v) < 0) return -1;
+    *rate = v;
+    return 0;
+}
+
+// Leading "--repeat N", "--rate R" and "--batch K" of a shell argument,
+// up to a "--" that ends them (so a payload can start with "--").
+// Advances *argp to what follows them (the payload).
+int parse_load_opts(char **argp, LoadOpts *o) {
+    char *p = *argp;
+    memset(o, 0, sizeof(*o));
+    while (strncmp(p, "--", 2) == 0) {
+        if (p[2] == 0 || p[2] == ' ') {
+            p += 2;
+            if (*p == ' ') p++;
+            break;
+        }
+        char name[16], val[64], *end;
+        int used = 0;
+        if (sscanf(p, "--%15s %63s %n", name, val, &used) != 2) return -1;
+        if (strcmp(name, "repeat") == 0) {
+            o->repeat = strtoll(val, &end, 10);
+            if (*end || o->repeat <= 0) return -1;
+        } else if (strcmp(name, "rate") == 0) {
+            if (parse_rate(val, &o->rate, &o->rate_msgs) < 0) return -1;
+        } else if (strcmp(name, "batch") == 0) {
+            long b = strtol(val, &end, 10);
+            if (*end || b <= 0 || b > INT_MAX) return -1;
+            o->batch = (int)b;
+        } else {
+            return -1;
+        }
+        p += used;
+    }
+    *argp = p;
+    return 0;
+}
@@ -1,13 +1,60 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <getopt.h>
+#include <signal.h>
 #include "jinsock.h"
 
-int selected_fd = -1;
-int recv_timeout_sec = 5;
-  
+int recv_timeout_ms = 5000;
+int discovery_backend = DISCOVERY_AUTO;
+int search_threads = 0;
+int rec_flush = FLUSH_AUTO;
+long long rec_fsync = 0;
+int rec_record = 0;
+int rec_ring_count = 0;
+long long rec_ring_size = 0;
+int io_engine = ENGINE_SYNC;
+int output_format = OUTPUT_TEXT;
+Filter *search_filter = NULL;
+
+// Options without a short form
+enum {
+    OPT_FLUSH = 256,
+    OPT_FSYNC,
+    OPT_SCRIPT,
+    OPT_REPEAT,
+    OPT_RATE,
+    OPT_BATCH,
+    OPT_INTERVAL,
+    OPT_COUNT,
+    OPT_TO,
+    OPT_PEEK,
+    OPT_PEEK_BYTES,
+    OPT_STATS,
+    OPT_PROFILE,
+    OPT_DAEMON,
+    OPT_CONNECT,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_SPEED,
+    OPT_FROM,
+    OPT_RING,
+    OPT_RING_CAT,
+    OPT_BRIDGE
+};
+
+static int run_shell(void) {
+    shell_run();
+    handle_release_all();
+    printf("Bye.\n");
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
+    // A peer closing the stolen connection must not kill us mid-transfer
+    signal(SIGPIPE, SIG_IGN);
+
     if (argc > 1) {
         // Gestion mode ligne de commande
         static struct option long_options[] = {
@@ -16,6 +63,34 @@ int main(int argc, char *argv[]) {
             {"send", required_argument, 0, 'S'},
             {"sendf", required_argument, 0, 'F'},
             {"rec", optional_argument, 0, 'r'},
+            {"timeout", required_argument, 0, 'T'},
+            {"backend", required_argument, 0, 'b'},
+            {"threads", required_argument, 0, 't'},
+            {"engine", required_argument, 0, 'e'},
+            {"format", required_argument, 0, 'o'},
+            {"filter", required_argument, 0, 'f'},
+            {"flush", required_argument, 0, OPT_FLUSH},
+            {"fsync", required_argument, 0, OPT_FSYNC},
+            {"script", required_argument, 0, OPT_SCRIPT},
+            {"repeat", required_argument, 0, OPT_REPEAT},
+            {"rate", required_argument, 0, OPT_RATE},
+            {"batch", required_argument, 0, OPT_BATCH},
+            {"interval", required_argument, 0, OPT_INTERVAL},
+            {"count", required_argument, 0, OPT_COUNT},
+            {"to", required_argument, 0, OPT_TO},
+            {"peek", optional_argument, 0, OPT_PEEK},
+            {"peek-bytes", required_argument, 0, OPT_PEEK_BYTES},
+            {"stats", no_argument, 0, OPT_STATS},
+            {"profile", no_argument, 0, OPT_PROFILE},
+            {"daemon", required_argument, 0, OPT_DAEMON},
+            {"connect", required_argument, 0, OPT_CONNECT},
+            {"record", no_argument, 0, OPT_RECORD},
+            {"replay", required_argument, 0, OPT_REPLAY},
+            {"speed", required_argument, 0, OPT_SPEED},
+            {"from", required_argument, 0, OPT_FROM},
+            {"ring", required_argument, 0, OPT_RING},
+            {"ring-cat", required_argument, 0, OPT_RING_CAT},
+            {"bridge", required_argument, 0, OPT_BRIDGE},
             {"help", no_argument, 0, 'h'},
             {0,0,0,0}
         };
@@ -25,22 +100,27 @@ int main(int argc, char *argv[]) {
         char *send_str = NULL;
         char *sendf_file = NULL;
         char *rec_file = NULL;
+        char *script = NULL;
+        LoadOpts load = { 0 };
+        int watch_interval = 1000;
+        long watch_count = 0;
+        int do_rec = 0;
+        char *peek_file = NULL;
+        int do_peek = 0;
+        long long peek_bytes = 0;
+        int do_stats = 0;
+        char *daemon_path = NULL;
+        char *connect_path = NULL;
+        char *filter_expr = NULL;
+        char *replay_file = NULL;
+        char *ring_cat_prefix = NULL;
+        char *bridge_addr = NULL;
+        ReplayOpts replay = { .speed = 1 };
         int opt;
         int option_index = 0;
 
-        // On vérifie si le premier argument est "search"
-        if (strcmp(argv[1], "search") == 0) {
-            // Recherche avec ou sans pattern
-            if (argc == 2) {
-                cmd_search(NULL);
-            } else {
-                cmd_search(argv[2]);
-            }
-            return 0;
-        }
-
         // Parsing options getopt_long
-        while ((opt = getopt_long(argc, argv, "p:s:S:F:r::h", long_options, &option_index)) != -1) {
+        while ((opt = getopt_long(argc, argv, "p:s:S:F:r::T:b:t:e:o:f:h", long_options, &option_index)) != -1) {
             switch (opt) {
                 case 'p':
                     pid = atoi(optarg);
@@ -55,8 +135,11 @@ int main(int argc, char *argv[]) {
                     sendf_file = optarg;
                     break;
                 case 'r':
+                    do_rec = 1;
                     // --rec peut avoir argument optionnel
-                    if (optind < argc && argv[optind][0] != '-') {
+                    if (optarg) {
+                        rec_file = optarg;
+                    } else if (optind < argc && argv[optind][0] != '-') {
                         rec_file = argv[optind];
                         optind++;
                     }
@@ -64,6 +147,170 @@ int main(int argc, char *argv[]) {
                         rec_file = NULL;
                     }
                     break;
+                case 'T':
+                    if (parse_timeout_ms(optarg, &recv_timeout_ms) < 0) {
+                        fprintf(stderr, "Error: Invalid timeout '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case 'b':
+                    discovery_backend = parse_backend(optarg);
+                    if (discovery_backend < 0) {
+                        fprintf(stderr, "Error: Unknown backend '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case 't':
+                    search_threads = atoi(optarg);
+                    if (search_threads < 0) search_threads = 0;
+                    break;
+                case 'e':
+                    io_engine = parse_engine(optarg);
+                    if (io_engine < 0) {
+                        fprintf(stderr, "Error: Unknown engine '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case 'o':
+                    output_format = parse_format(optarg);
+                    if (output_format < 0) {
+                        fprintf(stderr, "Error: Unknown format '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case 'f': {
+                    char err[128];
+                    filter_free(search_filter);
+                    search_filter = filter_compile(optarg, err, sizeof(err));
+                    if (!search_filter) {
+                        fprintf(stderr, "Error: Invalid filter: %s\n", err);
+                        return 1;
+                    }
+                    filter_expr = optarg;
+                    break;
+                }
+                case OPT_FLUSH:
+                    rec_flush = parse_flush_mode(optarg);
+                    if (rec_flush < 0) {
+                        fprintf(stderr, "Error: Unknown flush mode '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case OPT_FSYNC:
+                    if (parse_fsync_mode(optarg, &rec_fsync) < 0) {
+                        fprintf(stderr, "Error: Invalid fsync mode '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case OPT_SCRIPT:
+                    script = optarg;
+                    break;
+                case OPT_REPEAT: {
+                    char *end;
+                    load.repeat = strtoll(optarg, &end, 10);
+                    if (*end || load.repeat <= 0) {
+                        fprintf(stderr, "Error: Invalid repeat count '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                }
+                case OPT_RATE:
+                    if (parse_rate(optarg, &load.rate, &load.rate_msgs) < 0) {
+                        fprintf(stderr, "Error: Invalid rate '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case OPT_BATCH: {
+                    char *end;
+                    long b = strtol(optarg, &end, 10);
+                    if (*end || b <= 0 || b > INT_MAX) {
+                        fprintf(stderr, "Error: Invalid batch size '%s'\n", optarg);
+                        return 1;
+                    }
+                    load.batch = (int)b;
+                    break;
+                }
+                case OPT_INTERVAL:
+                    if (parse_interval_ms(optarg, &watch_interval) < 0) {
+                        fprintf(stderr, "Error: Invalid interval '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case OPT_COUNT:
+                    watch_count = atol(optarg);
+                    if (watch_count <= 0) {
+                        fprintf(stderr, "Error: Invalid count '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case OPT_TO:
+                    load.to = optarg;
+                    break;
+                case OPT_PEEK:
+                    do_peek = 1;
+                    // Same optional FILE handling as --rec
+                    if (optarg) {
+                        peek_file = optarg;
+                    } else if (optind < argc && argv[optind][0] != '-') {
+                        peek_file = argv[optind];
+                        optind++;
+                    }
+                    break;
+                case OPT_PEEK_BYTES:
+                    if (parse_size(optarg, &peek_bytes) < 0) {
+                        fprintf(stderr, "Error: Invalid peek size '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case OPT_STATS:
+                    do_stats = 1;
+                    break;
+                case OPT_PROFILE:
+                    if (!prof_enabled) atexit(prof_report_at_exit);
+                    prof_enabled = 1;
+                    break;
+                case OPT_DAEMON:
+                    daemon_path = optarg;
+                    break;
+                case OPT_CONNECT:
+                    connect_path = optarg;
+                    break;
+                case OPT_RING:
+                    if (parse_ring(optarg, &rec_ring_count, &rec_ring_size) < 0) {
+                        fprintf(stderr, "Error: Invalid ring '%s' (NxSIZE, e.g. 8x256M)\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case OPT_RING_CAT:
+                    ring_cat_prefix = optarg;
+                    break;
+                case OPT_BRIDGE:
+                    bridge_addr = optarg;
+                    break;
+                case OPT_RECORD:
+                    rec_record = 1;
+                    break;
+                case OPT_REPLAY:
+                    replay_file = optarg;
+                    break;
+                case OPT_SPEED: {
+                    char *end;
+                    replay.speed = strtod(optarg, &end);
+                    if (end == optarg || *end || replay.speed < 0) {
+                        fprintf(stderr, "Error: Invalid speed '%s'\n", optarg);
+                        return 1;
+                    }
+                    break;
+                }
+                case OPT_FROM: {
+                    int ms;
+                    if (parse_timeout_ms(optarg, &ms) < 0) {
+                        fprintf(stderr, "Error: Invalid start time '%s'\n", optarg);
+                        return 1;
+                    }
+                    replay.from_ns = ms * 1000000LL;
+                    break;
+                }
                 case 'h':
                     print_usage();
                     return 0;
@@ -73,15 +320,66 @@ int main(int argc, char *argv[]) {
             }
         }
 
+        // Positional arguments: "search" or "watch" and at most one pattern
+        int positional = 0;
+        if (optind < argc && (strcmp(argv[optind], "search") == 0 || strcmp(argv[optind], "watch") == 0))
+            positional = optind + 1 < argc ? 2 : 1;
+        if (optind + positional < argc) {
+            fprintf(stderr, "Error: Unexpected argument '%s'\n", argv[optind + positional]);
+            print_usage();
+            return 1;
+        }
+
+        if (ring_cat_prefix) return ring_cat(ring_cat_prefix, STDOUT_FILENO) == 0 ? 0 : 1;
+        if (daemon_path) return daemon_run(daemon_path, watch_interval) == 0 ? 0 : 1;
+        if (connect_path) {
+            // Served by a running daemon: search, --send and --rec only
+            if (optind < argc && strcmp(argv[optind], "search") == 0)
+                return daemon_search(connect_path, optind + 1 < argc ? argv[optind + 1] : NULL, filter_expr) == 0 ? 0 : 1;
+            if (pid <= 0 || sockfd < 0 || !!send_str + do_rec != 1) {
+                fprintf(stderr, "Error: --connect takes search, or --pid and --socket with one of --send or --rec\n");
+                return 1;
+            }
+            int ret = send_str ? daemon_send(connect_path, pid, sockfd, send_str, strlen(send_str))
+                               : daemon_recv(connect_path, pid, sockfd, rec_file);
+            return ret == 0 ? 0 : 1;
+        }
+
+        // getopt_long permute les arguments : "search" et son pattern restent à la fin
+        if (optind < argc && strcmp(argv[optind], "search") == 0) {
+            // Recherche avec ou sans pattern
+            cmd_search(optind + 1 < argc ? argv[optind + 1] : NULL);
+            return 0;
+        }
+        if (optind < argc && strcmp(argv[optind], "watch") == 0) {
+            cmd_watch(optind + 1 < argc ? argv[optind + 1] : NULL, watch_interval, watch_count);
+            return 0;
+        }
+
         // Validation arguments
         int action_count = 0;
         if (send_str) action_count++;
         if (sendf_file) action_count++;
-        if (rec_file || (optind > 0 && strcmp(argv[optind-1], "-r") == 0)) action_count++; // rec detected
+        if (do_rec) action_count++;
+        if (do_peek) action_count++;
+        if (do_stats) action_count++;
+        if (replay_file) action_count++;
+        if (bridge_addr) action_count++;
+        if (script) {
+            if (action_count > 0) {
+                fprintf(stderr, "Error: --script cannot be combined with --send, --sendf, --rec, --peek, --stats, --replay or --bridge\n");
+                return 1;
+            }
+            // -p/-s are optional here: the script may search/select or attach itself
+            if ((pid > 0 || sockfd >= 0) && shell_attach(pid, sockfd) < 0) return 1;
+            int ret = shell_run_script(script);
+            handle_release_all();
+            return ret == 0 ? 0 : 1;
+        }
         if (action_count == 0) {
-            fprintf(stderr, "Error: Must specify one action among --send, --sendf, or --rec\n");
-            print_usage();
-            return 1;
+            // Options only: they configure the interactive shell
+            if ((pid > 0 || sockfd >= 0) && shell_attach(pid, sockfd) < 0) return 1;
+            return run_shell();
         }
         if (pid <= 0 || sockfd < 0) {
             fprintf(stderr, "Error: Must specify valid --pid and --socket\n");
@@ -89,107 +387,42 @@ int main(int argc, char *argv[]) {
             return 1;
         }
         // Execute action
-        if (send_str) {
-            ssize_t sent = dup_socket_and_send(pid, sockfd, send_str, strlen(send_str));
+        if (send_str && (load.repeat || load.rate > 0 || load.batch)) {
+            ssize_t sent = dup_socket_and_send_load(pid, sockfd, 0, send_str, strlen(send_str), &load);
+            return sent >= 0 ? 0 : 1;
+        } else if (send_str) {
+            ssize_t sent = load.to ? dup_socket_and_sendto(pid, sockfd, 0, load.to, send_str, strlen(send_str))
+                                   : dup_socket_and_send(pid, sockfd, 0, send_str, strlen(send_str));
             if (sent >= 0) {
                 printf("Data sent: %zd bytes\n", sent);
                 return 0;
             }
             return 1;
         } else if (sendf_file) {
-            ssize_t sent = dup_socket_and_sendfile(pid, sockfd, sendf_file);
+            if (load.rate_msgs || load.repeat || load.batch || load.to) {
+                fprintf(stderr, "Error: --sendf only takes a --rate in bytes per second\n");
+                return 1;
+            }
+            ssize_t sent = dup_socket_and_sendfile(pid, sockfd, 0, sendf_file, load.rate);
             if (sent >= 0) {
                 printf("File sent: %zd bytes\n", sent);
                 return 0;
             }
             return 1;
+        } else if (bridge_addr) {
+            return dup_socket_and_bridge(pid, sockfd, 0, bridge_addr) == 0 ? 0 : 1;
+        } else if (replay_file) {
+            return dup_socket_and_replay(pid, sockfd, 0, replay_file, &replay) >= 0 ? 0 : 1;
+        } else if (do_stats) {
+            return dup_socket_and_stats(pid, sockfd, 0, watch_interval, watch_count) == 0 ? 0 : 1;
+        } else if (do_peek) {
+            PeekOpts po = { .interval_ms = watch_interval, .count = watch_count, .bytes = peek_bytes };
+            return dup_socket_and_peek(pid, sockfd, 0, peek_file, &po) == 0 ? 0 : 1;
         } else {
-            ssize_t ret = dup_socket_and_recv(pid, sockfd, rec_file);
+            ssize_t ret = dup_socket_and_recv(pid, sockfd, 0, rec_file);
             return (ret == 0) ? 0 : 1;
         }
     }
 
-    char line[1024];
-    printf("Socket Injector Shell. Type 'help' for commands.\n");
-    while (1) {
-        printf("> ");
-        fflush(stdout);
-        if (!fgets(line, sizeof(line), stdin)) break;
-        trim_newline(line);
-
-        if (strncmp(line, "help", 4) == 0) {
-            cmd_help();
-        } else if (strncmp(line, "search", 6) == 0) {
-            char *arg = line + 6;
-            while (*arg == ' ') arg++;
-            cmd_search(*arg ? arg : NULL);
-        } else if (strncmp(line, "select", 6) == 0) {
-            int idx = -1;
-            if (sscanf(line + 6, "%d", &idx) != 1 || idx < 0 || idx >= entry_count) {
-                printf("Invalid index\n");
-            } else {
-                selected_fd = idx;
-                printf("Selected entry [%d]\n", idx);
-            }
-        } else if (strncmp(line, "sendf", 5) == 0) {
-            if (selected_fd < 0) {
-                printf("No socket selected\n");
-                continue;
-            }
-            char *filename = line + 5;
-            while (*filename == ' ') filename++;
-            if (*filename == 0) {
-                printf("Missing filename\n");
-                continue;
-            }
-            SocketEntry *e = &entries[selected_fd];
-            ssize_t sent = dup_socket_and_sendfile(e->pid, e->fd, filename);
-            if (sent >= 0)
-                printf("File sent: %zd bytes\n", sent);
-        } else if (strncmp(line, "send", 4) == 0) {
-            if (selected_fd < 0) {
-                printf("No socket selected\n");
-                continue;
-            }
-            char *data = line + 4;
-            while (*data == ' ') data++;
-            if (*data == 0) {
-                printf("Missing data to send\n");
-                continue;
-            }
-            SocketEntry *e = &entries[selected_fd];
-            ssize_t sent = dup_socket_and_send(e->pid, e->fd, data, strlen(data));
-            if (sent >= 0)
-                printf("Data sent: %zd bytes\n", sent);
-        } else if (strncmp(line, "rec", 3) == 0) {
-            if (selected_fd < 0) {
-                printf("No socket selected\n");
-                continue;
-            }
-            char *filename = line + 3;
-            while (*filename == ' ') filename++;
-            SocketEntry *e = &entries[selected_fd];
-            if (*filename)
-                dup_socket_and_recv(e->pid, e->fd, filename);
-            else
-                dup_socket_and_recv(e->pid, e->fd, NULL);
-        } else if (strncmp(line, "timeout", 7) == 0) {
-            int t = 0;
-            if (sscanf(line + 7, "%d", &t) != 1 || t <= 0) {
-                printf("Invalid timeout value\n");
-            } else {
-                recv_timeout_sec = t;
-                printf("Timeout set to %d seconds\n", recv_timeout_sec);
-            }
-        } else if (strncmp(line, "quit", 4) == 0) {
-            break;
-        } else if (strlen(line) == 0) {
-            // empty, ignore
-        } else {
-            printf("Unknown command: %s\n", line);
-        }
-    }
-
-    printf("Bye.\n");
-    return 0;
+    return run_shell();
 }
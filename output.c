@@ -0,0 +1,242 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+// Streaming search output: JSON Lines, CSV or fixed-size binary records.
+// Search workers format into their own OutBuf and hand whole buffers to
+// stdout under a lock, so lines never interleave and nothing is kept once
+// written: memory stays constant whatever the number of sockets.
+
+#define OUTBUF_FLUSH (64 * 1024)
+
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const char *tcp_state_name(int st) {
+    static const char *names[] = {
+        "?", "ESTABLISHED", "SYN_SENT", "SYN_RECV", "FIN_WAIT1", "FIN_WAIT2", "TIME_WAIT",
+        "CLOSE", "CLOSE_WAIT", "LAST_ACK", "LISTEN", "CLOSING", "NEW_SYN_RECV"
+    };
+    return st > 0 && st < (int)(sizeof(names) / sizeof(names[0])) ? names[st] : "-";
+}
+
+const char *sock_proto_name(int proto) {
+    static const char *names[] = { "-", "tcp", "udp", "raw", "unix" };
+    return proto >= 0 && proto < (int)(sizeof(names) / sizeof(names[0])) ? names[proto] : "-";
+}
+
+// Remote end of a search result: "addr:port", or for a UNIX socket its
+// path, "peer:<inode>" when unnamed, "*" when not connected either
+void format_remote(const ResultStore *rs, const SocketEntry *e, char *buf, size_t buflen) {
+    if (e->proto == SOCK_PROTO_UNIX) {
+        const char *path = entry_path(rs, e);
+        if (path) snprintf(buf, buflen, "%s", path);
+        else if (e->peer) snprintf(buf, buflen, "peer:%llu", e->peer);
+        else snprintf(buf, buflen, "*");
+        return;
+    }
+    char addr[INET6_ADDRSTRLEN];
+    format_addr(&e->remote, addr, sizeof(addr));
+    snprintf(buf, buflen, "%s:%d", addr, e->remote.port);
+}
+
+int parse_format(const char *name) {
+    if (strcmp(name, "text") == 0) return OUTPUT_TEXT;
+    if (strcmp(name, "jsonl") == 0 || strcmp(name, "json") == 0) return OUTPUT_JSONL;
+    if (strcmp(name, "csv") == 0) return OUTPUT_CSV;
+    if (strcmp(name, "bin") == 0) return OUTPUT_BIN;
+    return -1;
+}
+
+static int outbuf_reserve(OutBuf *ob, size_t n) {
+    if (ob->len + n <= ob->cap) return 0;
+    size_t newcap = ob->cap ? ob->cap : OUTBUF_FLUSH * 2;
+    while (newcap < ob->len + n) newcap *= 2;
+    char *b = realloc(ob->buf, newcap);
+    if (!b) return -1;
+    ob->buf = b;
+    ob->cap = newcap;
+    return 0;
+}
+
+static void outbuf_put(OutBuf *ob, const void *p, size_t n) {
+    if (outbuf_reserve(ob, n) < 0) return;
+    memcpy(ob->buf + ob->len, p, n);
+    ob->len += n;
+}
+
+static void outbuf_printf(OutBuf *ob, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void outbuf_printf(OutBuf *ob, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0 || outbuf_reserve(ob, n + 1) < 0) return;
+    va_start(ap, fmt);
+    vsnprintf(ob->buf + ob->len, n + 1, fmt, ap);
+    va_end(ap);
+    ob->len += n;
+}
+
+// Process names are user controlled: escape them for JSON and CSV
+static void put_json_string(OutBuf *ob, const char *s) {
+    outbuf_put(ob, "\"", 1);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', c };
+            outbuf_put(ob, esc, 2);
+        } else if (c < 0x20) {
+            outbuf_printf(ob, "\\u%04x", c);
+        } else {
+            outbuf_put(ob, &c, 1);
+        }
+    }
+    outbuf_put(ob, "\"", 1);
+}
+
+static void put_csv_string(OutBuf *ob, const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) {
+        outbuf_put(ob, s, strlen(s));
+        return;
+    }
+    outbuf_put(ob, "\"", 1);
+    for (; *s; s++) {
+        if (*s == '"') outbuf_put(ob, "\"", 1);
+        outbuf_put(ob, s, 1);
+    }
+    outbuf_put(ob, "\"", 1);
+}
+
+// All of p to stdout. Unlike write_all there is no stall timeout: a slow
+// reader of the search output only slows the walk down.
+static int write_stdout(const char *p, size_t n) {
+    while (n > 0) {
+        long long t0 = prof_begin();
+        ssize_t w = write(STDOUT_FILENO, p, n);
+        prof_end(PROF_WRITE, t0, w);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = { .fd = STDOUT_FILENO, .events = POLLOUT };
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+void output_flush(OutBuf *ob) {
+    if (ob->len == 0) return;
+    pthread_mutex_lock(&out_lock);
+    if (write_stdout(ob->buf, ob->len) < 0 && errno != EPIPE) perror("write");
+    pthread_mutex_unlock(&out_lock);
+    ob->len = 0;
+}
+
+void output_free(OutBuf *ob) {
+    output_flush(ob);
+    free(ob->buf);
+    ob->buf = NULL;
+    ob->cap = 0;
+}
+
+// Per-stream preamble: the CSV header or the binary file header
+void output_header(OutBuf *ob, int format) {
+    if (format == OUTPUT_CSV) {
+        outbuf_printf(ob, "pid,fd,comm,inode,state,local,lport,remote,rport,txq,rxq,uid,proto,path\n");
+    } else if (format == OUTPUT_BIN) {
+        BinHeader h = { .magic = BIN_MAGIC, .version = BIN_VERSION, .record_size = sizeof(BinRecord) };
+        outbuf_put(ob, &h, sizeof(h));
+    }
+}
+
+void output_begin(int format) {
+    fflush(stdout);
+    OutBuf ob = { 0 };
+    output_header(&ob, format);
+    output_free(&ob);
+}
+
+// One line of the indexed text table
+void output_text_entry(OutBuf *ob, size_t i, const ResultStore *rs, const SocketEntry *e) {
+    char rem[PATH_MAX];
+    format_remote(rs, e, rem, sizeof(rem));
+    // TCP (and unknown) lines keep their historical shape, others are tagged
+    if (e->proto == SOCK_PROTO_TCP || e->proto == SOCK_PROTO_NONE)
+        outbuf_printf(ob, "[%zu] PID=%d (%s) FD=%d -> %s\n", i, e->pid, entry_proc_name(rs, e), e->fd, rem);
+    else
+        outbuf_printf(ob, "[%zu] PID=%d (%s) FD=%d %s -> %s\n", i, e->pid, entry_proc_name(rs, e), e->fd,
+                      sock_proto_name(e->proto), rem);
+    if (ob->len >= OUTBUF_FLUSH && !ob->hold) output_flush(ob);
+}
+
+// Append one socket; si is NULL when it isn't in the namespace tables,
+// path is the UNIX path if any (not part of the binary records)
+void output_entry(OutBuf *ob, int format, pid_t pid, int fd, unsigned long long inode, const char *name,
+                  const SockInfo *si, const char *path) {
+    static const SockInfo none = { .uid = (uid_t)-1 };
+    if (!si) si = &none;
+    if (!path) path = "";
+    if (format == OUTPUT_BIN) {
+        BinRecord r;
+        memset(&r, 0, sizeof(r));
+        r.pid = pid;
+        r.fd = fd;
+        r.inode = inode;
+        r.state = si->state;
+        r.family = si->local.family;
+        r.lport = si->local.port;
+        r.rport = si->remote.port;
+        r.proto = si->proto;
+        memcpy(r.laddr, si->local.addr, 16);
+        memcpy(r.raddr, si->remote.addr, 16);
+        r.txq = si->tx_queue;
+        r.rxq = si->rx_queue;
+        r.uid = si->uid;
+        memcpy(r.comm, name, strnlen(name, sizeof(r.comm)));
+        outbuf_put(ob, &r, sizeof(r));
+    } else {
+        char loc[INET6_ADDRSTRLEN] = "", rem[INET6_ADDRSTRLEN] = "";
+        if (si->local.family == AF_INET || si->local.family == AF_INET6) {
+            format_addr(&si->local, loc, sizeof(loc));
+            format_addr(&si->remote, rem, sizeof(rem));
+        }
+        long uid = si->uid == (uid_t)-1 ? -1 : (long)si->uid;
+        if (format == OUTPUT_JSONL) {
+            outbuf_printf(ob, "{\"pid\":%d,\"fd\":%d,\"comm\":", pid, fd);
+            put_json_string(ob, name);
+            outbuf_printf(ob, ",\"inode\":%llu,\"state\":\"%s\",\"local\":\"%s\",\"lport\":%u,"
+                          "\"remote\":\"%s\",\"rport\":%u,\"txq\":%u,\"rxq\":%u,\"uid\":%ld,\"proto\":\"%s\"",
+                          inode, tcp_state_name(si->state), loc, si->local.port, rem,
+                          si->remote.port, si->tx_queue, si->rx_queue, uid, sock_proto_name(si->proto));
+            if (*path) {
+                outbuf_printf(ob, ",\"path\":");
+                put_json_string(ob, path);
+            }
+            if (si->peer) outbuf_printf(ob, ",\"peer\":%llu", si->peer);
+            outbuf_printf(ob, "}\n");
+        } else {
+            outbuf_printf(ob, "%d,%d,", pid, fd);
+            put_csv_string(ob, name);
+            outbuf_printf(ob, ",%llu,%s,%s,%u,%s,%u,%u,%u,%ld,%s,", inode, tcp_state_name(si->state),
+                          loc, si->local.port, rem, si->remote.port, si->tx_queue, si->rx_queue, uid,
+                          sock_proto_name(si->proto));
+            put_csv_string(ob, path);
+            outbuf_put(ob, "\n", 1);
+        }
+    }
+    if (ob->len >= OUTBUF_FLUSH && !ob->hold) output_flush(ob);
+}
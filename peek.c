@@ -0,0 +1,189 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/sockios.h>
+
+// peek: watch a socket's queues without taking anything from its owner.
+// Every interval the receive and send queue depths are read with
+// SIOCINQ/SIOCOUTQ and the head of the receive queue is sampled with
+// MSG_PEEK, so the owning process still reads every byte. When the bytes
+// seen last time are still at the head, the consumer hasn't read anything
+// (new data may have been queued behind them). With a file, every sample
+// that shows something new is written as a record
+//   [<realtime sec.nsec> inq=<n> outq=<n> len=<n>]
+// followed by the n sampled bytes and a newline.
+
+#define PEEK_DEFAULT_BYTES 4096
+
+static volatile sig_atomic_t peek_interrupted;
+
+static void peek_sigint(int sig) {
+    (void)sig;
+    peek_interrupted = 1;
+}
+
+// FNV-1a: enough to tell whether the consumer read since the last sample
+static unsigned long long head_hash(const char *p, size_t n) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h ^ n;
+}
+
+// Queue depth in bytes, -1 where the ioctl doesn't apply (listening sockets)
+int sock_queue_depth(int sockfd, unsigned long req) {
+    int v;
+    return ioctl(sockfd, req, &v) < 0 ? -1 : v;
+}
+
+static void print_depth(const char *name, int v) {
+    if (v < 0) printf(" %s=-", name);
+    else printf(" %s=%d", name, v);
+}
+
+int dup_socket_and_peek(int pid, int fd, unsigned long long inode, const char *outfile, const PeekOpts *o) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+
+    // Anonymous mapping: large sample sizes stay off the heap and only the
+    // pages actually written by a peek get backed
+    size_t bytes = o->bytes > 0 ? (size_t)o->bytes : PEEK_DEFAULT_BYTES;
+    char *buf = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    int outfd = -1;
+    if (outfile) {
+        outfd = open(outfile, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (outfd < 0) {
+            perror(outfile);
+            munmap(buf, bytes);
+            return -1;
+        }
+    }
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = peek_sigint;
+    sigaction(SIGINT, &sa, &old);
+    peek_interrupted = 0;
+
+    printf("Peeking at PID %d FD %d every %d ms, Ctrl-C to stop\n", pid, fd, o->interval_ms);
+    fflush(stdout);
+
+    long samples = 0, changes = 0, stalled = 0, longest = 0;
+    long long inq_sum = 0, inq_max = 0, outq_max = 0;
+    unsigned long long last = 0;        // hash of the previous sample
+    ssize_t last_n = 0;
+    int ret = 0;
+    long long start = now_ns();
+    while (!peek_interrupted && (o->count <= 0 || samples < o->count)) {
+        int inq = sock_queue_depth(h->sockfd, SIOCINQ);
+        int outq = sock_queue_depth(h->sockfd, SIOCOUTQ);
+        ssize_t n = 0;
+        if (inq != 0) {
+            n = recv(h->sockfd, buf, bytes, MSG_PEEK | MSG_DONTWAIT);
+            if (n < 0 && errno != EAGAIN && errno != EINVAL && errno != ENOTCONN) {
+                perror("recv");
+                ret = -1;
+                break;
+            }
+            if (n < 0) n = 0;
+        }
+        samples++;
+        if (inq > 0) inq_sum += inq;
+        if (inq > inq_max) inq_max = inq;
+        if (outq > outq_max) outq_max = outq;
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        char when[16];
+        strftime(when, sizeof(when), "%H:%M:%S", localtime(&ts.tv_sec));
+        printf("[%s.%03ld]", when, ts.tv_nsec / 1000000);
+        print_depth("inq", inq);
+        print_depth("outq", outq);
+
+        if (n > 0) {
+            int unread = last_n > 0 && n >= last_n && head_hash(buf, last_n) == last;
+            if (unread) {
+                stalled++;
+                if (stalled > longest) longest = stalled;
+                printf(" head=%zd unread for %ld sample(s)", n, stalled);
+                if (n > last_n) printf(", +%zd queued", n - last_n);
+                printf("\n");
+            } else {
+                stalled = 0;
+                changes++;
+                printf(" head=%zd new\n", n);
+            }
+            if (outfd >= 0 && (!unread || n > last_n)) {
+                char hdr[128];
+                int hl = snprintf(hdr, sizeof(hdr), "[%lld.%09ld inq=%d outq=%d len=%zd]\n",
+                                  (long long)ts.tv_sec, ts.tv_nsec, inq, outq, n);
+                if (write_all(outfd, hdr, hl) < 0 || write_all(outfd, buf, n) < 0 ||
+                    write_all(outfd, "\n", 1) < 0) {
+                    perror("write output");
+                    ret = -1;
+                    break;
+                }
+            }
+            last = head_hash(buf, n);
+            last_n = n;
+        } else {
+            stalled = 0;
+            last_n = 0;
+            printf("\n");
+        }
+        fflush(stdout);
+        if (o->count > 0 && samples >= o->count) break;
+
+        struct timespec d = { o->interval_ms / 1000, (o->interval_ms % 1000) * 1000000L };
+        while (nanosleep(&d, &d) < 0 && errno == EINTR && !peek_interrupted) ;
+    }
+    sigaction(SIGINT, &old, NULL);
+
+    double secs = (now_ns() - start) / 1e9;
+    printf("%ld sample(s) in %.1f s: inq max %lld avg %.0f, outq max %lld, head moved %ld time(s)",
+           samples, secs, inq_max, samples ? (double)inq_sum / samples : 0.0, outq_max, changes);
+    if (longest) printf(", stalled up to %ld sample(s)", longest);
+    printf("\n");
+    if (outfd >= 0) close(outfd);
+    munmap(buf, bytes);
+    return ret;
+}
+
+// peek options: --interval T, --count N, --bytes SIZE, then the rest (file)
+int parse_peek_opts(char **argp, PeekOpts *o) {
+    char *p = *argp;
+    memset(o, 0, sizeof(*o));
+    o->interval_ms = 1000;
+    while (strncmp(p, "--", 2) == 0) {
+        char name[16], val[64];
+        int used = 0;
+        if (sscanf(p, "--%15s %63s %n", name, val, &used) != 2) return -1;
+        if (strcmp(name, "interval") == 0) {
+            if (parse_interval_ms(val, &o->interval_ms) < 0) return -1;
+        } else if (strcmp(name, "count") == 0) {
+            o->count = atol(val);
+            if (o->count <= 0) return -1;
+        } else if (strcmp(name, "bytes") == 0) {
+            if (parse_size(val, &o->bytes) < 0) return -1;
+        } else {
+            return -1;
+        }
+        p += used;
+    }
+    *argp = p;
+    return 0;
+}
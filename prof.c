@@ -0,0 +1,65 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Profiling counters, see jinsock.h. Enabled by --profile (report on
+// stderr at exit) or the profile shell command.
+
+int prof_enabled = 0;
+ProfCounter prof_counters[PROF_COUNT];
+
+// Monotonic clock of the probes, also used for throughput and timeouts
+long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const struct {
+    const char *name;
+    const char *unit;           // what amount counts, NULL = nothing
+} prof_names[PROF_COUNT] = {
+    [PROF_SEARCH] = { "search", "sockets" },
+    [PROF_PROC_SCAN] = { "/proc readdir", "pids" },
+    [PROF_COMM] = { "comm read", NULL },
+    [PROF_FD_DIR] = { "fd readdir", "fds" },
+    [PROF_FD_STAT] = { "fd stat", "sockets" },
+    [PROF_NETNS_LOAD] = { "netns table load", "rows" },
+    [PROF_DIAG_RECV] = { "sock_diag recv", "bytes" },
+    [PROF_PROC_TABLE] = { "procfs table parse", "rows" },
+    [PROF_PRINT] = { "print results", "lines" },
+    [PROF_POLL] = { "poll", NULL },
+    [PROF_WRITE] = { "write", "bytes" },
+    [PROF_WRITEV] = { "writev", "bytes" },
+    [PROF_SENDFILE] = { "sendfile", "bytes" },
+    [PROF_SPLICE] = { "splice", "bytes" },
+    [PROF_RECV] = { "recv", "bytes" },
+    [PROF_SENDMMSG] = { "sendmmsg", "msgs" },
+    [PROF_RECVMMSG] = { "recvmmsg", "msgs" },
+    [PROF_URING_ENTER] = { "io_uring_enter", "sqes" },
+};
+
+void prof_report(FILE *out) {
+    fprintf(out, "%-20s %10s %12s %10s  %s\n", "counter", "calls", "total ms", "avg us", "amount");
+    int any = 0;
+    for (int i = 0; i < PROF_COUNT; i++) {
+        const ProfCounter *c = &prof_counters[i];
+        if (!c->calls) continue;
+        any = 1;
+        fprintf(out, "%-20s %10llu %12.3f %10.2f", prof_names[i].name, c->calls, c->ns / 1e6,
+                c->ns / 1e3 / c->calls);
+        if (prof_names[i].unit) fprintf(out, "  %llu %s", c->amount, prof_names[i].unit);
+        fprintf(out, "\n");
+    }
+    if (!any) fprintf(out, "(nothing counted%s)\n", prof_enabled ? "" : ", profiling is off");
+}
+
+void prof_reset(void) {
+    memset(prof_counters, 0, sizeof(prof_counters));
+}
+
+void prof_report_at_exit(void) {
+    fflush(stdout);
+    prof_report(stderr);
+}
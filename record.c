@@ -0,0 +1,261 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Timestamped captures (rec --record) and their replay.
+// A raw capture loses where one read ended and the next began and when
+// each arrived; a record keeps both (layout with RecFileHeader in
+// jinsock.h). The index at the end maps capture times to file offsets so
+// replay --from doesn't read what it skips; a capture cut short (kill -9,
+// full disk) has none and is read from the start.
+
+#define REPLAY_BATCH 64     // chunks per writev/sendmmsg when they are due together
+
+// Switch an open sink to record mode and write the file header
+int recv_sink_record(RecvSink *s, const SockHandle *h) {
+    if (s->pipefd[0] >= 0) {
+        close(s->pipefd[0]);
+        close(s->pipefd[1]);
+        s->pipefd[0] = s->pipefd[1] = -1;
+    }
+    RecFileHeader fh;
+    memset(&fh, 0, sizeof(fh));
+    fh.magic = REC_MAGIC;
+    fh.version = REC_VERSION;
+    fh.header_len = sizeof(fh);
+    fh.pid = h->pid;
+    fh.fd = h->fd;
+    fh.type = h->type;
+    socklen_t len = sizeof(fh.local);
+    if (getsockname(h->sockfd, (struct sockaddr *)&fh.local, &len) == 0) fh.local_len = len;
+    len = sizeof(fh.remote);
+    if (getpeername(h->sockfd, (struct sockaddr *)&fh.remote, &len) == 0) fh.remote_len = len;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    fh.start_realtime_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+    s->record = 1;
+    s->rec_start = now_ns();
+    s->rec_offset = s->rec_next_index = sizeof(fh);
+    return recv_sink_frame(s, (const char *)&fh, sizeof(fh));
+}
+
+// Fill the header of the next len-byte chunk and account for it
+void recv_sink_chunk(RecvSink *s, RecChunk *c, size_t len) {
+    c->t_ns = now_ns() - s->rec_start;
+    c->len = (uint32_t)len;
+    c->flags = 0;
+    if (s->rec_offset >= s->rec_next_index) {
+        if (s->rec_nindex == s->rec_index_cap) {
+            size_t cap = s->rec_index_cap ? s->rec_index_cap * 2 : 256;
+            RecIndexEntry *n = realloc(s->rec_index, cap * sizeof(RecIndexEntry));
+            if (n) {
+                s->rec_index = n;
+                s->rec_index_cap = cap;
+            }
+        }
+        // Out of memory only makes the index coarser
+        if (s->rec_nindex < s->rec_index_cap) {
+            s->rec_index[s->rec_nindex].t_ns = c->t_ns;
+            s->rec_index[s->rec_nindex].offset = s->rec_offset;
+            s->rec_nindex++;
+        }
+        s->rec_next_index = s->rec_offset + REC_INDEX_STEP;
+    }
+    s->rec_offset += sizeof(RecChunk) + len;
+    s->rec_chunks++;
+}
+
+// Index and trailer, once the last chunk is in
+int recv_sink_finish_record(RecvSink *s) {
+    RecTrailer tr = {
+        .magic = REC_INDEX_MAGIC,
+        .count = (uint32_t)s->rec_nindex,
+        .index_offset = s->rec_offset,
+        .chunks = s->rec_chunks,
+        .bytes = s->total
+    };
+    if (s->rec_nindex && recv_sink_frame(s, (const char *)s->rec_index, s->rec_nindex * sizeof(RecIndexEntry)) < 0)
+        return -1;
+    return recv_sink_frame(s, (const char *)&tr, sizeof(tr));
+}
+
+// A mapped record file
+typedef struct {
+    const char *map;
+    size_t size;
+    RecFileHeader fh;
+    size_t start, end;              // chunks live in [start, end)
+    const RecIndexEntry *index;     // NULL without a trailer
+    RecTrailer tr;
+} RecFile;
+
+static int rec_file_open(RecFile *rf, const char *path) {
+    memset(rf, 0, sizeof(*rf));
+    int f = open(path, O_RDONLY | O_CLOEXEC);
+    if (f < 0) {
+        perror(path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(f, &st) < 0 || (size_t)st.st_size < sizeof(RecFileHeader)) {
+        fprintf(stderr, "%s: not a record file\n", path);
+        close(f);
+        return -1;
+    }
+    rf->size = st.st_size;
+    rf->map = mmap(NULL, rf->size, PROT_READ, MAP_PRIVATE, f, 0);
+    close(f);
+    if (rf->map == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise((void *)rf->map, rf->size, MADV_SEQUENTIAL);
+    memcpy(&rf->fh, rf->map, sizeof(rf->fh));
+    if (rf->fh.magic != REC_MAGIC || rf->fh.version != REC_VERSION || rf->fh.header_len < sizeof(RecFileHeader) ||
+        rf->fh.header_len > rf->size) {
+        fprintf(stderr, "%s: not a record file (or another version)\n", path);
+        munmap((void *)rf->map, rf->size);
+        return -1;
+    }
+    rf->start = rf->fh.header_len;
+    rf->end = rf->size;
+    if (rf->size >= rf->start + sizeof(RecTrailer)) {
+        RecTrailer tr;
+        memcpy(&tr, rf->map + rf->size - sizeof(tr), sizeof(tr));
+        size_t ilen = (size_t)tr.count * sizeof(RecIndexEntry);
+        // Checked without sums that could wrap: a bad trailer is ignored
+        if (tr.magic == REC_INDEX_MAGIC && tr.index_offset >= rf->start &&
+            tr.index_offset <= rf->size - sizeof(tr) && ilen == rf->size - sizeof(tr) - tr.index_offset) {
+            rf->tr = tr;
+            rf->end = tr.index_offset;
+            rf->index = (const RecIndexEntry *)(rf->map + tr.index_offset);
+        }
+    }
+    return 0;
+}
+
+// Offset of the first chunk worth reading to start at t_ns
+static size_t rec_file_seek(const RecFile *rf, long long t_ns) {
+    if (!rf->index || t_ns <= 0) return rf->start;
+    size_t lo = 0, hi = rf->tr.count, best = rf->start;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        RecIndexEntry e;
+        memcpy(&e, &rf->index[mid], sizeof(e));
+        if ((long long)e.t_ns <= t_ns) {
+            // An entry pointing outside the chunks is no use
+            if (e.offset >= rf->start && e.offset < rf->end) best = e.offset;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return best;
+}
+
+// Send the batched chunks, each its own datagram on message sockets
+static ssize_t replay_flush(const SockHandle *h, struct iovec *iov, int cnt) {
+    if (cnt == 0) return 0;
+    return handle_is_dgram(h) ? dgram_sendv(h->sockfd, NULL, 0, iov, cnt) : writev_all(h->sockfd, iov, cnt);
+}
+
+ssize_t dup_socket_and_replay(int pid, int fd, unsigned long long inode, const char *path, const ReplayOpts *o) {
+    SockHandle *h = handle_get(pid, fd, inode);
+    if (!h) return -1;
+    RecFile rf;
+    if (rec_file_open(&rf, path) < 0) return -1;
+
+    char local[PATH_MAX], remote[PATH_MAX];
+    format_sockaddr(&rf.fh.local, rf.fh.local_len, local, sizeof(local));
+    format_sockaddr(&rf.fh.remote, rf.fh.remote_len, remote, sizeof(remote));
+    printf("Record of PID %d FD %d (%s -> %s)", rf.fh.pid, rf.fh.fd, local, remote);
+    if (rf.index) printf(": %llu chunk(s), %llu bytes\n", (unsigned long long)rf.tr.chunks, (unsigned long long)rf.tr.bytes);
+    else printf(", no index (capture cut short), reading it whole\n");
+    fflush(stdout);
+
+    struct iovec iov[REPLAY_BATCH];
+    int cnt = 0;
+    long long chunks = 0, total = 0, max_lag = 0, first_t = -1;
+    long long start = now_ns();
+    size_t off = rec_file_seek(&rf, o->from_ns);
+    ssize_t ret = 0;
+    while (off + sizeof(RecChunk) <= rf.end) {
+        RecChunk c;
+        memcpy(&c, rf.map + off, sizeof(c));
+        if (c.len > rf.end - off - sizeof(c)) {
+            fprintf(stderr, "Last chunk truncated, stopping there\n");
+            break;
+        }
+        const char *data = rf.map + off + sizeof(c);
+        off += sizeof(c) + c.len;
+        if ((long long)c.t_ns < o->from_ns) continue;
+        if (first_t < 0) first_t = c.t_ns;
+        if (o->speed > 0) {
+            // Timing is relative to the first chunk replayed, scaled by speed
+            long long due = start + (long long)((c.t_ns - first_t) / o->speed);
+            long long now = now_ns();
+            if (due > now) {
+                if ((ret = replay_flush(h, iov, cnt)) < 0) break;
+                cnt = 0;
+                struct timespec ts = { due / 1000000000LL, due % 1000000000LL };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+                    ;
+            } else if (now - due > max_lag) {
+                max_lag = now - due;
+            }
+        }
+        iov[cnt].iov_base = (void *)data;
+        iov[cnt].iov_len = c.len;
+        cnt++;
+        chunks++;
+        total += c.len;
+        if (cnt == REPLAY_BATCH) {
+            if ((ret = replay_flush(h, iov, cnt)) < 0) break;
+            cnt = 0;
+        }
+    }
+    if (ret >= 0) ret = replay_flush(h, iov, cnt);
+    munmap((void *)rf.map, rf.size);
+    if (ret < 0) {
+        perror("replay");
+        return -1;
+    }
+    print_throughput("Replayed", total, now_ns() - start);
+    if (o->speed > 0) printf("%lld chunk(s), max lag %.3f ms\n", chunks, max_lag / 1e6);
+    else printf("%lld chunk(s)\n", chunks);
+    return total;
+}
+
+// --speed X (0 = as fast as possible) and --from T (seconds, or ms/s suffix)
+int parse_replay_opts(char **argp, ReplayOpts *o) {
+    char *p = *argp;
+    memset(o, 0, sizeof(*o));
+    o->speed = 1;
+    while (strncmp(p, "--", 2) == 0) {
+        char name[16], val[64];
+        int used = 0;
+        if (sscanf(p, "--%15s %63s %n", name, val, &used) != 2) return -1;
+        if (strcmp(name, "speed") == 0) {
+            char *end;
+            o->speed = strtod(val, &end);
+            if (end == val || *end || o->speed < 0) return -1;
+        } else if (strcmp(name, "from") == 0) {
+            int ms;
+            if (parse_timeout_ms(val, &ms) < 0) return -1;
+            o->from_ns = ms * 1000000LL;
+        } else {
+            return -1;
+        }
+        p += used;
+    }
+    *argp = p;
+    return 0;
+}
@@ -0,0 +1,412 @@
+#define _GNU_SOURCE
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// rec --ring NxSIZE PREFIX: bounded capture for long runs.
+// N segment files PREFIX.0 .. PREFIX.N-1 of SIZE bytes each are
+// preallocated up front and written through mmap, oldest overwritten
+// first, so disk use never grows past N * SIZE. The recv loop never
+// touches them: the sink hands full buffers to a writer thread through a
+// single-producer/single-consumer queue of RING_SLOTS buffers, and only
+// if the writer falls RING_SLOTS buffers behind (disk stalled for longer
+// than that much traffic) does the recv loop wait, which is counted.
+//
+// Each segment starts with a RingSegHeader page; seq orders segments
+// (0 = never written) and len is how much of the rest holds data, kept
+// up to date after every buffer so a killed capture is still readable.
+// capture tells this run's segments from those an earlier, larger ring
+// left past PREFIX.N-1. js5 --ring-cat PREFIX writes the data back in
+// order.
+
+#define RING_SLOT (256 * 1024)      // sink buffer, published when full
+#define RING_SLOTS 64               // 16 MiB between recv and disk
+#define RING_HDR 4096               // data starts page aligned
+#define RING_MAGIC 0x4735534AU      // "JS5G"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t seq;
+    uint64_t len;
+    uint64_t start_realtime_ns;     // when the segment was (re)started
+    uint64_t capture;               // version 2: id of the capture, same in all its segments
+    uint32_t nseg;                  // version 2: segments in that capture
+    uint32_t reserved;
+} RingSegHeader;
+
+struct RecvRing {
+    // Queue: slots [tail, head) are filled and belong to the writer, the
+    // others to the sink. head is only written by the recv side, tail
+    // only by the writer; each sleeps on the other's counter (futex) when
+    // there is nothing to do, after saying so in its *_waiting flag.
+    char *bufs[RING_SLOTS];
+    size_t lens[RING_SLOTS];
+    unsigned head, tail;
+    int writer_waiting, sink_waiting;
+    int closing;
+
+    pthread_t writer;
+    int *fds;
+    int nseg;
+    size_t seg_size;
+    uint64_t capture;
+    int syncing;                    // rec_fsync set: msync each finished segment
+    // writer side
+    int cur;
+    char *map;
+    size_t seg_len;
+    uint64_t seq;
+    long long rotations;
+    int error;                      // errno that stopped the writer
+    // sink side
+    long long stalls, stall_ns;
+};
+
+static void futex_wait(unsigned *addr, unsigned val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int ring_map_segment(RecvRing *r, int i) {
+    r->map = mmap(NULL, r->seg_size, PROT_READ | PROT_WRITE, MAP_SHARED, r->fds[i], 0);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return -1;
+    }
+    madvise(r->map, r->seg_size, MADV_SEQUENTIAL);
+    RingSegHeader *h = (RingSegHeader *)r->map;
+    h->magic = RING_MAGIC;
+    h->version = 2;
+    h->capture = r->capture;
+    h->nseg = r->nseg;
+    h->len = 0;
+    h->start_realtime_ns = realtime_ns();
+    __atomic_store_n(&h->seq, ++r->seq, __ATOMIC_RELEASE);
+    r->cur = i;
+    r->seg_len = 0;
+    return 0;
+}
+
+static void ring_unmap_segment(RecvRing *r) {
+    if (!r->map) return;
+    if (r->syncing) msync(r->map, RING_HDR + r->seg_len, MS_SYNC);
+    munmap(r->map, r->seg_size);
+    r->map = NULL;
+}
+
+// Copy one buffer into the segments, moving to the next one when full
+static int ring_write(RecvRing *r, const char *data, size_t n) {
+    size_t room = r->seg_size - RING_HDR;
+    while (n > 0) {
+        if (r->seg_len == room) {
+            ring_unmap_segment(r);
+            if (ring_map_segment(r, (r->cur + 1) % r->nseg) < 0) return -1;
+            r->rotations++;
+        }
+        size_t k = n < room - r->seg_len ? n : room - r->seg_len;
+        long long t0 = prof_begin();
+        memcpy(r->map + RING_HDR + r->seg_len, data, k);
+        prof_end(PROF_WRITE, t0, k);
+        r->seg_len += k;
+        ((RingSegHeader *)r->map)->len = r->seg_len;
+        data += k;
+        n -= k;
+    }
+    return 0;
+}
+
+static void *ring_writer(void *arg) {
+    RecvRing *r = arg;
+    unsigned tail = r->tail;
+    while (1) {
+        unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (__atomic_load_n(&r->closing, __ATOMIC_ACQUIRE)) {
+                // The last buffers may have been published between the two
+                // loads: closing is set after them, so head is final now
+                if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail) break;
+                continue;
+            }
+            __atomic_store_n(&r->writer_waiting, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == tail &&
+                !__atomic_load_n(&r->closing, __ATOMIC_SEQ_CST))
+                futex_wait(&r->head, tail);
+            __atomic_store_n(&r->writer_waiting, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+        for (; tail != head; tail++) {
+            unsigned i = tail % RING_SLOTS;
+            // After an error keep consuming, so the recv side never blocks
+            if (!r->error && ring_write(r, r->bufs[i], r->lens[i]) < 0)
+                __atomic_store_n(&r->error, errno, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&r->tail, tail, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&r->sink_waiting, __ATOMIC_SEQ_CST)) futex_wake(&r->tail);
+    }
+    ring_unmap_segment(r);
+    return NULL;
+}
+
+// Hand the sink buffer to the writer and take the next free one
+int recv_ring_publish(RecvSink *s) {
+    RecvRing *r = s->ring;
+    unsigned head = r->head;
+    r->lens[head % RING_SLOTS] = s->buflen;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->writer_waiting, __ATOMIC_SEQ_CST)) futex_wake(&r->head);
+    head++;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RING_SLOTS) {
+        long long t0 = now_ns();
+        r->stalls++;
+        while (1) {
+            __atomic_store_n(&r->sink_waiting, 1, __ATOMIC_SEQ_CST);
+            unsigned tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+            if (head - tail < RING_SLOTS) break;
+            futex_wait(&r->tail, tail);
+        }
+        __atomic_store_n(&r->sink_waiting, 0, __ATOMIC_RELAXED);
+        r->stall_ns += now_ns() - t0;
+    }
+    s->buf = r->bufs[head % RING_SLOTS];
+    s->buflen = 0;
+    if (__atomic_load_n(&r->error, __ATOMIC_RELAXED)) {
+        errno = r->error;
+        return -1;
+    }
+    return 0;
+}
+
+// "8x256M": count and segment size (k/M/G suffixes), "off" = no ring
+int parse_ring(const char *arg, int *count, long long *size) {
+    if (strcmp(arg, "off") == 0) {
+        *count = 0;
+        *size = 0;
+        return 0;
+    }
+    char *end;
+    long n = strtol(arg, &end, 10);
+    if (end == arg || (*end != 'x' && *end != 'X') || n < 2 || n > 10000) return -1;
+    long long sz;
+    if (parse_size(end + 1, &sz) < 0) return -1;
+    // Page multiples, room for data after the header page
+    sz = (sz + RING_HDR - 1) / RING_HDR * RING_HDR;
+    if (sz < 2 * RING_HDR) return -1;
+    *count = (int)n;
+    *size = sz;
+    return 0;
+}
+
+static void recv_ring_free(RecvRing *r) {
+    for (int i = 0; i < r->nseg; i++)
+        if (r->fds[i] >= 0) close(r->fds[i]);
+    free(r->fds);
+    for (int i = 0; i < RING_SLOTS; i++) free(r->bufs[i]);
+    free(r);
+}
+
+// Create (or reuse) and preallocate the segment files, start the writer
+int recv_ring_open(RecvSink *s, const char *prefix) {
+    if (!prefix) {
+        fprintf(stderr, "--ring needs a file prefix to capture to\n");
+        return -1;
+    }
+    if (rec_record) {
+        fprintf(stderr, "--ring and --record don't combine: segments hold raw bytes\n");
+        return -1;
+    }
+    RecvRing *r = calloc(1, sizeof(RecvRing));
+    if (!r || !(r->fds = malloc(rec_ring_count * sizeof(int)))) {
+        perror("malloc");
+        free(r);
+        return -1;
+    }
+    r->nseg = rec_ring_count;
+    r->seg_size = rec_ring_size;
+    r->capture = realtime_ns() ^ (uint64_t)getpid() << 32;
+    r->syncing = rec_fsync != 0;
+    r->cur = -1;
+    for (int i = 0; i < r->nseg; i++) r->fds[i] = -1;
+    for (int i = 0; i < RING_SLOTS; i++) {
+        if (!(r->bufs[i] = malloc(RING_SLOT))) {
+            perror("malloc");
+            recv_ring_free(r);
+            return -1;
+        }
+    }
+    for (int i = 0; i < r->nseg; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s.%d", prefix, i);
+        r->fds[i] = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (r->fds[i] < 0) {
+            perror(path);
+            recv_ring_free(r);
+            return -1;
+        }
+        // Reserve the blocks now: a full disk fails here, not hours in.
+        // Segments of an earlier capture are marked empty.
+        RingSegHeader h = { .magic = RING_MAGIC, .version = 2, .capture = r->capture, .nseg = r->nseg };
+        int rv = fallocate(r->fds[i], 0, 0, r->seg_size);
+        if (rv < 0 && (errno == EOPNOTSUPP || errno == ENOSYS)) rv = ftruncate(r->fds[i], r->seg_size);
+        if (rv < 0 || ftruncate(r->fds[i], r->seg_size) < 0 || pwrite(r->fds[i], &h, sizeof(h), 0) != sizeof(h)) {
+            perror(path);
+            recv_ring_free(r);
+            return -1;
+        }
+    }
+    if (ring_map_segment(r, 0) < 0) {
+        perror("mmap");
+        recv_ring_free(r);
+        return -1;
+    }
+    if (pthread_create(&r->writer, NULL, ring_writer, r) != 0) {
+        fprintf(stderr, "Cannot start the ring writer thread\n");
+        munmap(r->map, r->seg_size);
+        recv_ring_free(r);
+        return -1;
+    }
+    s->ring = r;
+    s->outfd = -1;
+    s->flush_each = rec_flush == FLUSH_CHUNK;
+    s->buf = r->bufs[0];
+    s->bufcap = RING_SLOT;
+    return 0;
+}
+
+// Publish what is left, wait for the writer and report
+int recv_ring_close(RecvSink *s) {
+    RecvRing *r = s->ring;
+    int ret = 0;
+    // Data first, then closing, then an empty buffer to wake the writer:
+    // once it sees closing with nothing queued, everything was written
+    if (s->buflen) recv_ring_publish(s);
+    __atomic_store_n(&r->closing, 1, __ATOMIC_SEQ_CST);
+    recv_ring_publish(s);
+    pthread_join(r->writer, NULL);
+    if (r->error) {
+        errno = r->error;
+        perror("ring write");
+        ret = -1;
+    }
+    printf("Ring: %d segment(s) of %zu bytes, %lld rotation(s), recv waited for the writer %lld time(s) (%.1f ms)\n",
+           r->nseg, r->seg_size, r->rotations, r->stalls, r->stall_ns / 1e6);
+    recv_ring_free(r);
+    s->ring = NULL;
+    s->buf = NULL;
+    return ret;
+}
+
+// Write the data of PREFIX.* segments to fd, oldest first. Only the
+// newest capture's segments count: a smaller ring reusing the prefix
+// leaves the earlier one's last segments behind.
+int ring_cat(const char *prefix, int fd) {
+    typedef struct { int i; uint64_t seq, capture, start; } SegOrder;
+    SegOrder *order = NULL;
+    int n = 0, cap = 0, ret = 0;
+    for (int i = 0;; i++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s.%d", prefix, i);
+        int f = open(path, O_RDONLY | O_CLOEXEC);
+        if (f < 0) break;
+        RingSegHeader h;
+        memset(&h, 0, sizeof(h));
+        ssize_t got = pread(f, &h, sizeof(h), 0);
+        // Version 1 headers end before capture: those read as capture 0
+        if (got >= (ssize_t)offsetof(RingSegHeader, capture) && h.magic == RING_MAGIC && h.seq != 0 &&
+            (h.version == 1 || (got == sizeof(h) && (uint32_t)i < h.nseg))) {
+            if (n == cap) {
+                cap = cap ? cap * 2 : 16;
+                SegOrder *o = realloc(order, cap * sizeof(SegOrder));
+                if (!o) {
+                    close(f);
+                    free(order);
+                    perror("malloc");
+                    return -1;
+                }
+                order = o;
+            }
+            order[n].i = i;
+            order[n].seq = h.seq;
+            order[n].capture = h.version == 1 ? 0 : h.capture;
+            order[n].start = h.start_realtime_ns;
+            n++;
+        }
+        close(f);
+    }
+    // The newest capture is the one whose latest segment started last
+    if (n > 0) {
+        int newest = 0, kept = 0;
+        for (int k = 1; k < n; k++)
+            if (order[k].start > order[newest].start) newest = k;
+        uint64_t capture = order[newest].capture;
+        for (int k = 0; k < n; k++)
+            if (order[k].capture == capture) order[kept++] = order[k];
+        n = kept;
+    }
+    if (n == 0) {
+        fprintf(stderr, "No ring segments at %s.*\n", prefix);
+        free(order);
+        return -1;
+    }
+    // Few segments: insertion sort by seq
+    for (int a = 1; a < n; a++)
+        for (int b = a; b > 0 && order[b - 1].seq > order[b].seq; b--) {
+            SegOrder t = order[b];
+            order[b] = order[b - 1];
+            order[b - 1] = t;
+        }
+    for (int k = 0; k < n && ret == 0; k++) {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s.%d", prefix, order[k].i);
+        int f = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (f < 0 || fstat(f, &st) < 0) {
+            perror(path);
+            if (f >= 0) close(f);
+            ret = -1;
+            break;
+        }
+        if (st.st_size < RING_HDR) {
+            fprintf(stderr, "%s: truncated ring segment\n", path);
+            close(f);
+            ret = -1;
+            break;
+        }
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, f, 0);
+        close(f);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            ret = -1;
+            break;
+        }
+        RingSegHeader h;
+        memcpy(&h, map, sizeof(h));
+        size_t room = (size_t)st.st_size - RING_HDR;
+        size_t len = h.len < room ? h.len : room;
+        if (write_all(fd, map + RING_HDR, len) < 0) {
+            perror("write");
+            ret = -1;
+        }
+        munmap(map, st.st_size);
+    }
+    free(order);
+    return ret;
+}
@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+// Socket discovery: walk /proc/<pid>/fd of every process and resolve the
+// socket inodes through the per-namespace tables. Nothing here prints or
+// reads the command line settings, everything comes in through
+// SearchOpts, so the shell, watch and the library (api.c) share it.
+
+// Strip the line ending, CRLF (a script written on Windows) included
+void trim_newline(char *s) {
+    size_t len = strlen(s);
+    if (len > 0 && s[len-1] == '\n') s[--len] = 0;
+    if (len > 0 && s[len-1] == '\r') s[--len] = 0;
+}
+
+// Check if the socket inode matches one from /proc/pid/fd/<fd>
+// stat() follows the magic link to the sockfs inode, so no text to parse
+int get_socket_inode_from_fd(pid_t pid, int fd, unsigned long long *inode) {
+    char fdlink[PATH_MAX];
+    struct stat st;
+    snprintf(fdlink, sizeof(fdlink), "/proc/%d/fd/%d", pid, fd);
+    long long t0 = prof_begin();
+    int is_sock = stat(fdlink, &st) == 0 && S_ISSOCK(st.st_mode);
+    prof_end(PROF_FD_STAT, t0, is_sock);
+    if (!is_sock) return -1;
+    *inode = st.st_ino;
+    return 0;
+}
+
+int load_proc_name(pid_t pid, char *buf, size_t buflen) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    if (!fgets(buf, buflen, f)) {
+        fclose(f);
+        return -1;
+    }
+    trim_newline(buf);
+    fclose(f);
+    return 0;
+}
+
+SocketEntry *result_store_push(ResultStore *rs) {
+    if (rs->count == rs->cap) {
+        size_t newcap = rs->cap ? rs->cap * 2 : 64;
+        SocketEntry *items = realloc(rs->items, newcap * sizeof(SocketEntry));
+        if (!items) return NULL;
+        rs->items = items;
+        rs->cap = newcap;
+    }
+    return &rs->items[rs->count++];
+}
+
+// Copy name into the store's name pool, returns its offset
+long result_store_intern(ResultStore *rs, const char *name) {
+    size_t len = strlen(name) + 1;
+    if (rs->names_len + len > rs->names_cap) {
+        size_t newcap = rs->names_cap ? rs->names_cap * 2 : 4096;
+        while (newcap < rs->names_len + len) newcap *= 2;
+        char *names = realloc(rs->names, newcap);
+        if (!names) return -1;
+        rs->names = names;
+        rs->names_cap = newcap;
+    }
+    memcpy(rs->names + rs->names_len, name, len);
+    rs->names_len += len;
+    return (long)(rs->names_len - len);
+}
+
+// Copy what the namespace tables know about a socket into e (si may be
+// NULL); a UNIX path is interned like the process names
+int result_store_fill(ResultStore *rs, SocketEntry *e, const NetnsIndex *ns, const SockInfo *si) {
+    e->state = si ? si->state : 0;
+    e->proto = si ? si->proto : SOCK_PROTO_NONE;
+    e->peer = si ? si->peer : 0;
+    e->path = -1;
+    if (si) {
+        e->local = si->local;
+        e->remote = si->remote;
+    } else {
+        memset(&e->local, 0, sizeof(e->local));
+        memset(&e->remote, 0, sizeof(e->remote));
+    }
+    const char *path = netns_index_unix_path(ns, si);
+    if (path) {
+        long off = result_store_intern(rs, path);
+        if (off < 0) return -1;
+        e->path = (int)off;
+    }
+    return 0;
+}
+
+// Move every entry of src to the end of dst, src is left empty
+int result_store_merge(ResultStore *dst, ResultStore *src) {
+    if (src->count == 0) {
+        result_store_free(src);
+        return 0;
+    }
+    if (dst->count + src->count > dst->cap) {
+        SocketEntry *items = realloc(dst->items, (dst->count + src->count) * sizeof(SocketEntry));
+        if (!items) return -1;
+        dst->items = items;
+        dst->cap = dst->count + src->count;
+    }
+    if (dst->names_len + src->names_len > dst->names_cap) {
+        char *names = realloc(dst->names, dst->names_len + src->names_len);
+        if (!names) return -1;
+        dst->names = names;
+        dst->names_cap = dst->names_len + src->names_len;
+    }
+    memcpy(dst->names + dst->names_len, src->names, src->names_len);
+    for (size_t i = 0; i < src->count; i++) {
+        SocketEntry *e = &dst->items[dst->count++];
+        *e = src->items[i];
+        e->name += dst->names_len;
+        if (e->path >= 0) e->path += dst->names_len;
+    }
+    dst->names_len += src->names_len;
+    result_store_free(src);
+    return 0;
+}
+
+void result_store_free(ResultStore *rs) {
+    free(rs->items);
+    free(rs->names);
+    memset(rs, 0, sizeof(*rs));
+}
+
+typedef struct {
+    const SearchOpts *o;
+    pid_t *pids;
+    size_t npids;
+    size_t next;            // next unclaimed index in pids, taken atomically
+    SockIndex *idx;
+} SearchJob;
+
+typedef struct {
+    SearchJob *job;
+    ResultStore out;        // OUTPUT_TEXT
+    OutBuf ob;              // streamed formats
+    size_t found;
+    int failed;             // out of memory: out is incomplete, worker stopped
+    pthread_t thread;
+} SearchWorker;
+
+#define SEARCH_CHUNK 32
+
+// Filter by pid or process name substring (case-insensitive)
+int search_match(const char *pattern, pid_t pid, const char *proc_name) {
+    if (!pattern || !*pattern) return 1;
+    if (strstr(proc_name, pattern)) return 1;
+    char pidstr[32];
+    snprintf(pidstr, sizeof(pidstr), "%d", pid);
+    return strstr(pidstr, pattern) != NULL;
+}
+
+// readdir, its time added to *ns when profiling
+static struct dirent *readdir_timed(DIR *d, long long *ns) {
+    long long t0 = prof_begin();
+    struct dirent *ent = readdir(d);
+    if (prof_enabled) *ns += now_ns() - t0;
+    return ent;
+}
+
+static void search_pid(SearchJob *job, pid_t pid, SearchWorker *w) {
+    const SearchOpts *o = job->o;
+    ResultStore *out = &w->out;
+    char proc_name[256] = {0};
+    long long t0 = prof_begin();
+    load_proc_name(pid, proc_name, sizeof(proc_name));
+    prof_end(PROF_COMM, t0, 0);
+
+    if (!search_match(o->pattern, pid, proc_name)) return;
+    FilterCtx fc = { .known = FILTER_KNOW_PID, .pid = pid, .comm = proc_name };
+    if (filter_eval(o->filter, &fc) == FILTER_NO) return;
+
+    // List fd entries
+    char fd_dir[PATH_MAX];
+    snprintf(fd_dir, sizeof(fd_dir), "/proc/%d/fd", pid);
+    t0 = prof_begin();
+    DIR *fdp = opendir(fd_dir);
+    if (!fdp) return;
+    long long dir_ns = prof_enabled ? now_ns() - t0 : 0, nfds = 0;
+    NetnsIndex *ns = NULL; // resolved on the first socket fd of this pid
+    long name = -1;        // interned on the first socket fd too
+    struct dirent *fdent;
+    while ((fdent = readdir_timed(fdp, &dir_ns)) != NULL) {
+        if (fdent->d_name[0] == '.') continue;
+        nfds++;
+        int fd = atoi(fdent->d_name);
+        fc.known = FILTER_KNOW_PID | FILTER_KNOW_FD;
+        fc.fd = fd;
+        if (o->filter && filter_eval(o->filter, &fc) == FILTER_NO) continue;
+        unsigned long long inode;
+        if (get_socket_inode_from_fd(pid, fd, &inode) < 0) continue;
+        if (!ns) ns = sock_index_for_pid(job->idx, pid);
+        const SockInfo *si = netns_index_lookup(ns, inode);
+        fc.known |= FILTER_KNOW_SOCK;
+        fc.inode = inode;
+        fc.si = si;
+        fc.path = netns_index_unix_path(ns, si);
+        if (o->filter && filter_eval(o->filter, &fc) != FILTER_YES) continue;
+        if (o->format != OUTPUT_TEXT) {
+            w->found++;
+            output_entry(&w->ob, o->format, pid, fd, inode, proc_name, si, fc.path);
+            continue;
+        }
+        SocketEntry *e = NULL;
+        if ((name >= 0 || (name = result_store_intern(out, proc_name)) >= 0) && (e = result_store_push(out)) != NULL) {
+            memset(e, 0, sizeof(*e));
+            e->pid = pid;
+            e->fd = fd;
+            e->name = (unsigned int)name;
+            e->inode = inode;
+        }
+        if (!e || result_store_fill(out, e, ns, si) < 0) {
+            if (e) out->count--;
+            w->failed = 1;
+            break;
+        }
+        w->found++;
+    }
+    closedir(fdp);
+    prof_add(PROF_FD_DIR, dir_ns, nfds);
+    // Whole pids at a time: the first results show up right away
+    output_flush(&w->ob);
+}
+
+static void *search_worker(void *arg) {
+    SearchWorker *w = arg;
+    SearchJob *job = w->job;
+    while (1) {
+        size_t start = __atomic_fetch_add(&job->next, SEARCH_CHUNK, __ATOMIC_RELAXED);
+        if (start >= job->npids) break;
+        size_t end = start + SEARCH_CHUNK < job->npids ? start + SEARCH_CHUNK : job->npids;
+        for (size_t i = start; i < end && !w->failed; i++)
+            search_pid(job, job->pids[i], w);
+        if (w->failed) break;
+    }
+    return NULL;
+}
+
+static int cmp_pid(const void *a, const void *b) {
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_entry(const void *a, const void *b) {
+    const SocketEntry *x = a, *y = b;
+    if (x->pid != y->pid) return (x->pid > y->pid) - (x->pid < y->pid);
+    return (x->fd > y->fd) - (x->fd < y->fd);
+}
+
+// Number of walker threads: threads, or one per online cpu when 0
+static int search_thread_count(int threads, size_t npids) {
+    long n = threads;
+    if (n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_SEARCH_THREADS) n = MAX_SEARCH_THREADS;
+    size_t chunks = (npids + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+    if ((size_t)n > chunks) n = chunks ? chunks : 1;
+    return (int)n;
+}
+
+// Walk every process and append the matching sockets to out, sorted by
+// (pid, fd). Streamed formats are written to stdout during the walk
+// instead and out is left untouched. Returns the number of sockets
+// found, -1 with errno set when /proc can't be read or memory runs out
+// (out then holds what was merged so far).
+long search_run(const SearchOpts *o, ResultStore *out) {
+    long long t_search = prof_begin(), t0 = t_search;
+    DIR *proc = opendir("/proc");
+    if (!proc) return -1;
+    SearchJob job = { .o = o };
+    size_t pidcap = 0;
+    struct dirent *dent;
+    while ((dent = readdir(proc)) != NULL) {
+        if (!isdigit(dent->d_name[0])) continue;
+        if (job.npids == pidcap) {
+            pidcap = pidcap ? pidcap * 2 : 1024;
+            pid_t *pids = realloc(job.pids, pidcap * sizeof(pid_t));
+            if (!pids) break;
+            job.pids = pids;
+        }
+        job.pids[job.npids++] = atoi(dent->d_name);
+    }
+    closedir(proc);
+    // Sorted pid order keeps chunks (and the single-thread walk) deterministic
+    qsort(job.pids, job.npids, sizeof(pid_t), cmp_pid);
+    prof_end(PROF_PROC_SCAN, t0, job.npids);
+
+    SockIndex idx;
+    sock_index_init(&idx, o->backend);
+    idx.want_tcpinfo = filter_wants_tcpinfo(o->filter);
+    job.idx = &idx;
+    if (o->format != OUTPUT_TEXT) output_begin(o->format);
+
+    int nthreads = search_thread_count(o->threads, job.npids);
+    SearchWorker *workers = calloc(nthreads, sizeof(SearchWorker));
+    if (!workers) {
+        free(job.pids);
+        sock_index_free(&idx);
+        errno = ENOMEM;
+        return -1;
+    }
+    int started = 0;
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].job = &job;
+        // Worker 0 runs on the calling thread
+        if (i == 0) continue;
+        if (pthread_create(&workers[i].thread, NULL, search_worker, &workers[i]) != 0) break;
+        started = i;
+    }
+    search_worker(&workers[0]);
+    for (int i = 1; i <= started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    // Merge per-thread results, then restore (pid, fd) order
+    size_t first = out->count;
+    long found = 0;
+    int failed = 0;
+    for (int i = 0; i < nthreads; i++) {
+        found += workers[i].found;
+        failed |= workers[i].failed;
+        output_free(&workers[i].ob);
+        if (result_store_merge(out, &workers[i].out) < 0) {
+            failed = 1;
+            result_store_free(&workers[i].out);
+        }
+    }
+    free(workers);
+    free(job.pids);
+    int stuck = idx.error;
+    sock_index_free(&idx);
+    qsort(out->items + first, out->count - first, sizeof(SocketEntry), cmp_entry);
+    prof_end(PROF_SEARCH, t_search, found);
+    if (stuck) {
+        errno = stuck;
+        return -1;
+    }
+    if (failed) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return found;
+}
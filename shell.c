@@ -0,0 +1,595 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Command interpreter shared by the interactive shell and --script.
+// Every command acts on the current target: a search result picked with
+// select, or a raw pid/fd given with attach (or -p/-s on the command line).
+// Handles are cached, so a script talks to one duplicate for its whole run.
+
+#define SCRIPT_BATCH (256 * 1024)   // pipelined sends are flushed past this
+
+int selected_fd = -1;
+
+static const char *backend_names[] = { "auto", "netlink", "proc" };
+static const char *flush_names[] = { "auto", "chunk", "end" };
+static const char *engine_names[] = { "sync", "uring" };
+static const char *format_names[] = { "text", "jsonl", "csv", "bin" };
+
+static char *filter_text;     // as typed, for display
+
+static struct {
+    pid_t pid;
+    int fd;
+    unsigned long long inode;
+} target = { -1, -1, 0 };
+
+// Scripts queue consecutive send/sendx payloads and write them with a
+// single send (one sendmmsg on datagram sockets, a datagram per payload)
+// once another command (or the end of the script) needs the wire to be
+// up to date.
+static int pipelining;
+static struct {
+    char *buf;
+    size_t len, cap;
+    size_t *lens;               // length of each queued payload
+    int count, lens_cap;
+} batch;
+
+static void print_fsync_mode(void) {
+    if (rec_fsync == 0) printf("fsync: none\n");
+    else if (rec_fsync == FSYNC_CLOSE) printf("fsync: close\n");
+    else printf("fsync: every %lld bytes\n", rec_fsync);
+}
+
+static char *skip_spaces(char *s) {
+    while (*s == ' ') s++;
+    return s;
+}
+
+int shell_attach(pid_t pid, int fd) {
+    unsigned long long inode;
+    if (pid <= 0 || fd < 0 || get_socket_inode_from_fd(pid, fd, &inode) < 0) {
+        printf("PID %d FD %d is not a socket\n", pid, fd);
+        return -1;
+    }
+    target.pid = pid;
+    target.fd = fd;
+    target.inode = inode;
+    selected_fd = -1;
+    return 0;
+}
+
+static int have_target(void) {
+    if (target.pid > 0) return 1;
+    printf("No socket selected\n");
+    return 0;
+}
+
+// Decode C-style escapes in place (\n \r \t \0 \\ \xHH), returns the length
+static size_t unescape(char *s) {
+    char *in = s, *out = s;
+    while (*in) {
+        if (*in != '\\' || !in[1]) {
+            *out++ = *in++;
+            continue;
+        }
+        in++;
+        unsigned v;
+        int n = 0;
+        switch (*in) {
+            case 'n': *out++ = '\n'; in++; break;
+            case 'r': *out++ = '\r'; in++; break;
+            case 't': *out++ = '\t'; in++; break;
+            case '0': *out++ = '\0'; in++; break;
+            case 'x':
+                if (sscanf(in + 1, "%2x%n", &v, &n) == 1) {
+                    *out++ = (char)v;
+                    in += 1 + n;
+                } else {
+                    *out++ = *in++;     // a lone \x stays "x"
+                }
+                break;
+            default: *out++ = *in++; break;
+        }
+    }
+    return out - s;
+}
+
+static int batch_flush(void) {
+    if (batch.count == 0) return SHELL_OK;
+    ssize_t sent = dup_socket_and_send_msgs(target.pid, target.fd, target.inode, batch.buf, batch.lens, batch.count);
+    if (sent >= 0) printf("Data sent: %zd bytes (%d send%s)\n", sent, batch.count, batch.count == 1 ? "" : "s");
+    batch.len = 0;
+    batch.count = 0;
+    return sent < 0 ? SHELL_ERR : SHELL_OK;
+}
+
+static int send_data(const char *data, size_t len, const LoadOpts *o) {
+    if (o->repeat || o->rate > 0 || o->batch) {
+        // A load run is its own batch: queued sends go out first
+        if (batch_flush() != SHELL_OK) return SHELL_ERR;
+        ssize_t sent = dup_socket_and_send_load(target.pid, target.fd, target.inode, data, len, o);
+        return sent < 0 ? SHELL_ERR : SHELL_OK;
+    }
+    if (!pipelining) {
+        ssize_t sent = dup_socket_and_send(target.pid, target.fd, target.inode, data, len);
+        if (sent < 0) return SHELL_ERR;
+        printf("Data sent: %zd bytes\n", sent);
+        return SHELL_OK;
+    }
+    if (batch.count == batch.lens_cap) {
+        int newcap = batch.lens_cap ? batch.lens_cap * 2 : 64;
+        size_t *l = realloc(batch.lens, newcap * sizeof(size_t));
+        if (!l) {
+            perror("realloc");
+            return SHELL_ERR;
+        }
+        batch.lens = l;
+        batch.lens_cap = newcap;
+    }
+    if (batch.len + len > batch.cap) {
+        size_t newcap = batch.cap ? batch.cap : 4096;
+        while (newcap < batch.len + len) newcap *= 2;
+        char *b = realloc(batch.buf, newcap);
+        if (!b) {
+            perror("realloc");
+            return SHELL_ERR;
+        }
+        batch.buf = b;
+        batch.cap = newcap;
+    }
+    memcpy(batch.buf + batch.len, data, len);
+    batch.len += len;
+    batch.lens[batch.count++] = len;
+    return batch.len >= SCRIPT_BATCH ? batch_flush() : SHELL_OK;
+}
+
+static int is_send_command(const char *line) {
+    return strncmp(line, "send", 4) == 0 && line[4] != 'f' && strncmp(line + 4, "to", 2) != 0;
+}
+
+// Run one command line; SHELL_ERR when it failed, SHELL_QUIT on quit
+int shell_exec(char *line) {
+    line = skip_spaces(line);
+    if (*line == 0 || *line == '#') return SHELL_OK;
+    // Anything but another send must see the wire up to date
+    if (batch.count && !is_send_command(line) && batch_flush() != SHELL_OK) return SHELL_ERR;
+
+    if (strncmp(line, "help", 4) == 0) {
+        cmd_help();
+    } else if (strncmp(line, "search", 6) == 0) {
+        char *arg = skip_spaces(line + 6);
+        cmd_search(*arg ? arg : NULL);
+    } else if (strncmp(line, "watch", 5) == 0) {
+        // watch [pattern] [--interval T] [--count N], options in any order
+        char *pattern = NULL;
+        int interval = 1000;
+        long count = 0;
+        char *save, *tok = strtok_r(line + 5, " ", &save);
+        for (; tok; tok = strtok_r(NULL, " ", &save)) {
+            if (strcmp(tok, "--interval") == 0 || strcmp(tok, "--count") == 0) {
+                char *val = strtok_r(NULL, " ", &save);
+                int bad = !val;
+                if (!bad && tok[2] == 'i') bad = parse_interval_ms(val, &interval) < 0;
+                else if (!bad) bad = (count = atol(val)) <= 0;
+                if (bad) {
+                    printf("Invalid %s value\n", tok);
+                    return SHELL_ERR;
+                }
+            } else {
+                pattern = tok;
+            }
+        }
+        cmd_watch(pattern, interval, count);
+    } else if (strncmp(line, "select", 6) == 0) {
+        int idx = -1;
+        if (sscanf(line + 6, "%d", &idx) != 1 || idx < 0 || (size_t)idx >= results.count) {
+            printf("Invalid index\n");
+            return SHELL_ERR;
+        }
+        SocketEntry *e = &results.items[idx];
+        target.pid = e->pid;
+        target.fd = e->fd;
+        target.inode = e->inode;
+        selected_fd = idx;
+        printf("Selected entry [%d]\n", idx);
+    } else if (strncmp(line, "attach", 6) == 0) {
+        int pid, fd;
+        if (sscanf(line + 6, "%d %d", &pid, &fd) != 2) {
+            printf("Usage: attach <pid> <fd>\n");
+            return SHELL_ERR;
+        }
+        if (shell_attach(pid, fd) < 0) return SHELL_ERR;
+        printf("Attached to PID %d FD %d\n", pid, fd);
+    } else if (strncmp(line, "sendto", 6) == 0) {
+        // sendto [load options] <addr> <string>, escapes decoded as for sendx
+        if (!have_target()) return SHELL_ERR;
+        char *dest = skip_spaces(line + 6);
+        LoadOpts o;
+        if (parse_load_opts(&dest, &o) < 0) {
+            printf("Invalid send options (end them with -- if the data starts with --)\n");
+            return SHELL_ERR;
+        }
+        char *data = strchr(dest, ' ');
+        if (!*dest || !data) {
+            printf("Usage: sendto [--repeat N] [--rate R] [--batch K] <addr> <string>\n");
+            return SHELL_ERR;
+        }
+        *data++ = 0;
+        data = skip_spaces(data);
+        size_t len = unescape(data);
+        if (o.repeat || o.rate > 0 || o.batch) {
+            o.to = dest;
+            ssize_t sent = dup_socket_and_send_load(target.pid, target.fd, target.inode, data, len, &o);
+            return sent < 0 ? SHELL_ERR : SHELL_OK;
+        }
+        ssize_t sent = dup_socket_and_sendto(target.pid, target.fd, target.inode, dest, data, len);
+        if (sent < 0) return SHELL_ERR;
+        printf("Data sent: %zd bytes to %s\n", sent, dest);
+    } else if (strncmp(line, "sendf", 5) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        char *filename = skip_spaces(line + 5);
+        LoadOpts o;
+        if (parse_load_opts(&filename, &o) < 0 || o.repeat || o.batch || o.rate_msgs) {
+            printf("Usage: sendf [--rate BYTES/s] <file>\n");
+            return SHELL_ERR;
+        }
+        if (*filename == 0) {
+            printf("Missing filename\n");
+            return SHELL_ERR;
+        }
+        ssize_t sent = dup_socket_and_sendfile(target.pid, target.fd, target.inode, filename, o.rate);
+        if (sent < 0) return SHELL_ERR;
+        printf("File sent: %zd bytes\n", sent);
+    } else if (strncmp(line, "sendx", 5) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        char *data = skip_spaces(line + 5);
+        LoadOpts o;
+        if (parse_load_opts(&data, &o) < 0) {
+            printf("Invalid send options (end them with -- if the data starts with --)\n");
+            return SHELL_ERR;
+        }
+        size_t len = unescape(data);
+        if (len == 0) {
+            printf("Missing data to send\n");
+            return SHELL_ERR;
+        }
+        return send_data(data, len, &o);
+    } else if (strncmp(line, "send", 4) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        char *data = skip_spaces(line + 4);
+        LoadOpts o;
+        if (parse_load_opts(&data, &o) < 0) {
+            printf("Invalid send options (end them with -- if the data starts with --)\n");
+            return SHELL_ERR;
+        }
+        if (*data == 0) {
+            printf("Missing data to send\n");
+            return SHELL_ERR;
+        }
+        return send_data(data, strlen(data), &o);
+    } else if (strncmp(line, "bridge", 6) == 0) {
+        // bridge [index] <listen-addr>: a search result, or the selected socket
+        char *arg = skip_spaces(line + 6);
+        char *addr = strrchr(arg, ' ');
+        pid_t pid = target.pid;
+        int fd = target.fd;
+        unsigned long long inode = target.inode;
+        if (addr) {
+            int idx = -1;
+            if (sscanf(arg, "%d", &idx) != 1 || idx < 0 || (size_t)idx >= results.count) {
+                printf("Invalid index\n");
+                return SHELL_ERR;
+            }
+            pid = results.items[idx].pid;
+            fd = results.items[idx].fd;
+            inode = results.items[idx].inode;
+            addr++;
+        } else if (*arg) {
+            if (!have_target()) return SHELL_ERR;
+            addr = arg;
+        } else {
+            printf("Usage: bridge [index] <listen-addr>\n");
+            return SHELL_ERR;
+        }
+        if (dup_socket_and_bridge(pid, fd, inode, addr) < 0) return SHELL_ERR;
+    } else if (strncmp(line, "ring", 4) == 0) {
+        char *arg = skip_spaces(line + 4);
+        if (*arg && parse_ring(arg, &rec_ring_count, &rec_ring_size) < 0) {
+            printf("Usage: ring [NxSIZE|off], e.g. ring 8x256M\n");
+            return SHELL_ERR;
+        }
+        if (rec_ring_count) printf("ring: %d x %lld bytes\n", rec_ring_count, rec_ring_size);
+        else printf("ring: off\n");
+    } else if (strncmp(line, "record", 6) == 0) {
+        char *arg = skip_spaces(line + 6);
+        if (strcmp(arg, "on") == 0) {
+            rec_record = 1;
+        } else if (strcmp(arg, "off") == 0) {
+            rec_record = 0;
+        } else if (*arg) {
+            printf("Usage: record [on|off]\n");
+            return SHELL_ERR;
+        }
+        printf("record: %s\n", rec_record ? "on" : "off");
+    } else if (strncmp(line, "replay", 6) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        char *filename = skip_spaces(line + 6);
+        ReplayOpts o;
+        if (parse_replay_opts(&filename, &o) < 0 || *filename == 0) {
+            printf("Usage: replay [--speed X] [--from T] <file>\n");
+            return SHELL_ERR;
+        }
+        if (dup_socket_and_replay(target.pid, target.fd, target.inode, filename, &o) < 0) return SHELL_ERR;
+    } else if (strncmp(line, "rec", 3) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        char *filename = skip_spaces(line + 3);
+        if (dup_socket_and_recv(target.pid, target.fd, target.inode, *filename ? filename : NULL) < 0)
+            return SHELL_ERR;
+    } else if (strncmp(line, "peek", 4) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        char *filename = skip_spaces(line + 4);
+        PeekOpts o;
+        if (parse_peek_opts(&filename, &o) < 0) {
+            printf("Usage: peek [--interval T] [--count N] [--bytes SIZE] [file]\n");
+            return SHELL_ERR;
+        }
+        if (dup_socket_and_peek(target.pid, target.fd, target.inode, *filename ? filename : NULL, &o) < 0)
+            return SHELL_ERR;
+    } else if (strncmp(line, "expect", 6) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        char *text = skip_spaces(line + 6);
+        size_t len = unescape(text);
+        if (len == 0) {
+            printf("Missing text to expect\n");
+            return SHELL_ERR;
+        }
+        long long n = dup_socket_and_expect(target.pid, target.fd, target.inode, text, len);
+        if (n < 0) return SHELL_ERR;
+        printf("Matched after %lld bytes\n", n);
+    } else if (strncmp(line, "wait-for-bytes", 14) == 0) {
+        if (!have_target()) return SHELL_ERR;
+        long long want;
+        if (parse_size(skip_spaces(line + 14), &want) < 0) {
+            printf("Invalid byte count\n");
+            return SHELL_ERR;
+        }
+        long long n = dup_socket_and_drain(target.pid, target.fd, target.inode, want);
+        if (n < 0) return SHELL_ERR;
+        printf("Received %lld bytes\n", n);
+    } else if (strncmp(line, "sleep", 5) == 0) {
+        int ms;
+        if (parse_timeout_ms(skip_spaces(line + 5), &ms) < 0) {
+            printf("Invalid duration\n");
+            return SHELL_ERR;
+        }
+        struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR) ;
+    } else if (strncmp(line, "tap", 3) == 0) {
+        char *spec = skip_spaces(line + 3);
+        char *dir = strchr(spec, ' ');
+        if (dir) {
+            *dir++ = 0;
+            dir = skip_spaces(dir);
+        }
+        size_t *idx, n;
+        if (!*spec || parse_selection(&results, spec, &idx, &n) < 0) {
+            printf("Invalid selection\n");
+            return SHELL_ERR;
+        }
+        int rv = tap_sockets(&results, idx, n, dir && *dir ? dir : NULL);
+        free(idx);
+        if (rv < 0) return SHELL_ERR;
+    } else if (strncmp(line, "stats", 5) == 0) {
+        // stats [--interval T] [--count N] [selection], default: the target
+        char *spec = NULL;
+        int interval = 1000;
+        long count = 0;
+        char *save, *tok = strtok_r(line + 5, " ", &save);
+        for (; tok; tok = strtok_r(NULL, " ", &save)) {
+            if (strcmp(tok, "--interval") == 0 || strcmp(tok, "--count") == 0) {
+                char *val = strtok_r(NULL, " ", &save);
+                int bad = !val;
+                if (!bad && tok[2] == 'i') bad = parse_interval_ms(val, &interval) < 0;
+                else if (!bad) bad = (count = atol(val)) <= 0;
+                if (bad) {
+                    printf("Invalid %s value\n", tok);
+                    return SHELL_ERR;
+                }
+            } else {
+                spec = tok;
+            }
+        }
+        if (!spec) {
+            if (!have_target()) return SHELL_ERR;
+            return dup_socket_and_stats(target.pid, target.fd, target.inode, interval, count) < 0 ? SHELL_ERR : SHELL_OK;
+        }
+        size_t *idx, n;
+        if (parse_selection(&results, spec, &idx, &n) < 0) {
+            printf("Invalid selection\n");
+            return SHELL_ERR;
+        }
+        int rv = stats_sockets(&results, idx, n, interval, count);
+        free(idx);
+        if (rv < 0) return SHELL_ERR;
+    } else if (strncmp(line, "timeout", 7) == 0) {
+        if (parse_timeout_ms(skip_spaces(line + 7), &recv_timeout_ms) < 0) {
+            printf("Invalid timeout value\n");
+            return SHELL_ERR;
+        }
+        char t[32];
+        format_timeout(recv_timeout_ms, t, sizeof(t));
+        printf("Timeout set to %s\n", t);
+    } else if (strncmp(line, "backend", 7) == 0) {
+        char *name = skip_spaces(line + 7);
+        if (*name) {
+            int b = parse_backend(name);
+            if (b < 0) {
+                printf("Unknown backend: %s\n", name);
+                return SHELL_ERR;
+            }
+            discovery_backend = b;
+        }
+        printf("Discovery backend: %s\n", backend_names[discovery_backend]);
+    } else if (strncmp(line, "engine", 6) == 0) {
+        char *name = skip_spaces(line + 6);
+        if (*name) {
+            int e = parse_engine(name);
+            if (e < 0) {
+                printf("Unknown engine: %s\n", name);
+                return SHELL_ERR;
+            }
+            io_engine = e;
+        }
+        printf("I/O engine: %s\n", engine_names[io_engine]);
+    } else if (strncmp(line, "filter", 6) == 0) {
+        char *expr = skip_spaces(line + 6);
+        if (strcmp(expr, "off") == 0) {
+            filter_free(search_filter);
+            search_filter = NULL;
+            free(filter_text);
+            filter_text = NULL;
+        } else if (*expr) {
+            char err[128];
+            Filter *f = filter_compile(expr, err, sizeof(err));
+            if (!f) {
+                printf("Invalid filter: %s\n", err);
+                return SHELL_ERR;
+            }
+            filter_free(search_filter);
+            search_filter = f;
+            free(filter_text);
+            filter_text = strdup(expr);
+        }
+        printf("Filter: %s\n", search_filter ? (filter_text ? filter_text : "(command line)") : "none");
+    } else if (strncmp(line, "format", 6) == 0) {
+        char *name = skip_spaces(line + 6);
+        if (*name) {
+            int f = parse_format(name);
+            if (f < 0) {
+                printf("Unknown format: %s\n", name);
+                return SHELL_ERR;
+            }
+            output_format = f;
+        }
+        printf("Search output: %s\n", format_names[output_format]);
+    } else if (strncmp(line, "threads", 7) == 0) {
+        int t = -1;
+        if (sscanf(line + 7, "%d", &t) != 1 || t < 0) {
+            printf("Invalid thread count\n");
+            return SHELL_ERR;
+        }
+        search_threads = t;
+        printf("Search threads set to %d%s\n", t, t == 0 ? " (one per cpu)" : "");
+    } else if (strncmp(line, "release", 7) == 0) {
+        char *arg = skip_spaces(line + 7);
+        if (strcmp(arg, "all") == 0) {
+            printf("Released %d handle(s)\n", handle_release_all());
+            return SHELL_OK;
+        }
+        if (*arg) {
+            int idx = -1;
+            if (sscanf(arg, "%d", &idx) != 1 || idx < 0 || (size_t)idx >= results.count) {
+                printf("Invalid index\n");
+                return SHELL_ERR;
+            }
+            SocketEntry *e = &results.items[idx];
+            printf("Released %d handle(s)\n", handle_release(e->pid, e->fd));
+            return SHELL_OK;
+        }
+        if (!have_target()) return SHELL_ERR;
+        printf("Released %d handle(s)\n", handle_release(target.pid, target.fd));
+    } else if (strncmp(line, "flush", 5) == 0) {
+        char *arg = skip_spaces(line + 5);
+        if (*arg) {
+            int m = parse_flush_mode(arg);
+            if (m < 0) {
+                printf("Unknown flush mode: %s\n", arg);
+                return SHELL_ERR;
+            }
+            rec_flush = m;
+        }
+        printf("flush: %s\n", flush_names[rec_flush]);
+    } else if (strncmp(line, "fsync", 5) == 0) {
+        char *arg = skip_spaces(line + 5);
+        if (*arg && parse_fsync_mode(arg, &rec_fsync) < 0) {
+            printf("Invalid fsync mode: %s\n", arg);
+            return SHELL_ERR;
+        }
+        print_fsync_mode();
+    } else if (strncmp(line, "profile", 7) == 0) {
+        char *arg = skip_spaces(line + 7);
+        if (strcmp(arg, "on") == 0) {
+            prof_enabled = 1;
+        } else if (strcmp(arg, "off") == 0) {
+            prof_enabled = 0;
+        } else if (strcmp(arg, "reset") == 0) {
+            prof_reset();
+        } else if (*arg) {
+            printf("Usage: profile [on|off|reset]\n");
+            return SHELL_ERR;
+        }
+        if (*arg) printf("Profiling: %s\n", prof_enabled ? "on" : "off");
+        else prof_report(stdout);
+    } else if (strncmp(line, "quit", 4) == 0) {
+        return SHELL_QUIT;
+    } else {
+        printf("Unknown command: %s\n", line);
+        return SHELL_ERR;
+    }
+    return SHELL_OK;
+}
+
+void shell_run(void) {
+    char *line = NULL;
+    size_t cap = 0;
+    printf("Socket Injector Shell. Type 'help' for commands.\n");
+    while (1) {
+        printf("> ");
+        fflush(stdout);
+        if (getline(&line, &cap, stdin) < 0) break;
+        trim_newline(line);
+        if (shell_exec(line) == SHELL_QUIT) break;
+    }
+    free(line);
+}
+
+// Run a command file ("-" for stdin), stopping at the first failing command
+int shell_run_script(const char *path) {
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    int lineno = 0, ret = 0;
+    pipelining = 1;
+    while (getline(&line, &cap, f) >= 0) {
+        lineno++;
+        trim_newline(line);
+        int rv = shell_exec(line);
+        if (rv == SHELL_QUIT) break;
+        if (rv == SHELL_ERR) {
+            fflush(stdout);
+            fprintf(stderr, "%s:%d: command failed\n", path, lineno);
+            ret = -1;
+            break;
+        }
+    }
+    if (ret == 0 && batch_flush() != SHELL_OK) {
+        fflush(stdout);
+        fprintf(stderr, "%s: pipelined send failed\n", path);
+        ret = -1;
+    }
+    pipelining = 0;
+    batch.len = 0;
+    batch.count = 0;
+    free(line);
+    if (f != stdin) fclose(f);
+    return ret;
+}
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <linux/limits.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+#include <linux/unix_diag.h>
+
+// NETLINK_SOCK_DIAG discovery backend.
+// inet_diag and unix_diag dumps return binary records (inode, endpoints,
+// state, queues, UNIX path and peer, optionally tcp_info) so no table text
+// has to be parsed.
+
+// errno of a failed return to the thread's own namespace, 0 if none
+static __thread int netns_stuck;
+
+// Nonzero (an errno) once the calling thread failed to get back to its
+// network namespace after a query: sockets it opens land in the wrong one.
+// search_run then fails; what to do about the thread is the caller's call.
+int sockdiag_netns_stuck(void) {
+    return netns_stuck;
+}
+
+// Open a sock_diag socket living in pid's network namespace.
+// A netlink socket answers for the namespace it was created in, so for a
+// foreign namespace we briefly setns() the calling thread into it.
+static int sockdiag_open(pid_t pid) {
+    char path[PATH_MAX];
+    struct stat target, self;
+    // No more namespace hopping from a thread that couldn't get back
+    if (netns_stuck) {
+        errno = netns_stuck;
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/proc/%d/ns/net", pid);
+    if (stat(path, &target) < 0) return -1;
+    if (stat("/proc/thread-self/ns/net", &self) < 0) return -1;
+
+    if (target.st_ino == self.st_ino && target.st_dev == self.st_dev)
+        return socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+
+    int selfns = open("/proc/thread-self/ns/net", O_RDONLY | O_CLOEXEC);
+    if (selfns < 0) return -1;
+    int targetns = open(path, O_RDONLY | O_CLOEXEC);
+    if (targetns < 0) {
+        close(selfns);
+        return -1;
+    }
+    int nl = -1;
+    if (setns(targetns, CLONE_NEWNET) == 0) {
+        nl = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+        if (setns(selfns, CLONE_NEWNET) < 0) {
+            netns_stuck = errno;
+            if (nl >= 0) close(nl);
+            nl = -1;
+        }
+    }
+    close(targetns);
+    close(selfns);
+    if (netns_stuck) errno = netns_stuck;
+    return nl;
+}
+
+static void sockinfo_from_diag(SockInfo *si, const struct inet_diag_msg *msg, int proto) {
+    memset(si, 0, sizeof(*si));
+    size_t alen = msg->idiag_family == AF_INET6 ? 16 : 4;
+    si->inode = msg->idiag_inode;
+    si->proto = proto;
+    si->local.family = msg->idiag_family;
+    si->local.port = ntohs(msg->id.idiag_sport);
+    memcpy(si->local.addr, msg->id.idiag_src, alen);
+    si->remote.family = msg->idiag_family;
+    si->remote.port = ntohs(msg->id.idiag_dport);
+    memcpy(si->remote.addr, msg->id.idiag_dst, alen);
+    si->state = msg->idiag_state;
+    si->tx_queue = msg->idiag_wqueue;
+    si->rx_queue = msg->idiag_rqueue;
+    si->uid = msg->idiag_uid;
+}
+
+static void sockinfo_add_tcpinfo(SockInfo *si, const struct nlmsghdr *nlh, const struct inet_diag_msg *msg) {
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg));
+    for (struct rtattr *attr = (struct rtattr *)(msg + 1); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        if (attr->rta_type != INET_DIAG_INFO) continue;
+        struct tcp_info ti;
+        memset(&ti, 0, sizeof(ti));
+        size_t n = RTA_PAYLOAD(attr);
+        memcpy(&ti, RTA_DATA(attr), n < sizeof(ti) ? n : sizeof(ti));
+        si->has_tcpinfo = 1;
+        si->rtt_us = ti.tcpi_rtt;
+        si->rttvar_us = ti.tcpi_rttvar;
+        si->snd_cwnd = ti.tcpi_snd_cwnd;
+        si->total_retrans = ti.tcpi_total_retrans;
+    }
+}
+
+// unix_diag record: path (abstract names shown with a leading '@'),
+// peer, queues and uid travel as attributes
+static int sockinfo_from_unix_diag(SockInfo *si, NetnsIndex *ns, const struct nlmsghdr *nlh) {
+    const struct unix_diag_msg *msg = NLMSG_DATA(nlh);
+    memset(si, 0, sizeof(*si));
+    si->inode = msg->udiag_ino;
+    si->proto = SOCK_PROTO_UNIX;
+    si->local.family = si->remote.family = AF_UNIX;
+    si->state = msg->udiag_state;
+    si->uid = (uid_t)-1;
+    int len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof(*msg));
+    for (struct rtattr *attr = (struct rtattr *)(msg + 1); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        size_t n = RTA_PAYLOAD(attr);
+        switch (attr->rta_type) {
+            case UNIX_DIAG_NAME: {
+                char path[PATH_MAX];
+                if (n == 0 || n >= sizeof(path)) break;
+                memcpy(path, RTA_DATA(attr), n);
+                if (path[0] == 0) path[0] = '@';
+                long off = netns_index_add_path(ns, path, strnlen(path, n));
+                if (off < 0) return -1;
+                si->path = (unsigned int)off;
+                break;
+            }
+            case UNIX_DIAG_PEER:
+                if (n >= sizeof(uint32_t)) si->peer = *(uint32_t *)RTA_DATA(attr);
+                break;
+            case UNIX_DIAG_RQLEN:
+                if (n >= sizeof(struct unix_diag_rqlen)) {
+                    const struct unix_diag_rqlen *q = RTA_DATA(attr);
+                    si->rx_queue = q->udiag_rqueue;
+                    si->tx_queue = q->udiag_wqueue;
+                }
+                break;
+            case UNIX_DIAG_UID:
+                if (n >= sizeof(uint32_t)) si->uid = *(uint32_t *)RTA_DATA(attr);
+                break;
+        }
+    }
+    return 0;
+}
+
+// Send one dump request and index every record of the answer, returns
+// the number of records or -1. proto tags inet records; unix_diag ones
+// are recognised by their family.
+static int sockdiag_dump(int nl, NetnsIndex *ns, const void *req, size_t reqlen, int proto, int want_tcpinfo) {
+    struct {
+        struct nlmsghdr nlh;
+        char req[sizeof(struct inet_diag_req_v2)];
+    } request;
+    memset(&request, 0, sizeof(request));
+    request.nlh.nlmsg_len = NLMSG_LENGTH(reqlen);
+    request.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+    request.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.nlh.nlmsg_seq = 1;
+    memcpy(request.req, req, reqlen);
+
+    struct sockaddr_nl kernel = { .nl_family = AF_NETLINK };
+    if (sendto(nl, &request, request.nlh.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel)) < 0)
+        return -1;
+
+    static __thread char buf[64 * 1024];
+    int records = 0;
+    while (1) {
+        long long t0 = prof_begin();
+        ssize_t n = recv(nl, buf, sizeof(buf), 0);
+        prof_end(PROF_DIAG_RECV, t0, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;
+        for (struct nlmsghdr *nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, n); nlh = NLMSG_NEXT(nlh, n)) {
+            if (nlh->nlmsg_type == NLMSG_DONE) return records;
+            if (nlh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(nlh);
+                errno = -err->error;
+                return -1;
+            }
+            if (nlh->nlmsg_type != SOCK_DIAG_BY_FAMILY) continue;
+            SockInfo si;
+            if (*(const unsigned char *)NLMSG_DATA(nlh) == AF_UNIX) {
+                if (sockinfo_from_unix_diag(&si, ns, nlh) < 0) return -1;
+            } else {
+                const struct inet_diag_msg *msg = NLMSG_DATA(nlh);
+                sockinfo_from_diag(&si, msg, proto);
+                if (want_tcpinfo) sockinfo_add_tcpinfo(&si, nlh, msg);
+            }
+            if (netns_index_insert(ns, &si) < 0) return -1;
+            records++;
+        }
+    }
+}
+
+// Both families of one inet protocol. IPv6 may be compiled out or
+// disabled: IPv4 results alone are still valid.
+static int sockdiag_dump_inet(int nl, NetnsIndex *ns, int protocol, int proto, int want_tcpinfo) {
+    int records;
+    struct inet_diag_req_v2 req;
+    memset(&req, 0, sizeof(req));
+    req.sdiag_protocol = protocol;
+    req.idiag_states = ~0U;
+    if (want_tcpinfo && protocol == IPPROTO_TCP)
+        req.idiag_ext = 1 << (INET_DIAG_INFO - 1);
+    req.sdiag_family = AF_INET;
+    if ((records = sockdiag_dump(nl, ns, &req, sizeof(req), proto, want_tcpinfo)) < 0) return -1;
+    req.sdiag_family = AF_INET6;
+    int more = sockdiag_dump(nl, ns, &req, sizeof(req), proto, want_tcpinfo);
+    return more > 0 ? records + more : records;
+}
+
+static int sockdiag_dump_unix(int nl, NetnsIndex *ns) {
+    struct unix_diag_req req;
+    memset(&req, 0, sizeof(req));
+    req.sdiag_family = AF_UNIX;
+    req.udiag_states = ~0U;
+    req.udiag_show = UDIAG_SHOW_NAME | UDIAG_SHOW_PEER | UDIAG_SHOW_RQLEN | UDIAG_SHOW_UID;
+    return sockdiag_dump(nl, ns, &req, sizeof(req), SOCK_PROTO_UNIX, 0);
+}
+
+// Returns the PROTO_BIT mask of the protocols loaded, -1 when netlink
+// can't be used at all (the tcp dump fails). The other protocols need
+// their own diag module and are left to the caller when missing.
+int netns_index_load_diag(NetnsIndex *ns, pid_t pid, int want_tcpinfo) {
+    int nl = sockdiag_open(pid);
+    if (nl < 0) return -1;
+    int got = -1;
+    if (sockdiag_dump_inet(nl, ns, IPPROTO_TCP, SOCK_PROTO_TCP, want_tcpinfo) >= 0) {
+        got = PROTO_BIT(SOCK_PROTO_TCP);
+        if (sockdiag_dump_inet(nl, ns, IPPROTO_UDP, SOCK_PROTO_UDP, 0) >= 0) got |= PROTO_BIT(SOCK_PROTO_UDP);
+        // Without raw_diag the raw dump comes back empty rather than failing:
+        // only a non-empty answer counts, /proc/net/raw is small anyway
+        if (sockdiag_dump_inet(nl, ns, IPPROTO_RAW, SOCK_PROTO_RAW, 0) > 0) got |= PROTO_BIT(SOCK_PROTO_RAW);
+        if (sockdiag_dump_unix(nl, ns) >= 0) got |= PROTO_BIT(SOCK_PROTO_UNIX);
+    }
+    close(nl);
+    return got;
+}
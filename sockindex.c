@@ -0,0 +1,479 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+// Inode -> connection index, one per network namespace.
+// Every pid of a namespace sees the same /proc/<pid>/net/{tcp,udp,raw}{,6}
+// and unix tables, so they are parsed once per search and shared by all
+// pids living in it.
+
+#define NETNS_INDEX_MIN_CAP 256
+
+static size_t inode_hash(unsigned long long inode, size_t mask) {
+    return (size_t)((inode * 0x9E3779B97F4A7C15ULL) >> 17) & mask;
+}
+
+static int netns_index_grow(NetnsIndex *ns) {
+    size_t newcap = ns->cap ? ns->cap * 2 : NETNS_INDEX_MIN_CAP;
+    SockInfo *slots = calloc(newcap, sizeof(SockInfo));
+    if (!slots) return -1;
+    for (size_t i = 0; i < ns->cap; i++) {
+        SockInfo *s = &ns->slots[i];
+        if (s->inode == 0) continue;
+        size_t h = inode_hash(s->inode, newcap - 1);
+        while (slots[h].inode != 0) h = (h + 1) & (newcap - 1);
+        slots[h] = *s;
+    }
+    free(ns->slots);
+    ns->slots = slots;
+    ns->cap = newcap;
+    return 0;
+}
+
+static unsigned long long fnv1a(unsigned long long h, const char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 0x100000001B3ULL;
+    }
+    return h;
+}
+
+// Hash of what watch reports on: identity, endpoints and state. Queues,
+// timers and tcp_info move constantly on a busy host and would make every
+// tick look like a change.
+static unsigned long long sockinfo_digest(const SockInfo *si) {
+    unsigned long long h = 0xCBF29CE484222325ULL;
+    h = fnv1a(h, (const char *)&si->inode, sizeof(si->inode));
+    h = fnv1a(h, (const char *)&si->proto, sizeof(si->proto));
+    h = fnv1a(h, (const char *)&si->local, sizeof(si->local));
+    h = fnv1a(h, (const char *)&si->remote, sizeof(si->remote));
+    h = fnv1a(h, (const char *)&si->peer, sizeof(si->peer));
+    return fnv1a(h, (const char *)&si->state, sizeof(si->state));
+}
+
+int netns_index_insert(NetnsIndex *ns, const SockInfo *si) {
+    if (si->inode == 0) return 0; // not yet bound to a file, nobody can own it
+    if ((ns->count + 1) * 10 >= ns->cap * 7 && netns_index_grow(ns) < 0) return -1;
+    size_t mask = ns->cap - 1;
+    size_t h = inode_hash(si->inode, mask);
+    while (ns->slots[h].inode != 0) {
+        if (ns->slots[h].inode == si->inode) {
+            ns->digest -= sockinfo_digest(&ns->slots[h]);
+            ns->digest += sockinfo_digest(si);
+            ns->slots[h] = *si;
+            return 0;
+        }
+        h = (h + 1) & mask;
+    }
+    ns->slots[h] = *si;
+    ns->count++;
+    // A sum, so the order of the records doesn't matter
+    ns->digest += sockinfo_digest(si);
+    return 0;
+}
+
+const SockInfo *netns_index_lookup(const NetnsIndex *ns, unsigned long long inode) {
+    if (!ns || ns->cap == 0 || inode == 0) return NULL;
+    size_t mask = ns->cap - 1;
+    size_t h = inode_hash(inode, mask);
+    while (ns->slots[h].inode != 0) {
+        if (ns->slots[h].inode == inode) return &ns->slots[h];
+        h = (h + 1) & mask;
+    }
+    return NULL;
+}
+
+// Copy a UNIX socket path into the index's pool, returns its offset
+long netns_index_add_path(NetnsIndex *ns, const char *path, size_t len) {
+    if (len == 0) return 0;
+    if (ns->paths_len + len + 1 > ns->paths_cap || !ns->paths) {
+        size_t newcap = ns->paths_cap ? ns->paths_cap * 2 : 4096;
+        while (newcap < ns->paths_len + len + 2) newcap *= 2;
+        char *paths = realloc(ns->paths, newcap);
+        if (!paths) return -1;
+        if (!ns->paths) {
+            paths[0] = 0;
+            ns->paths_len = 1;
+        }
+        ns->paths = paths;
+        ns->paths_cap = newcap;
+    }
+    memcpy(ns->paths + ns->paths_len, path, len);
+    ns->paths[ns->paths_len + len] = 0;
+    ns->paths_len += len + 1;
+    return (long)(ns->paths_len - len - 1);
+}
+
+// Path shown for a UNIX socket: its own, or its peer's for the unnamed end
+// of a connection (a client socket). NULL when neither end is bound.
+const char *netns_index_unix_path(const NetnsIndex *ns, const SockInfo *si) {
+    if (!si || si->proto != SOCK_PROTO_UNIX) return NULL;
+    if (si->path) return ns->paths + si->path;
+    const SockInfo *peer = si->peer ? netns_index_lookup(ns, si->peer) : NULL;
+    return peer && peer->path ? ns->paths + peer->path : NULL;
+}
+
+// hex format: "0100007F:1F90" (IPv4) or 32 hex digits + ":1F90" (IPv6),
+// address words are in host byte order as printed by the kernel
+int parse_hex_addr(const char *hex, JsAddr *out) {
+    const char *colon = strchr(hex, ':');
+    if (!colon) return -1;
+    size_t hexlen = colon - hex;
+    unsigned int port;
+    if (sscanf(colon + 1, "%X", &port) != 1) return -1;
+
+    memset(out, 0, sizeof(*out));
+    if (hexlen == 8) {
+        unsigned int ipval;
+        if (sscanf(hex, "%8X", &ipval) != 1) return -1;
+        out->family = AF_INET;
+        memcpy(out->addr, &ipval, 4);
+    } else if (hexlen == 32) {
+        out->family = AF_INET6;
+        for (int w = 0; w < 4; w++) {
+            char wordhex[9];
+            memcpy(wordhex, hex + w * 8, 8);
+            wordhex[8] = 0;
+            unsigned int word = (unsigned int)strtoul(wordhex, NULL, 16);
+            memcpy(out->addr + w * 4, &word, 4);
+        }
+    } else {
+        return -1;
+    }
+    out->port = (unsigned short)port;
+    return 0;
+}
+
+int format_addr(const JsAddr *a, char *buf, size_t buflen) {
+    if (a->family != AF_INET && a->family != AF_INET6) {
+        snprintf(buf, buflen, "?");
+        return -1;
+    }
+    if (!inet_ntop(a->family, a->addr, buf, buflen)) {
+        snprintf(buf, buflen, "?");
+        return -1;
+    }
+    return 0;
+}
+
+// Load one /proc/<pid>/net/{tcp,udp,raw}{,6} table into ns, they share
+// their leading columns
+static int netns_index_load_table(NetnsIndex *ns, const char *path, int proto) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[512];
+    if (!fgets(line, sizeof(line), f)) { // skip header
+        fclose(f);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        // sl  local_address rem_address st tx_queue:rx_queue tr:tm->when retrnsmt uid timeout inode
+        char local_addr[64], rem_addr[64];
+        unsigned int st, txq, rxq, uid;
+        unsigned long long inode;
+        if (sscanf(line, "%*u: %63s %63s %X %X:%X %*X:%*X %*X %u %*d %llu",
+                   local_addr, rem_addr, &st, &txq, &rxq, &uid, &inode) != 7)
+            continue;
+        SockInfo si;
+        memset(&si, 0, sizeof(si));
+        if (parse_hex_addr(local_addr, &si.local) < 0) continue;
+        if (parse_hex_addr(rem_addr, &si.remote) < 0) continue;
+        si.inode = inode;
+        si.proto = proto;
+        si.state = st;
+        si.tx_queue = txq;
+        si.rx_queue = rxq;
+        si.uid = uid;
+        if (netns_index_insert(ns, &si) < 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// UNIX socket states and flags, as in /proc/net/unix
+#define UNIX_SS_CONNECTING 2
+#define UNIX_SS_CONNECTED 3
+#define UNIX_ACCEPTCON 0x10000  // listening
+
+// /proc/<pid>/net/unix: no peer inode and no uid in this one
+static int netns_index_load_unix(NetnsIndex *ns, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char line[PATH_MAX + 128];
+    if (!fgets(line, sizeof(line), f)) {
+        fclose(f);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        // Num RefCount Protocol Flags Type St Inode [Path]
+        unsigned int flags, st;
+        unsigned long long inode;
+        int used = 0;
+        if (sscanf(line, "%*s %*x %*x %x %*x %x %llu %n", &flags, &st, &inode, &used) != 3)
+            continue;
+        trim_newline(line);
+        SockInfo si;
+        memset(&si, 0, sizeof(si));
+        si.inode = inode;
+        si.proto = SOCK_PROTO_UNIX;
+        si.local.family = si.remote.family = AF_UNIX;
+        si.uid = (uid_t)-1;
+        if (st == UNIX_SS_CONNECTED) si.state = TCP_ESTABLISHED;
+        else if (st == UNIX_SS_CONNECTING) si.state = TCP_SYN_SENT;
+        else si.state = flags & UNIX_ACCEPTCON ? TCP_LISTEN : TCP_CLOSE;
+        long off = netns_index_add_path(ns, line + used, strlen(line + used));
+        if (off < 0) {
+            fclose(f);
+            return -1;
+        }
+        si.path = (unsigned int)off;
+        if (netns_index_insert(ns, &si) < 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+// Load the procfs tables of the protocols in protos (PROTO_BIT mask)
+int netns_index_load_proc(NetnsIndex *ns, pid_t pid, int protos) {
+    static const struct {
+        const char *name;
+        int proto;
+    } tables[] = {
+        { "tcp", SOCK_PROTO_TCP }, { "tcp6", SOCK_PROTO_TCP },
+        { "udp", SOCK_PROTO_UDP }, { "udp6", SOCK_PROTO_UDP },
+        { "raw", SOCK_PROTO_RAW }, { "raw6", SOCK_PROTO_RAW },
+    };
+    char path[PATH_MAX];
+    int loaded = 0;
+    for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+        if (!(protos & PROTO_BIT(tables[i].proto))) continue;
+        snprintf(path, sizeof(path), "/proc/%d/net/%s", pid, tables[i].name);
+        long long t0 = prof_begin();
+        size_t rows = ns->count;
+        if (netns_index_load_table(ns, path, tables[i].proto) == 0) loaded++;
+        prof_end(PROF_PROC_TABLE, t0, ns->count - rows);
+    }
+    if (protos & PROTO_BIT(SOCK_PROTO_UNIX)) {
+        snprintf(path, sizeof(path), "/proc/%d/net/unix", pid);
+        long long t0 = prof_begin();
+        size_t rows = ns->count;
+        if (netns_index_load_unix(ns, path) == 0) loaded++;
+        prof_end(PROF_PROC_TABLE, t0, ns->count - rows);
+    }
+    return loaded ? 0 : -1;
+}
+
+// Fill ns using the given discovery backend (DISCOVERY_*).
+// In auto mode sock_diag is tried first and procfs covers kernels or
+// namespaces where netlink isn't allowed, and protocols whose diag module
+// is missing (udp_diag, raw_diag...).
+static int netns_index_load_backend(NetnsIndex *ns, pid_t pid, int backend, int want_tcpinfo) {
+    if (backend != DISCOVERY_PROC) {
+        int got = netns_index_load_diag(ns, pid, want_tcpinfo);
+        if (backend == DISCOVERY_NETLINK) return got < 0 ? -1 : 0;
+        if (got == SOCK_PROTO_ALL) return 0;
+        if (got > 0) {
+            netns_index_load_proc(ns, pid, SOCK_PROTO_ALL & ~got);
+            return 0;
+        }
+    }
+    return netns_index_load_proc(ns, pid, SOCK_PROTO_ALL);
+}
+
+int netns_index_load(NetnsIndex *ns, pid_t pid, int backend, int want_tcpinfo) {
+    long long t0 = prof_begin();
+    int rv = netns_index_load_backend(ns, pid, backend, want_tcpinfo);
+    prof_end(PROF_NETNS_LOAD, t0, ns->count);
+    return rv;
+}
+
+int parse_backend(const char *name) {
+    if (strcmp(name, "auto") == 0) return DISCOVERY_AUTO;
+    if (strcmp(name, "netlink") == 0) return DISCOVERY_NETLINK;
+    if (strcmp(name, "proc") == 0) return DISCOVERY_PROC;
+    return -1;
+}
+
+void netns_index_free(NetnsIndex *ns) {
+    free(ns->slots);
+    free(ns->paths);
+    ns->slots = NULL;
+    ns->paths = NULL;
+    ns->cap = ns->count = 0;
+    ns->paths_len = ns->paths_cap = 0;
+    ns->digest = 0;
+}
+
+void sock_index_init(SockIndex *idx, int backend) {
+    idx->head = NULL;
+    idx->backend = backend;
+    idx->want_tcpinfo = 0;
+    idx->track = 0;
+    idx->error = 0;
+    pthread_mutex_init(&idx->lock, NULL);
+    pthread_cond_init(&idx->built, NULL);
+}
+
+void sock_index_free(SockIndex *idx) {
+    NetnsIndex *ns = idx->head;
+    while (ns) {
+        NetnsIndex *next = ns->next;
+        netns_index_free(ns);
+        free(ns);
+        ns = next;
+    }
+    idx->head = NULL;
+    pthread_mutex_destroy(&idx->lock);
+    pthread_cond_destroy(&idx->built);
+}
+
+// Namespace identity of a pid: inode of /proc/<pid>/ns/net
+static int get_netns_inode(pid_t pid, unsigned long long *netns) {
+    char path[PATH_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "/proc/%d/ns/net", pid);
+    if (stat(path, &st) < 0) return -1;
+    *netns = st.st_ino;
+    return 0;
+}
+
+// Return the index of pid's namespace, building it on first use.
+// Safe to call from several search workers: the first caller for a namespace
+// builds it outside the lock while the others wait for it to be ready.
+// Pids whose namespace can't be identified get a private, unshared index.
+NetnsIndex *sock_index_for_pid(SockIndex *idx, pid_t pid) {
+    unsigned long long netns = 0;
+    int known = get_netns_inode(pid, &netns) == 0;
+
+    pthread_mutex_lock(&idx->lock);
+    if (known) {
+        for (NetnsIndex *ns = idx->head; ns; ns = ns->next) {
+            if (ns->netns != netns) continue;
+            while (!ns->ready) pthread_cond_wait(&idx->built, &idx->lock);
+            pthread_mutex_unlock(&idx->lock);
+            return ns;
+        }
+    }
+    NetnsIndex *ns = calloc(1, sizeof(*ns));
+    if (!ns) {
+        pthread_mutex_unlock(&idx->lock);
+        return NULL;
+    }
+    ns->netns = known ? netns : 0;
+    ns->owner = pid;
+    ns->next = idx->head;
+    idx->head = ns;
+    pthread_mutex_unlock(&idx->lock);
+
+    // Signed before loading: a change in between shows on the next refresh
+    if (idx->track && idx->backend == DISCOVERY_PROC) ns->sig = netns_table_signature(pid);
+    netns_index_load(ns, pid, idx->backend, idx->want_tcpinfo); // on failure the index stays empty and lookups miss
+
+    pthread_mutex_lock(&idx->lock);
+    if (sockdiag_netns_stuck()) idx->error = sockdiag_netns_stuck();
+    ns->ready = 1;
+    pthread_cond_broadcast(&idx->built);
+    pthread_mutex_unlock(&idx->lock);
+    return ns;
+}
+
+// Hash the identity columns of one inet table: addresses, state and inode.
+// Queue and timer columns move constantly on a busy host and would make
+// every tick look like a change.
+static unsigned long long table_signature(unsigned long long h, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return h;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char local_addr[64], rem_addr[64], st[8], inode[32];
+        if (sscanf(line, "%*s %63s %63s %7s %*s %*s %*s %*s %*s %31s",
+                   local_addr, rem_addr, st, inode) != 4)
+            continue;
+        h = fnv1a(h, local_addr, strlen(local_addr));
+        h = fnv1a(h, rem_addr, strlen(rem_addr));
+        h = fnv1a(h, st, strlen(st));
+        h = fnv1a(h, inode, strlen(inode) + 1);
+    }
+    fclose(f);
+    return h;
+}
+
+// Same for the unix table: everything but the reference count
+static unsigned long long unix_table_signature(unsigned long long h, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return h;
+    char line[PATH_MAX + 128];
+    while (fgets(line, sizeof(line), f)) {
+        char *p = strchr(line, ' ');            // after Num
+        if (p) p = strchr(p + 1, ' ');          // after RefCount
+        if (p) h = fnv1a(h, p, strlen(p));
+    }
+    fclose(f);
+    return h;
+}
+
+// Signature of the socket tables seen by pid, 0 when they can't be read
+unsigned long long netns_table_signature(pid_t pid) {
+    static const char *tables[] = { "tcp", "tcp6", "udp", "udp6", "raw", "raw6" };
+    char path[PATH_MAX];
+    struct stat st;
+    snprintf(path, sizeof(path), "/proc/%d/net/tcp", pid);
+    if (stat(path, &st) < 0) return 0;
+    unsigned long long h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < sizeof(tables) / sizeof(tables[0]); i++) {
+        snprintf(path, sizeof(path), "/proc/%d/net/%s", pid, tables[i]);
+        h = table_signature(h, path);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/net/unix", pid);
+    h = unix_table_signature(h, path);
+    return h ? h : 1;
+}
+
+// Between two walks of a long-lived (track) index: reload the namespaces
+// whose tables changed and forget those whose owner pid is gone, so the
+// next lookup rebuilds them through a live pid. Through sock_diag a reload
+// is one binary dump, no dearer than reading the tables to find out, so
+// every namespace is reloaded and the digest of its records tells whether
+// it changed; only the procfs backend checks the table text first. Not
+// thread-safe: call it while no walker uses idx. Returns the number of
+// namespaces that changed or went away.
+int sock_index_refresh(SockIndex *idx) {
+    int dirty = 0;
+    NetnsIndex **link = &idx->head;
+    while (*link) {
+        NetnsIndex *ns = *link;
+        unsigned long long sig = 0, netns;
+        if (idx->backend == DISCOVERY_PROC) sig = netns_table_signature(ns->owner);
+        // The owner may have exited (or its pid been reused elsewhere)
+        if ((idx->backend == DISCOVERY_PROC && sig == 0) || ns->netns == 0 ||
+            get_netns_inode(ns->owner, &netns) < 0 || netns != ns->netns) {
+            *link = ns->next;
+            netns_index_free(ns);
+            free(ns);
+            dirty++;
+            continue;
+        }
+        if (idx->backend != DISCOVERY_PROC || sig != ns->sig) {
+            unsigned long long before = ns->digest;
+            ns->sig = sig;
+            netns_index_free(ns);
+            netns_index_load(ns, ns->owner, idx->backend, idx->want_tcpinfo);
+            if (ns->digest != before) dirty++;
+        }
+        link = &ns->next;
+    }
+    return dirty;
+}
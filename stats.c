@@ -0,0 +1,197 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <linux/sockios.h>
+#include <linux/sock_diag.h>
+
+// stats: sample per-socket telemetry from our duplicates at a fixed
+// interval. TCP_INFO (rtt, cwnd, retransmits, pacing rate), the queue
+// depths (SIOCINQ/SIOCOUTQ) and SO_MEMINFO (buffer usage, drops) are all
+// read with a few syscalls per socket, nothing is received or sent.
+// Output is a time series, one line per socket per sample: text, or
+// JSON Lines / CSV when that is the search output format.
+
+typedef struct {
+    SockHandle *h;
+    int is_tcp;                 // TCP_INFO answered
+    struct tcp_info ti;
+    int inq, outq;              // -1 when not applicable
+    int has_mem;
+    unsigned int mem[SK_MEMINFO_VARS];
+    // Summary
+    long samples;
+    unsigned int rtt_min, rtt_max;
+    double rtt_sum;
+    unsigned int retrans_first;
+    int inq_max, outq_max;
+} StatSlot;
+
+static volatile sig_atomic_t stats_interrupted;
+
+static void stats_sigint(int sig) {
+    (void)sig;
+    stats_interrupted = 1;
+}
+
+static void stats_sample(StatSlot *s) {
+    int fd = s->h->sockfd;
+    socklen_t len = sizeof(s->ti);
+    memset(&s->ti, 0, sizeof(s->ti));
+    s->is_tcp = getsockopt(fd, IPPROTO_TCP, TCP_INFO, &s->ti, &len) == 0;
+    s->inq = sock_queue_depth(fd, SIOCINQ);
+    s->outq = sock_queue_depth(fd, SIOCOUTQ);
+    len = sizeof(s->mem);
+    memset(s->mem, 0, sizeof(s->mem));
+    s->has_mem = getsockopt(fd, SOL_SOCKET, SO_MEMINFO, s->mem, &len) == 0;
+
+    if (s->is_tcp && s->ti.tcpi_rtt) {
+        if (!s->rtt_min || s->ti.tcpi_rtt < s->rtt_min) s->rtt_min = s->ti.tcpi_rtt;
+        if (s->ti.tcpi_rtt > s->rtt_max) s->rtt_max = s->ti.tcpi_rtt;
+        s->rtt_sum += s->ti.tcpi_rtt;
+    }
+    if (s->samples == 0) s->retrans_first = s->ti.tcpi_total_retrans;
+    if (s->inq > s->inq_max) s->inq_max = s->inq;
+    if (s->outq > s->outq_max) s->outq_max = s->outq;
+    s->samples++;
+}
+
+static void stats_print(const StatSlot *s, const struct timespec *ts, int format) {
+    const struct tcp_info *ti = &s->ti;
+    const unsigned int *m = s->mem;
+    if (format == OUTPUT_JSONL) {
+        printf("{\"time\":%lld.%03ld,\"pid\":%d,\"fd\":%d,\"inq\":%d,\"outq\":%d",
+               (long long)ts->tv_sec, ts->tv_nsec / 1000000, s->h->pid, s->h->fd, s->inq, s->outq);
+        if (s->is_tcp)
+            printf(",\"state\":\"%s\",\"rtt_us\":%u,\"rttvar_us\":%u,\"cwnd\":%u,\"ssthresh\":%u,"
+                   "\"unacked\":%u,\"retrans\":%u,\"total_retrans\":%u,\"pacing_rate\":%llu,"
+                   "\"delivery_rate\":%llu,\"bytes_acked\":%llu,\"bytes_received\":%llu",
+                   tcp_state_name(ti->tcpi_state), ti->tcpi_rtt, ti->tcpi_rttvar, ti->tcpi_snd_cwnd,
+                   ti->tcpi_snd_ssthresh, ti->tcpi_unacked, ti->tcpi_retransmits, ti->tcpi_total_retrans,
+                   (unsigned long long)ti->tcpi_pacing_rate, (unsigned long long)ti->tcpi_delivery_rate,
+                   (unsigned long long)ti->tcpi_bytes_acked, (unsigned long long)ti->tcpi_bytes_received);
+        if (s->has_mem)
+            printf(",\"rmem\":%u,\"rcvbuf\":%u,\"wmem\":%u,\"sndbuf\":%u,\"drops\":%u",
+                   m[SK_MEMINFO_RMEM_ALLOC], m[SK_MEMINFO_RCVBUF], m[SK_MEMINFO_WMEM_QUEUED],
+                   m[SK_MEMINFO_SNDBUF], m[SK_MEMINFO_DROPS]);
+        printf("}\n");
+    } else if (format == OUTPUT_CSV) {
+        printf("%lld.%03ld,%d,%d,%d,%d,", (long long)ts->tv_sec, ts->tv_nsec / 1000000,
+               s->h->pid, s->h->fd, s->inq, s->outq);
+        if (s->is_tcp)
+            printf("%s,%u,%u,%u,%u,%u,%llu,%llu,", tcp_state_name(ti->tcpi_state), ti->tcpi_rtt,
+                   ti->tcpi_rttvar, ti->tcpi_snd_cwnd, ti->tcpi_unacked, ti->tcpi_total_retrans,
+                   (unsigned long long)ti->tcpi_pacing_rate, (unsigned long long)ti->tcpi_delivery_rate);
+        else
+            printf(",,,,,,,,");
+        if (s->has_mem)
+            printf("%u,%u,%u,%u,%u\n", m[SK_MEMINFO_RMEM_ALLOC], m[SK_MEMINFO_RCVBUF],
+                   m[SK_MEMINFO_WMEM_QUEUED], m[SK_MEMINFO_SNDBUF], m[SK_MEMINFO_DROPS]);
+        else
+            printf(",,,,\n");
+    } else {
+        char when[16];
+        strftime(when, sizeof(when), "%H:%M:%S", localtime(&ts->tv_sec));
+        printf("[%s.%03ld] PID=%d FD=%d", when, ts->tv_nsec / 1000000, s->h->pid, s->h->fd);
+        if (s->is_tcp) {
+            printf(" %s rtt=%.2f/%.2fms cwnd=%u retrans=%u", tcp_state_name(ti->tcpi_state),
+                   ti->tcpi_rtt / 1000.0, ti->tcpi_rttvar / 1000.0, ti->tcpi_snd_cwnd, ti->tcpi_total_retrans);
+            if (ti->tcpi_total_retrans > s->retrans_first)
+                printf("(+%u)", ti->tcpi_total_retrans - s->retrans_first);
+            if (ti->tcpi_pacing_rate != ~0ULL)
+                printf(" pacing=%.1fMB/s", ti->tcpi_pacing_rate / 1e6);
+        }
+        if (s->inq >= 0) printf(" inq=%d outq=%d", s->inq, s->outq);
+        if (s->has_mem)
+            printf(" rmem=%u/%u wmem=%u/%u drops=%u", m[SK_MEMINFO_RMEM_ALLOC], m[SK_MEMINFO_RCVBUF],
+                   m[SK_MEMINFO_WMEM_QUEUED], m[SK_MEMINFO_SNDBUF], m[SK_MEMINFO_DROPS]);
+        printf("\n");
+    }
+}
+
+// Sample the given sockets every interval_ms, count times (0 = until Ctrl-C)
+static int stats_run(StatSlot *slots, size_t n, int interval_ms, long count) {
+    int format = output_format == OUTPUT_JSONL || output_format == OUTPUT_CSV ? output_format : OUTPUT_TEXT;
+    if (format == OUTPUT_CSV)
+        printf("time,pid,fd,inq,outq,state,rtt_us,rttvar_us,cwnd,unacked,total_retrans,pacing_rate,"
+               "delivery_rate,rmem,rcvbuf,wmem,sndbuf,drops\n");
+    else if (format == OUTPUT_TEXT)
+        printf("Sampling %zu socket(s) every %d ms, Ctrl-C to stop\n", n, interval_ms);
+    fflush(stdout);
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stats_sigint;
+    sigaction(SIGINT, &sa, &old);
+    stats_interrupted = 0;
+
+    // Absolute deadlines: the series keeps its period however long a
+    // sample takes
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (long k = 0; !stats_interrupted && (count <= 0 || k < count); k++) {
+        if (k > 0) {
+            next.tv_sec += interval_ms / 1000;
+            next.tv_nsec += (interval_ms % 1000) * 1000000L;
+            if (next.tv_nsec >= 1000000000L) {
+                next.tv_sec++;
+                next.tv_nsec -= 1000000000L;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR && !stats_interrupted) ;
+            if (stats_interrupted) break;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        for (size_t i = 0; i < n; i++) {
+            if (!slots[i].h) continue;
+            stats_sample(&slots[i]);
+            stats_print(&slots[i], &ts, format);
+        }
+        fflush(stdout);
+    }
+    sigaction(SIGINT, &old, NULL);
+
+    // The summary goes to stderr so the series stays machine readable
+    for (size_t i = 0; i < n; i++) {
+        const StatSlot *s = &slots[i];
+        if (!s->h || !s->samples) continue;
+        fprintf(stderr, "PID %d FD %d: %ld sample(s)", s->h->pid, s->h->fd, s->samples);
+        if (s->rtt_max)
+            fprintf(stderr, ", rtt min/avg/max %.2f/%.2f/%.2f ms, %u retransmit(s)",
+                    s->rtt_min / 1000.0, s->rtt_sum / s->samples / 1000.0, s->rtt_max / 1000.0,
+                    s->ti.tcpi_total_retrans - s->retrans_first);
+        if (s->inq >= 0) fprintf(stderr, ", inq max %d, outq max %d", s->inq_max, s->outq_max);
+        fprintf(stderr, "\n");
+    }
+    return 0;
+}
+
+int dup_socket_and_stats(int pid, int fd, unsigned long long inode, int interval_ms, long count) {
+    StatSlot slot;
+    memset(&slot, 0, sizeof(slot));
+    slot.h = handle_get(pid, fd, inode);
+    if (!slot.h) return -1;
+    return stats_run(&slot, 1, interval_ms, count);
+}
+
+int stats_sockets(const ResultStore *rs, const size_t *idx, size_t n, int interval_ms, long count) {
+    StatSlot *slots = calloc(n, sizeof(StatSlot));
+    if (!slots) {
+        perror("calloc");
+        return -1;
+    }
+    size_t ok = 0;
+    for (size_t i = 0; i < n; i++) {
+        const SocketEntry *e = &rs->items[idx[i]];
+        if ((slots[i].h = handle_get(e->pid, e->fd, e->inode))) ok++;
+    }
+    int rv = ok ? stats_run(slots, n, interval_ms, count) : -1;
+    free(slots);
+    return rv;
+}
@@ -0,0 +1,154 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// tap: drain many duplicated sockets from one epoll loop.
+// Every chunk is written as a tagged record: a header line
+//   [<realtime sec.nsec> pid=<pid> fd=<fd> len=<n>]
+// followed by the n payload bytes and a newline, either interleaved on
+// stdout or into one <pid>-<fd>.tap file per socket.
+
+#define TAP_BUF (64 * 1024)
+
+typedef struct {
+    SockHandle *h;
+    int outfd;          // stdout or the socket's own file
+    int open;
+    long long bytes;
+    long long chunks;
+} TapSlot;
+
+static volatile sig_atomic_t tap_interrupted;
+
+static void tap_sigint(int sig) {
+    (void)sig;
+    tap_interrupted = 1;
+}
+
+static int tap_write_record(TapSlot *t, const char *buf, size_t n) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    char hdr[128];
+    int hl = snprintf(hdr, sizeof(hdr), "[%lld.%09ld pid=%d fd=%d len=%zu]\n",
+                      (long long)ts.tv_sec, ts.tv_nsec, t->h->pid, t->h->fd, n);
+    if (write_all(t->outfd, hdr, hl) < 0) return -1;
+    if (write_all(t->outfd, buf, n) < 0) return -1;
+    return write_all(t->outfd, "\n", 1) < 0 ? -1 : 0;
+}
+
+static void tap_close_slot(TapSlot *t, int epfd, const char *why) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, t->h->sockfd, NULL);
+    t->open = 0;
+    fprintf(stderr, "PID %d FD %d: %s\n", t->h->pid, t->h->fd, why);
+}
+
+int tap_sockets(const ResultStore *rs, const size_t *idx, size_t n, const char *outdir) {
+    TapSlot *slots = calloc(n, sizeof(TapSlot));
+    char *buf = malloc(TAP_BUF);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!slots || !buf || epfd < 0) {
+        perror("tap setup");
+        free(slots);
+        free(buf);
+        if (epfd >= 0) close(epfd);
+        return -1;
+    }
+    fflush(stdout); // records go straight to fd 1
+
+    size_t nopen = 0;
+    for (size_t i = 0; i < n; i++) {
+        const SocketEntry *e = &rs->items[idx[i]];
+        TapSlot *t = &slots[i];
+        t->outfd = -1;
+        t->h = handle_get(e->pid, e->fd, e->inode);
+        if (!t->h) continue;
+        if (outdir) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%d-%d.tap", outdir, e->pid, e->fd);
+            t->outfd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+            if (t->outfd < 0) {
+                perror(path);
+                continue;
+            }
+        } else {
+            t->outfd = STDOUT_FILENO;
+        }
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.u64 = i };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, t->h->sockfd, &ev) < 0) {
+            perror("epoll_ctl");
+            continue;
+        }
+        t->open = 1;
+        nopen++;
+    }
+    printf("Tapping %zu socket(s), Ctrl-C to stop\n", nopen);
+    fflush(stdout);
+
+    struct sigaction sa, old;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = tap_sigint;
+    sigaction(SIGINT, &sa, &old);
+    tap_interrupted = 0;
+
+    struct epoll_event events[64];
+    while (nopen > 0 && !tap_interrupted) {
+        int nev = epoll_wait(epfd, events, 64, recv_timeout_ms);
+        if (nev == 0) {
+            char t[32];
+            format_timeout(recv_timeout_ms, t, sizeof(t));
+            fprintf(stderr, "Timeout expired (%s)\n", t);
+            break;
+        }
+        if (nev < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < nev; i++) {
+            TapSlot *t = &slots[events[i].data.u64];
+            if (!t->open) continue;
+            long long t0 = prof_begin();
+            ssize_t r = recv(t->h->sockfd, buf, TAP_BUF, MSG_DONTWAIT);
+            prof_end(PROF_RECV, t0, r);
+            if (r < 0) {
+                if (errno == EAGAIN || errno == EINTR) continue;
+                tap_close_slot(t, epfd, strerror(errno));
+                nopen--;
+            } else if (r == 0 && handle_eof_on_empty(t->h)) {
+                tap_close_slot(t, epfd, "connection closed by peer");
+                nopen--;
+            } else {
+                t->bytes += r;
+                t->chunks++;
+                if (tap_write_record(t, buf, r) < 0) {
+                    perror("tap write");
+                    tap_close_slot(t, epfd, "output error");
+                    nopen--;
+                }
+            }
+        }
+    }
+    sigaction(SIGINT, &old, NULL);
+
+    long long total = 0;
+    for (size_t i = 0; i < n; i++) {
+        TapSlot *t = &slots[i];
+        if (t->outfd > STDERR_FILENO) close(t->outfd);
+        if (!t->h) continue;
+        total += t->bytes;
+        fprintf(stderr, "PID %d FD %d: %lld bytes in %lld chunk(s)\n", t->h->pid, t->h->fd, t->bytes, t->chunks);
+    }
+    fprintf(stderr, "Tapped %lld bytes\n", total);
+    close(epfd);
+    free(buf);
+    free(slots);
+    return 0;
+}
@@ -0,0 +1,495 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+// io_uring I/O engine, on raw syscalls (no liburing dependency).
+// rec arms one multishot recv that picks its buffers from a registered
+// buffer ring, so a stream costs one submission for its whole lifetime.
+// sendf submits batches of linked read -> send pairs, one io_uring_enter
+// per batch. Callers get XFER_UNSUPPORTED whenever the kernel lacks a
+// feature and then use the sync engine instead.
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter 426
+#endif
+#ifndef __NR_io_uring_register
+#define __NR_io_uring_register 427
+#endif
+
+#define URING_ENTRIES 64
+#define URING_BUFS 64                   // buffer ring entries, power of 2
+#define URING_BUF_SIZE (64 * 1024)
+#define URING_BGID 1
+#define URING_SEND_SLOTS 16             // read -> send pairs per batch
+#define URING_SEND_CHUNK (256 * 1024)
+
+typedef struct {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_sz;
+    void *cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+    unsigned sqe_tail;          // local tail, published by uring_enter
+} Uring;
+
+static Uring ring = { .fd = -1 };
+static int ring_broken;         // setup failed once, don't retry every command
+
+static int uring_setup(Uring *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        // Needed for timed waits (5.11+)
+        close(fd);
+        errno = ENOTSUP;
+        return -1;
+    }
+    r->fd = fd;
+    r->sq_ring = r->cq_ring = r->sqes = MAP_FAILED;
+    r->sq_entries = p.sq_entries;
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_ring_sz > r->sq_ring_sz) r->sq_ring_sz = r->cq_ring_sz;
+        r->cq_ring_sz = r->sq_ring_sz;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED) goto fail;
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) goto fail;
+
+    char *sq = r->sq_ring, *cq = r->cq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    for (unsigned i = 0; i < p.sq_entries; i++) r->sq_array[i] = i;
+    r->sqe_tail = *r->sq_tail;
+    return 0;
+fail:
+    if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_sz);
+    if (r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_sz);
+    close(fd);
+    r->fd = -1;
+    return -1;
+}
+
+// The process-wide ring, created on first use
+static Uring *uring_get(void) {
+    if (ring.fd >= 0) return &ring;
+    if (ring_broken) return NULL;
+    if (uring_setup(&ring) < 0) {
+        ring_broken = 1;
+        fprintf(stderr, "io_uring unavailable (%s), using sync engine\n", strerror(errno));
+        return NULL;
+    }
+    return &ring;
+}
+
+static struct io_uring_sqe *uring_sqe(Uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) return NULL;
+    struct io_uring_sqe *sqe = &r->sqes[r->sqe_tail & *r->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqe_tail++;
+    return sqe;
+}
+
+// Submit queued SQEs and wait for at least wait_nr completions, or until
+// timeout_ms (-1 = forever). Returns 0, -ETIME on timeout or -errno.
+static int uring_enter(Uring *r, unsigned wait_nr, int timeout_ms) {
+    unsigned to_submit = r->sqe_tail - *r->sq_tail;
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void *argp = NULL;
+    size_t argsz = 0;
+    if (wait_nr && timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (unsigned long long)(uintptr_t)&ts;
+        argp = &arg;
+        argsz = sizeof(arg);
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    while (1) {
+        long long t0 = prof_begin();
+        int ret = syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr, flags, argp, argsz);
+        prof_end(PROF_URING_ENTER, t0, ret);
+        if (ret >= 0) return 0;
+        if (errno == EINTR) {
+            to_submit = 0;
+            continue;
+        }
+        return -errno;
+    }
+}
+
+static struct io_uring_cqe *uring_peek(Uring *r) {
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+static void uring_cqe_seen(Uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Provided buffer ring shared by the multishot recv
+typedef struct {
+    struct io_uring_buf_ring *br;
+    char *bufs;
+    unsigned short tail;
+} UringBufRing;
+
+static void buf_ring_add(UringBufRing *b, unsigned bid) {
+    struct io_uring_buf *buf = &b->br->bufs[b->tail & (URING_BUFS - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)(b->bufs + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    b->tail++;
+}
+
+static void buf_ring_publish(UringBufRing *b) {
+    __atomic_store_n(&b->br->tail, b->tail, __ATOMIC_RELEASE);
+}
+
+static int buf_ring_setup(Uring *r, UringBufRing *b) {
+    memset(b, 0, sizeof(*b));
+    size_t ringsz = URING_BUFS * sizeof(struct io_uring_buf);
+    b->br = mmap(NULL, ringsz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b->br == MAP_FAILED) return -1;
+    b->bufs = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)b->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (!b->bufs || syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        free(b->bufs);
+        munmap(b->br, ringsz);
+        return -1;
+    }
+    for (unsigned i = 0; i < URING_BUFS; i++) buf_ring_add(b, i);
+    buf_ring_publish(b);
+    return 0;
+}
+
+static void buf_ring_free(Uring *r, UringBufRing *b) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = URING_BGID;
+    syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(b->bufs);
+    munmap(b->br, URING_BUFS * sizeof(struct io_uring_buf));
+}
+
+enum { UD_RECV = 1, UD_CANCEL };
+
+static void arm_recv_multishot(Uring *r, int sockfd) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = sockfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = UD_RECV;
+}
+
+// Hand a recv completion's buffer to the sink and give it back to the ring
+static int recv_cqe_consume(UringBufRing *b, const struct io_uring_cqe *cqe, RecvSink *sink) {
+    unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    int ret = recv_sink_push(sink, b->bufs + (size_t)bid * URING_BUF_SIZE, cqe->res);
+    buf_ring_add(b, bid);
+    return ret;
+}
+
+// Cancel an armed multishot recv and reap until both the cancel and the
+// recv's final completion are seen, so no CQE leaks into the next command.
+// Data that raced with the cancel still goes to the sink.
+static void cancel_recv_multishot(Uring *r, UringBufRing *b, int sockfd, RecvSink *sink) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = sockfd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = UD_CANCEL;
+    int cancel_done = 0, recv_done = 0;
+    if (uring_enter(r, 0, 0) < 0) return;
+    while (!cancel_done || !recv_done) {
+        struct io_uring_cqe *cqe = uring_peek(r);
+        if (!cqe) {
+            if (uring_enter(r, 1, -1) < 0) return;
+            continue;
+        }
+        if (cqe->user_data == UD_CANCEL) {
+            cancel_done = 1;
+        } else {
+            if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) recv_cqe_consume(b, cqe, sink);
+            if (!(cqe->flags & IORING_CQE_F_MORE)) recv_done = 1;
+        }
+        uring_cqe_seen(r);
+    }
+}
+
+// Receive into sink until idle timeout, EOF or error.
+// Returns RECV_TIMEOUT, RECV_CLOSED, RECV_ERROR or XFER_UNSUPPORTED.
+int uring_recv_to_sink(int sockfd, RecvSink *sink, long long *last) {
+    Uring *r = uring_get();
+    if (!r) return XFER_UNSUPPORTED;
+    UringBufRing b;
+    // Buffer rings need 5.19+
+    if (buf_ring_setup(r, &b) < 0) {
+        fprintf(stderr, "io_uring buffer rings unsupported (%s), using sync engine\n", strerror(errno));
+        return XFER_UNSUPPORTED;
+    }
+    arm_recv_multishot(r, sockfd);
+    int armed = 1, outcome = RECV_ERROR, first = 1, done = 0;
+    while (!done) {
+        int ret = uring_enter(r, 1, recv_timeout_ms);
+        if (ret == -ETIME) {
+            outcome = RECV_TIMEOUT;
+            break;
+        }
+        if (ret < 0) {
+            errno = -ret;
+            perror("io_uring_enter");
+            break;
+        }
+        struct io_uring_cqe *cqe;
+        int recycled = 0, would_block = 0;
+        while ((cqe = uring_peek(r)) != NULL) {
+            int res = cqe->res;
+            if (!(cqe->flags & IORING_CQE_F_MORE)) armed = 0;
+            if (res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+                if (recv_cqe_consume(&b, cqe, sink) < 0) {
+                    perror("write output");
+                    done = 1;
+                }
+                *last = now_ns();
+                recycled = 1;
+            } else if (res == 0) {
+                outcome = RECV_CLOSED;
+                done = 1;
+            } else if (res == -EINVAL && first) {
+                // Multishot recv needs 6.0+: let the caller fall back
+                outcome = XFER_UNSUPPORTED;
+                done = 1;
+            } else if (res == -EAGAIN) {
+                // O_NONBLOCK set by the owner: the kernel won't park the
+                // request, so wait for data ourselves before re-arming
+                would_block = 1;
+            } else if (res < 0 && res != -ENOBUFS) {
+                errno = -res;
+                perror("recv");
+                done = 1;
+            }
+            first = 0;
+            uring_cqe_seen(r);
+        }
+        if (recycled) buf_ring_publish(&b);
+        if (done || armed) continue;
+        if (would_block && wait_fd(sockfd, POLLIN, recv_timeout_ms) < 0) {
+            outcome = errno == ETIMEDOUT ? RECV_TIMEOUT : RECV_ERROR;
+            break;
+        }
+        // Out of buffers or otherwise terminated: re-arm
+        arm_recv_multishot(r, sockfd);
+        armed = 1;
+    }
+    if (armed) {
+        cancel_recv_multishot(r, &b, sockfd, sink);
+        buf_ring_publish(&b);
+    }
+    buf_ring_free(r, &b);
+    if (outcome == XFER_UNSUPPORTED)
+        fprintf(stderr, "io_uring multishot recv unsupported, using sync engine\n");
+    return outcome;
+}
+
+// Finish a file transfer synchronously from offset (after a short send)
+static ssize_t send_rest(int sockfd, int f, off_t offset, off_t size) {
+    char *buf = malloc(URING_SEND_CHUNK);
+    if (!buf) return -1;
+    off_t done = 0;
+    while (offset + done < size) {
+        ssize_t n = pread(f, buf, URING_SEND_CHUNK, offset + done);
+        if (n <= 0) break;
+        if (write_all(sockfd, buf, n) < 0) {
+            free(buf);
+            return -1;
+        }
+        done += n;
+    }
+    free(buf);
+    return done;
+}
+
+// Send a regular file with batches of linked read -> send chains.
+// The whole batch is one chain so chunks reach the socket in order; the
+// ring is idle between batches so a batch always fits in the SQ.
+ssize_t uring_file_to_socket(int sockfd, int f) {
+    struct stat st;
+    if (fstat(f, &st) < 0) return -1;
+    if (!S_ISREG(st.st_mode)) return XFER_UNSUPPORTED; // lengths must be known up front
+    Uring *r = uring_get();
+    if (!r) return XFER_UNSUPPORTED;
+    char *bufs = malloc((size_t)URING_SEND_SLOTS * URING_SEND_CHUNK);
+    if (!bufs) return -1;
+
+    off_t size = st.st_size, offset = 0;
+    ssize_t ret = 0;
+    while (offset < size) {
+        size_t lens[URING_SEND_SLOTS];
+        unsigned nslots = 0;
+        off_t batch_off = offset;
+        while (nslots < URING_SEND_SLOTS && batch_off < size) {
+            size_t len = size - batch_off < URING_SEND_CHUNK ? size - batch_off : URING_SEND_CHUNK;
+            char *buf = bufs + (size_t)nslots * URING_SEND_CHUNK;
+            struct io_uring_sqe *rd = uring_sqe(r);
+            rd->opcode = IORING_OP_READ;
+            rd->fd = f;
+            rd->addr = (unsigned long long)(uintptr_t)buf;
+            rd->len = len;
+            rd->off = batch_off;
+            rd->flags = IOSQE_IO_LINK;
+            rd->user_data = nslots * 2;
+            struct io_uring_sqe *sd = uring_sqe(r);
+            sd->opcode = IORING_OP_SEND;
+            sd->fd = sockfd;
+            sd->addr = (unsigned long long)(uintptr_t)buf;
+            sd->len = len;
+            sd->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            sd->user_data = nslots * 2 + 1;
+            lens[nslots++] = len;
+            batch_off += len;
+            if (batch_off < size && nslots < URING_SEND_SLOTS) sd->flags = IOSQE_IO_LINK;
+        }
+        int err = uring_enter(r, nslots * 2, -1);
+        if (err < 0) {
+            errno = -err;
+            ret = -1;
+            break;
+        }
+        // Every SQE of the chain completes (the ones after a failure with
+        // -ECANCELED), though not necessarily in a single wakeup
+        unsigned seen = 0;
+        off_t sent_ok = 0;
+        int broken = 0, fatal = 0;
+        while (seen < nslots * 2) {
+            struct io_uring_cqe *cqe = uring_peek(r);
+            if (!cqe) {
+                if (uring_enter(r, 1, -1) < 0) break;
+                continue;
+            }
+            size_t len = lens[cqe->user_data / 2];
+            int res = cqe->res;
+            if (!(cqe->user_data & 1)) {
+                if (res != (int)len) broken = 1;
+            } else if (!broken) {
+                if (res > 0) sent_ok += res;
+                if (res != (int)len) broken = 1;
+                if (res < 0 && res != -ECANCELED && res != -EAGAIN) {
+                    errno = -res;
+                    fatal = 1;
+                }
+            }
+            uring_cqe_seen(r);
+            seen++;
+        }
+        offset += sent_ok;
+        if (fatal) {
+            ret = -1;
+            break;
+        }
+        if (broken) {
+            // Short send (non-blocking owner, signal) or short read:
+            // finish the file with the sync path from where the chain stopped
+            ssize_t rest = send_rest(sockfd, f, offset, size);
+            if (rest < 0) ret = -1;
+            else offset += rest;
+            break;
+        }
+    }
+    free(bufs);
+    return ret < 0 ? -1 : offset;
+}
+
+// Single send through the ring
+ssize_t uring_send(int sockfd, const void *data, size_t len) {
+    Uring *r = uring_get();
+    if (!r) return XFER_UNSUPPORTED;
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    if (!sqe) return XFER_UNSUPPORTED;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = sockfd;
+    sqe->addr = (unsigned long long)(uintptr_t)data;
+    sqe->len = len;
+    sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+    int err = uring_enter(r, 1, -1);
+    if (err < 0) {
+        errno = -err;
+        return -1;
+    }
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek(r)) == NULL) {
+        if ((err = uring_enter(r, 1, -1)) < 0) {
+            errno = -err;
+            return -1;
+        }
+    }
+    int res = cqe->res;
+    uring_cqe_seen(r);
+    if (res < 0) {
+        if (res != -EAGAIN) {
+            errno = -res;
+            return -1;
+        }
+        res = 0;
+    }
+    if ((size_t)res < len) {
+        // Short send on a non-blocking socket: finish synchronously
+        if (write_all(sockfd, (const char *)data + res, len - res) < 0) return -1;
+    }
+    return len;
+}
+
+int parse_engine(const char *name) {
+    if (strcmp(name, "sync") == 0) return ENGINE_SYNC;
+    if (strcmp(name, "uring") == 0) return ENGINE_URING;
+    return -1;
+}
@@ -0,0 +1,471 @@
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <linux/limits.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+// watch: repeated search that reports only what changed.
+// The previous snapshot is kept sorted by (pid, fd). On each tick a pid
+// whose fd directory lists the same descriptors as last time (same count
+// and signature) reuses its previous socket fds, re-stat()ing only those
+// instead of every fd it has; filtered out pids only have their name
+// re-read. Namespace indexes live across ticks: sock_diag reloads them
+// with one dump each, procfs only when the text of their tables changed.
+
+typedef struct {
+    pid_t pid;
+    int matched;                // pattern matched its name
+    size_t nfds;
+    unsigned long long fdsig;   // hash of the fd numbers in the fd directory
+    NetnsIndex *ns;             // namespace index, when it has sockets
+    char name[64];
+} PidState;
+
+typedef struct {
+    PidState *items;
+    size_t count, cap;
+} PidTable;
+
+// A snapshot and, per socket, whether it passes the filter. Sockets
+// that don't are still tracked: a state change can make them pass later
+// without their pid's fd set changing.
+typedef struct {
+    ResultStore rs;
+    unsigned char *pass;
+    size_t pass_cap;
+} Snapshot;
+
+static volatile sig_atomic_t watch_interrupted;
+
+static void watch_sigint(int sig) {
+    (void)sig;
+    watch_interrupted = 1;
+}
+
+static void print_change(char tag, const ResultStore *rs, const SocketEntry *e, int old_state) {
+    char addr[INET6_ADDRSTRLEN], rem[PATH_MAX];
+    printf("%c PID=%d (%s) FD=%d ", tag, e->pid, entry_proc_name(rs, e), e->fd);
+    if (e->proto == SOCK_PROTO_UNIX) {
+        printf("unix");
+    } else {
+        // TCP keeps the historical untagged shape
+        if (e->proto != SOCK_PROTO_TCP && e->proto != SOCK_PROTO_NONE) printf("%s ", sock_proto_name(e->proto));
+        format_addr(&e->local, addr, sizeof(addr));
+        printf("%s:%d", addr, e->local.port);
+    }
+    format_remote(rs, e, rem, sizeof(rem));
+    printf(" -> %s %s", rem, tcp_state_name(e->state));
+    if (tag == '~') printf(" (was %s)", tcp_state_name(old_state));
+    printf("\n");
+}
+
+static PidState *pid_table_find(const PidTable *t, pid_t pid) {
+    size_t lo = 0, hi = t->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (t->items[mid].pid < pid) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < t->count && t->items[lo].pid == pid ? &t->items[lo] : NULL;
+}
+
+static PidState *pid_table_push(PidTable *t) {
+    if (t->count == t->cap) {
+        size_t newcap = t->cap ? t->cap * 2 : 256;
+        PidState *items = realloc(t->items, newcap * sizeof(PidState));
+        if (!items) return NULL;
+        t->items = items;
+        t->cap = newcap;
+    }
+    return &t->items[t->count++];
+}
+
+// First entry of pid in a (pid, fd) sorted snapshot
+static size_t snapshot_lower(const ResultStore *rs, pid_t pid) {
+    size_t lo = 0, hi = rs->count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (rs->items[mid].pid < pid) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Count and hash the descriptor numbers of pid, -1 if it is gone
+static int fd_signature(pid_t pid, size_t *nfds, unsigned long long *sig) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+    DIR *d = opendir(path);
+    if (!d) return -1;
+    unsigned long long h = 0xCBF29CE484222325ULL;
+    size_t n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        for (const char *c = de->d_name; *c; c++) {
+            h ^= (unsigned char)*c;
+            h *= 0x100000001B3ULL;
+        }
+        h ^= ' ';
+        h *= 0x100000001B3ULL;
+        n++;
+    }
+    closedir(d);
+    *nfds = n;
+    *sig = h;
+    return 0;
+}
+
+static int cmp_pid(const void *a, const void *b) {
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int cmp_fd(const void *a, const void *b) {
+    const SocketEntry *x = a, *y = b;
+    return (x->fd > y->fd) - (x->fd < y->fd);
+}
+
+// Stat every fd of pid and append its sockets to out
+static void scan_pid_fds(pid_t pid, long name, ResultStore *out) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+    DIR *d = opendir(path);
+    if (!d) return;
+    size_t first = out->count;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;
+        int fd = atoi(de->d_name);
+        unsigned long long inode;
+        if (get_socket_inode_from_fd(pid, fd, &inode) < 0) continue;
+        SocketEntry *e = result_store_push(out);
+        if (!e) break;
+        memset(e, 0, sizeof(*e));
+        e->pid = pid;
+        e->fd = fd;
+        e->name = (unsigned int)name;
+        e->inode = inode;
+    }
+    closedir(d);
+    qsort(out->items + first, out->count - first, sizeof(SocketEntry), cmp_fd);
+}
+
+// Reuse pid's sockets of the previous snapshot, -1 if one of them now
+// refers to another inode (the fd set looked the same but was recycled)
+static int reuse_pid_fds(pid_t pid, long name, const ResultStore *prev, ResultStore *out) {
+    size_t first = out->count;
+    for (size_t i = snapshot_lower(prev, pid); i < prev->count && prev->items[i].pid == pid; i++) {
+        unsigned long long inode;
+        if (get_socket_inode_from_fd(pid, prev->items[i].fd, &inode) < 0 || inode != prev->items[i].inode) {
+            out->count = first;
+            return -1;
+        }
+        SocketEntry *e = result_store_push(out);
+        if (!e) return -1;
+        *e = prev->items[i];
+        e->name = (unsigned int)name;
+    }
+    return 0;
+}
+
+// Build the next snapshot from the previous one. pids comes sorted.
+static void watch_scan(const char *pattern, const Filter *filter, SockIndex *idx, const PidTable *oldpids,
+                       PidTable *newpids, const ResultStore *prev, Snapshot *snap, WatchTick *tick) {
+    ResultStore *out = &snap->rs;
+    DIR *proc = opendir("/proc");
+    if (!proc) {
+        perror("opendir /proc");
+        return;
+    }
+    pid_t *pids = NULL;
+    size_t npids = 0, pidcap = 0;
+    struct dirent *dent;
+    while ((dent = readdir(proc)) != NULL) {
+        if (!isdigit(dent->d_name[0])) continue;
+        if (npids == pidcap) {
+            pidcap = pidcap ? pidcap * 2 : 1024;
+            pid_t *p = realloc(pids, pidcap * sizeof(pid_t));
+            if (!p) break;
+            pids = p;
+        }
+        pids[npids++] = atoi(dent->d_name);
+    }
+    closedir(proc);
+    qsort(pids, npids, sizeof(pid_t), cmp_pid);
+
+    for (size_t i = 0; i < npids; i++) {
+        pid_t pid = pids[i];
+        PidState st = { .pid = pid };
+        const PidState *old = pid_table_find(oldpids, pid);
+        tick->pids++;
+        // Filtered out pids only get their name re-read (it changes on exec)
+        if (old && !old->matched) {
+            if (load_proc_name(pid, st.name, sizeof(st.name)) < 0) continue;
+            FilterCtx fc = { .known = FILTER_KNOW_PID, .pid = pid, .comm = st.name };
+            if (!search_match(pattern, pid, st.name) || filter_eval(filter, &fc) == FILTER_NO) {
+                PidState *slot = pid_table_push(newpids);
+                if (!slot) break;
+                *slot = st;
+                continue;
+            }
+            old = NULL;     // starts matching: treat as new
+        }
+        if (fd_signature(pid, &st.nfds, &st.fdsig) < 0) continue;
+        int same = old && old->nfds == st.nfds && old->fdsig == st.fdsig;
+        if (same) {
+            memcpy(st.name, old->name, sizeof(st.name));
+            st.matched = old->matched;
+        } else {
+            if (!st.name[0]) load_proc_name(pid, st.name, sizeof(st.name));
+            FilterCtx fc = { .known = FILTER_KNOW_PID, .pid = pid, .comm = st.name };
+            st.matched = search_match(pattern, pid, st.name) && filter_eval(filter, &fc) != FILTER_NO;
+        }
+        PidState *slot = pid_table_push(newpids);
+        if (!slot) break;
+        *slot = st;
+        if (!st.matched) continue;
+
+        long name = -1;
+        size_t first = out->count;
+        if (same && (name = result_store_intern(out, st.name)) >= 0 && reuse_pid_fds(pid, name, prev, out) == 0) {
+            // unchanged fd set, sockets re-checked one by one
+        } else {
+            if (name < 0 && (name = result_store_intern(out, st.name)) < 0) break;
+            scan_pid_fds(pid, name, out);
+            tick->rescanned++;
+        }
+        if (out->count == first) continue;
+        if (out->count > snap->pass_cap) {
+            size_t newcap = snap->pass_cap ? snap->pass_cap : 256;
+            while (newcap < out->count) newcap *= 2;
+            unsigned char *p = realloc(snap->pass, newcap);
+            if (!p) {
+                out->count = first;
+                break;
+            }
+            snap->pass = p;
+            snap->pass_cap = newcap;
+        }
+        NetnsIndex *ns = sock_index_for_pid(idx, pid);
+        slot->ns = ns;
+        FilterCtx fc = { .known = FILTER_KNOW_PID | FILTER_KNOW_FD | FILTER_KNOW_SOCK, .pid = pid, .comm = st.name };
+        for (size_t j = first; j < out->count; j++) {
+            SocketEntry *e = &out->items[j];
+            const SockInfo *si = netns_index_lookup(ns, e->inode);
+            snap->pass[j] = 0;
+            if (result_store_fill(out, e, ns, si) < 0) continue;
+            fc.fd = e->fd;
+            fc.inode = e->inode;
+            fc.si = si;
+            fc.path = entry_path(out, e);
+            snap->pass[j] = filter_eval(filter, &fc) == FILTER_YES;
+        }
+    }
+    free(pids);
+}
+
+static size_t snapshot_visible(const Snapshot *s) {
+    size_t n = 0;
+    for (size_t i = 0; i < s->rs.count; i++) n += s->pass[i];
+    return n;
+}
+
+static void snapshot_free(Snapshot *s) {
+    result_store_free(&s->rs);
+    free(s->pass);
+    memset(s, 0, sizeof(*s));
+}
+
+// Merge-walk two (pid, fd) sorted snapshots and print the differences
+static void watch_diff(const Snapshot *sa, const Snapshot *sb, WatchTick *tick) {
+    const ResultStore *a = &sa->rs, *b = &sb->rs;
+    size_t i = 0, j = 0;
+    while (i < a->count || j < b->count) {
+        // Filtered out sockets count as absent
+        if (i < a->count && !sa->pass[i]) {
+            i++;
+            continue;
+        }
+        if (j < b->count && !sb->pass[j]) {
+            j++;
+            continue;
+        }
+        const SocketEntry *x = i < a->count ? &a->items[i] : NULL;
+        const SocketEntry *y = j < b->count ? &b->items[j] : NULL;
+        int c;
+        if (!x) c = 1;
+        else if (!y) c = -1;
+        else if (x->pid != y->pid) c = x->pid < y->pid ? -1 : 1;
+        else c = (x->fd > y->fd) - (x->fd < y->fd);
+        if (c < 0) {
+            print_change('-', a, x, 0);
+            tick->closed++;
+            i++;
+        } else if (c > 0) {
+            print_change('+', b, y, 0);
+            tick->opened++;
+            j++;
+        } else {
+            if (x->inode != y->inode) {
+                print_change('-', a, x, 0);
+                print_change('+', b, y, 0);
+                tick->closed++;
+                tick->opened++;
+            } else if (x->state != y->state || x->peer != y->peer ||
+                       memcmp(&x->remote, &y->remote, sizeof(JsAddr)) != 0) {
+                print_change('~', b, y, x->state);
+                tick->changed++;
+            }
+            i++;
+            j++;
+        }
+    }
+}
+
+void cmd_watch(const char *pattern, int interval_ms, long count) {
+    SockIndex idx;
+    sock_index_init(&idx, discovery_backend);
+    idx.track = 1;
+    idx.want_tcpinfo = filter_wants_tcpinfo(search_filter);
+    PidTable pids = { 0 }, nextpids = { 0 };
+    Snapshot snap = { 0 }, next = { 0 };
+
+    struct sigaction sa, oldsa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = watch_sigint;
+    sigaction(SIGINT, &sa, &oldsa);
+    watch_interrupted = 0;
+
+    WatchTick tick = { 0 };
+    long long t0 = now_ns();
+    watch_scan(pattern, search_filter, &idx, &pids, &nextpids, &snap.rs, &next, &tick);
+    exit_if_netns_stuck();
+    printf("Watching %zu socket(s) in %zu pid(s), scan %.1f ms, Ctrl-C to stop\n",
+           snapshot_visible(&next), tick.pids, (now_ns() - t0) / 1e6);
+    for (size_t i = 0; i < next.rs.count; i++)
+        if (next.pass[i]) print_change(' ', &next.rs, &next.rs.items[i], 0);
+    fflush(stdout);
+
+    for (long n = 1; !watch_interrupted && (count <= 0 || n < count); n++) {
+        snapshot_free(&snap);
+        snap = next;
+        memset(&next, 0, sizeof(next));
+        PidTable t = pids;
+        pids = nextpids;
+        nextpids = t;
+        nextpids.count = 0;
+
+        struct timespec ts = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+        while (nanosleep(&ts, &ts) < 0 && errno == EINTR && !watch_interrupted) ;
+        if (watch_interrupted) {
+            // Keep the last complete snapshot
+            next = snap;
+            memset(&snap, 0, sizeof(snap));
+            break;
+        }
+
+        memset(&tick, 0, sizeof(tick));
+        t0 = now_ns();
+        tick.netns_dirty = sock_index_refresh(&idx);
+        watch_scan(pattern, search_filter, &idx, &pids, &nextpids, &snap.rs, &next, &tick);
+        exit_if_netns_stuck();
+        long long scan_ns = now_ns() - t0;
+        watch_diff(&snap, &next, &tick);
+        if (tick.opened || tick.closed || tick.changed) {
+            time_t now = time(NULL);
+            char when[16];
+            strftime(when, sizeof(when), "%H:%M:%S", localtime(&now));
+            printf("[%s] +%zu -%zu ~%zu, %zu socket(s); rescanned %zu/%zu pid(s), %d netns changed, %.1f ms\n",
+                   when, tick.opened, tick.closed, tick.changed, snapshot_visible(&next),
+                   tick.rescanned, tick.pids, tick.netns_dirty, scan_ns / 1e6);
+        }
+        fflush(stdout);
+    }
+    sigaction(SIGINT, &oldsa, NULL);
+
+    // The visible part of the last snapshot becomes the search results
+    size_t kept = 0;
+    for (size_t i = 0; i < next.rs.count; i++)
+        if (next.pass[i]) next.rs.items[kept++] = next.rs.items[i];
+    next.rs.count = kept;
+    selected_fd = -1;
+    result_store_free(&results);
+    results = next.rs;
+    free(next.pass);
+    snapshot_free(&snap);
+    printf("Watch stopped. ");
+    print_results();
+    free(pids.items);
+    free(nextpids.items);
+    sock_index_free(&idx);
+}
+
+// A warm, unfiltered snapshot of every socket for long-running users (the
+// daemon): each update is a watch tick, so only pids whose fd set changed
+// and namespaces whose tables changed cost a rescan.
+struct WatchCache {
+    SockIndex idx;
+    PidTable pids, spare;
+    Snapshot snap;
+};
+
+WatchCache *watch_cache_new(int backend) {
+    WatchCache *c = calloc(1, sizeof(WatchCache));
+    if (!c) return NULL;
+    sock_index_init(&c->idx, backend);
+    c->idx.track = 1;
+    return c;
+}
+
+void watch_cache_update(WatchCache *c, WatchTick *tick) {
+    memset(tick, 0, sizeof(*tick));
+    tick->netns_dirty = sock_index_refresh(&c->idx);
+    Snapshot next = { 0 };
+    c->spare.count = 0;
+    watch_scan(NULL, NULL, &c->idx, &c->pids, &c->spare, &c->snap.rs, &next, tick);
+    snapshot_free(&c->snap);
+    c->snap = next;
+    PidTable t = c->pids;
+    c->pids = c->spare;
+    c->spare = t;
+}
+
+// Read tcp_info from now on (a filter compares it), 1 if it wasn't:
+// namespaces loaded without it are reloaded by the next update
+int watch_cache_want_tcpinfo(WatchCache *c) {
+    if (c->idx.want_tcpinfo) return 0;
+    c->idx.want_tcpinfo = 1;
+    return 1;
+}
+
+// Sorted by (pid, fd), valid until the next update
+const ResultStore *watch_cache_results(const WatchCache *c) {
+    return &c->snap.rs;
+}
+
+// Namespace tables pid's sockets were resolved in, NULL when it has none
+const NetnsIndex *watch_cache_netns(const WatchCache *c, pid_t pid) {
+    const PidState *st = pid_table_find(&c->pids, pid);
+    return st ? st->ns : NULL;
+}
+
+size_t watch_cache_pids(const WatchCache *c) {
+    return c->pids.count;
+}
+
+void watch_cache_free(WatchCache *c) {
+    if (!c) return;
+    snapshot_free(&c->snap);
+    free(c->pids.items);
+    free(c->spare.items);
+    sock_index_free(&c->idx);
+    free(c);
+}
@@ -0,0 +1,416 @@
+#define _GNU_SOURCE
+#include "jinsock.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+// Bulk transfer loops between the duplicated socket and files.
+// The duplicate shares its file description with the target, so it may be
+// non-blocking: every loop copes with EAGAIN by polling, and with short
+// writes by resubmitting the remainder.
+
+#define XFER_CHUNK (1 << 20)            // bytes per sendfile/splice call
+#define XFER_COPY_BUF (256 * 1024)      // fallback copy buffer
+
+// Wait for events on fd; 0 when ready, -1 on timeout (errno ETIMEDOUT) or error
+int wait_fd(int fd, short events, int timeout_ms) {
+    struct pollfd pfd = { .fd = fd, .events = events };
+    while (1) {
+        long long t0 = prof_begin();
+        int rv = poll(&pfd, 1, timeout_ms);
+        prof_end(PROF_POLL, t0, 0);
+        if (rv > 0) return 0;
+        if (rv == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (errno != EINTR) return -1;
+    }
+}
+
+// The peer not reading for a whole receive timeout counts as a stall
+static int wait_writable(int sockfd) {
+    return wait_fd(sockfd, POLLOUT, recv_timeout_ms);
+}
+
+// Write all of buf to a socket or file, retrying short and would-block writes
+ssize_t write_all(int fd, const void *buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        long long t0 = prof_begin();
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        prof_end(PROF_WRITE, t0, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && wait_writable(fd) == 0) continue;
+            return -1;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// sendfile(2) a regular file. Returns bytes sent, -1 on error, or
+// XFER_UNSUPPORTED when the kernel refuses before anything was sent.
+static ssize_t xfer_sendfile(int sockfd, int f, off_t size) {
+    off_t offset = 0;
+    while (offset < size) {
+        size_t want = size - offset < XFER_CHUNK ? size - offset : XFER_CHUNK;
+        long long t0 = prof_begin();
+        ssize_t n = sendfile(sockfd, f, &offset, want);
+        prof_end(PROF_SENDFILE, t0, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && wait_writable(sockfd) == 0) continue;
+            if (offset == 0 && (errno == EINVAL || errno == ENOSYS)) return XFER_UNSUPPORTED;
+            return -1;
+        }
+        if (n == 0) break; // file shrank under us
+    }
+    return offset;
+}
+
+// Move everything readable from pipe end pin to out. No SPLICE_F_MORE:
+// the kernel already sets MSG_MORE while the pipe holds more than one
+// write takes, and the last piece must not wait for the cork timer.
+static ssize_t splice_drain(int pin, int out, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        long long t0 = prof_begin();
+        ssize_t n = splice(pin, NULL, out, NULL, len - done, SPLICE_F_MOVE);
+        prof_end(PROF_SPLICE, t0, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN && wait_writable(out) == 0) continue;
+            return -1;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// splice(2) a pipe/FIFO (directly) or any other fd (through a pipe) into
+// the socket until EOF. Same return convention as xfer_sendfile.
+static ssize_t xfer_splice(int sockfd, int f, int f_is_pipe) {
+    int pipefd[2] = {-1, -1};
+    if (!f_is_pipe) {
+        if (pipe2(pipefd, O_CLOEXEC) < 0) return XFER_UNSUPPORTED;
+        fcntl(pipefd[1], F_SETPIPE_SZ, XFER_CHUNK);
+    }
+    ssize_t total = 0;
+    while (1) {
+        ssize_t n;
+        long long t0 = prof_begin();
+        // Straight from a pipe there is no telling whether more will come:
+        // no SPLICE_F_MORE there either
+        if (f_is_pipe)
+            n = splice(f, NULL, sockfd, NULL, XFER_CHUNK, SPLICE_F_MOVE);
+        else
+            n = splice(f, NULL, pipefd[1], NULL, XFER_CHUNK, SPLICE_F_MOVE);
+        prof_end(PROF_SPLICE, t0, n);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (f_is_pipe && errno == EAGAIN && wait_writable(sockfd) == 0) continue;
+            if (total == 0 && (errno == EINVAL || errno == ENOSYS)) total = XFER_UNSUPPORTED;
+            else total = -1;
+            break;
+        }
+        if (n == 0) break;
+        if (!f_is_pipe && splice_drain(pipefd[0], sockfd, n) < 0) {
+            total = -1;
+            break;
+        }
+        total += n;
+    }
+    if (!f_is_pipe) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    return total;
+}
+
+// Plain read/write copy with a large buffer
+static ssize_t xfer_copy(int sockfd, int f) {
+    char *buf = malloc(XFER_COPY_BUF);
+    if (!buf) return -1;
+    ssize_t total = 0;
+    while (1) {
+        ssize_t n = read(f, buf, XFER_COPY_BUF);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            total = -1;
+            break;
+        }
+        if (n == 0) break;
+        if (write_all(sockfd, buf, n) < 0) {
+            total = -1;
+            break;
+        }
+        total += n;
+    }
+    free(buf);
+    return total;
+}
+
+// Send the whole content of f into sockfd using the cheapest path the
+// kernel accepts: sendfile for regular files, splice for everything else,
+// and a buffered copy when neither is allowed.
+ssize_t xfer_file_to_socket(int sockfd, int f) {
+    struct stat st;
+    if (fstat(f, &st) < 0) return -1;
+    ssize_t sent;
+    if (S_ISREG(st.st_mode))
+        sent = xfer_sendfile(sockfd, f, st.st_size);
+    else
+        sent = xfer_splice(sockfd, f, S_ISFIFO(st.st_mode));
+    if (sent == XFER_UNSUPPORTED) sent = xfer_copy(sockfd, f);
+    return sent;
+}
+
+void print_throughput(const char *what, long long bytes, long long elapsed_ns) {
+    double secs = elapsed_ns / 1e9;
+    double rate = secs > 0 ? bytes / secs : 0;
+    const char *unit = "B/s";
+    if (rate >= 1e9) { rate /= 1e9; unit = "GB/s"; }
+    else if (rate >= 1e6) { rate /= 1e6; unit = "MB/s"; }
+    else if (rate >= 1e3) { rate /= 1e3; unit = "kB/s"; }
+    printf("%s %lld bytes in %.3f s (%.2f %s)\n", what, bytes, secs, rate, unit);
+}
+
+// Capture sink for rec: socket -> file or stdout.
+// Regular files are fed by splice (socket -> pipe -> file) so the payload
+// never enters userspace; everything else gets large reads gathered in a
+// userspace buffer. Flushing and fsync follow rec_flush / rec_fsync.
+// Recording sinks (record.c) put a RecChunk in front of every chunk, so
+// they always take the buffered path.
+
+#define SINK_BUF (1 << 20)
+
+int recv_sink_open(RecvSink *s, const char *outfile) {
+    memset(s, 0, sizeof(*s));
+    s->pipefd[0] = s->pipefd[1] = -1;
+    if (rec_ring_count) return recv_ring_open(s, outfile);
+    if (outfile) {
+        s->outfd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (s->outfd < 0) {
+            perror("open output");
+            return -1;
+        }
+    } else {
+        fflush(stdout); // keep earlier printf output ahead of the payload
+        s->outfd = STDOUT_FILENO;
+    }
+    struct stat st;
+    s->is_file = fstat(s->outfd, &st) == 0 && S_ISREG(st.st_mode);
+    s->flush_each = rec_flush == FLUSH_CHUNK || (rec_flush == FLUSH_AUTO && !s->is_file);
+    if (s->is_file && pipe2(s->pipefd, O_CLOEXEC) == 0) {
+        fcntl(s->pipefd[1], F_SETPIPE_SZ, SINK_BUF);
+    } else {
+        s->pipefd[0] = s->pipefd[1] = -1;
+    }
+    s->buf = malloc(SINK_BUF);
+    s->bufcap = SINK_BUF;
+    if (!s->buf) {
+        recv_sink_close(s);
+        return -1;
+    }
+    return 0;
+}
+
+static int recv_sink_flush(RecvSink *s) {
+    if (s->buflen == 0) return 0;
+    if (s->ring) return recv_ring_publish(s);
+    if (write_all(s->outfd, s->buf, s->buflen) < 0) return -1;
+    s->buflen = 0;
+    return 0;
+}
+
+static void recv_sink_account(RecvSink *s, size_t n) {
+    s->total += n;
+    if (rec_fsync > 0 && s->is_file) {
+        s->unsynced += n;
+        if (s->unsynced >= rec_fsync) {
+            recv_sink_flush(s);
+            fdatasync(s->outfd);
+            s->unsynced = 0;
+        }
+    }
+}
+
+// Splice what the socket has ready into the file. Returns bytes moved,
+// 0 on EOF, -1 on error, XFER_UNSUPPORTED if this socket can't be spliced.
+static ssize_t recv_sink_splice(RecvSink *s, int sockfd) {
+    long long t0 = prof_begin();
+    ssize_t n = splice(sockfd, NULL, s->pipefd[1], NULL, SINK_BUF, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    prof_end(PROF_SPLICE, t0, n);
+    if (n < 0) {
+        if (errno == EINVAL || errno == ENOSYS) return XFER_UNSUPPORTED;
+        return -1;
+    }
+    if (n > 0 && splice_drain(s->pipefd[0], s->outfd, n) < 0) return -1;
+    return n;
+}
+
+// Move whatever the socket has ready into the sink, without blocking.
+// Returns bytes moved, 0 when the peer closed, -1 on error (EAGAIN if the
+// readiness was spurious).
+ssize_t recv_sink_pull(RecvSink *s, int sockfd) {
+    ssize_t n;
+    if (s->pipefd[0] >= 0) {
+        n = recv_sink_splice(s, sockfd);
+        if (n != XFER_UNSUPPORTED) {
+            if (n > 0) recv_sink_account(s, n);
+            return n;
+        }
+        close(s->pipefd[0]);
+        close(s->pipefd[1]);
+        s->pipefd[0] = s->pipefd[1] = -1;
+    }
+    // Room for the chunk header in front of the data when recording
+    size_t hdr = s->record ? sizeof(RecChunk) : 0;
+    if (s->bufcap - s->buflen <= hdr && recv_sink_flush(s) < 0) return -1;
+    long long t0 = prof_begin();
+    n = recv(sockfd, s->buf + s->buflen + hdr, s->bufcap - s->buflen - hdr, MSG_DONTWAIT);
+    prof_end(PROF_RECV, t0, n);
+    if (n <= 0) return n;
+    if (hdr) {
+        RecChunk c;
+        recv_sink_chunk(s, &c, n);
+        memcpy(s->buf + s->buflen, &c, sizeof(c));
+    }
+    s->buflen += hdr + n;
+    if (s->flush_each && recv_sink_flush(s) < 0) return -1;
+    recv_sink_account(s, n);
+    return n;
+}
+
+static int recv_sink_append(RecvSink *s, const char *data, size_t n) {
+    if (s->buflen + n > s->bufcap && recv_sink_flush(s) < 0) return -1;
+    if (n >= s->bufcap && !s->ring) return write_all(s->outfd, data, n) < 0 ? -1 : 0;
+    // A ring only takes its own buffers: larger data is split across them
+    while (n > 0) {
+        if (s->buflen == s->bufcap && recv_sink_flush(s) < 0) return -1;
+        size_t k = n < s->bufcap - s->buflen ? n : s->bufcap - s->buflen;
+        memcpy(s->buf + s->buflen, data, k);
+        s->buflen += k;
+        data += k;
+        n -= k;
+    }
+    return 0;
+}
+
+// Write data received elsewhere (io_uring buffers, datagrams) into the sink
+int recv_sink_push(RecvSink *s, const char *data, size_t n) {
+    if (s->record) {
+        RecChunk c;
+        recv_sink_chunk(s, &c, n);
+        if (recv_sink_append(s, (const char *)&c, sizeof(c)) < 0) return -1;
+    }
+    if (recv_sink_append(s, data, n) < 0) return -1;
+    if (s->flush_each && recv_sink_flush(s) < 0) return -1;
+    recv_sink_account(s, n);
+    return 0;
+}
+
+// Framing around pushed data: written like it but not counted as received
+int recv_sink_frame(RecvSink *s, const char *data, size_t n) {
+    return recv_sink_append(s, data, n);
+}
+
+int recv_sink_close(RecvSink *s) {
+    int ret = 0;
+    if (s->ring) return recv_ring_close(s);
+    if (s->record && s->outfd >= 0 && recv_sink_finish_record(s) < 0) ret = -1;
+    if (s->outfd >= 0 && recv_sink_flush(s) < 0) {
+        perror("write output");
+        ret = -1;
+    }
+    if (s->is_file && rec_fsync != 0 && fdatasync(s->outfd) < 0) ret = -1;
+    if (s->outfd > STDERR_FILENO) close(s->outfd);
+    if (s->pipefd[0] >= 0) close(s->pipefd[0]);
+    if (s->pipefd[1] >= 0) close(s->pipefd[1]);
+    free(s->buf);
+    free(s->rec_index);
+    s->buf = NULL;
+    s->rec_index = NULL;
+    s->outfd = -1;
+    return ret;
+}
+
+int parse_flush_mode(const char *name) {
+    if (strcmp(name, "auto") == 0) return FLUSH_AUTO;
+    if (strcmp(name, "chunk") == 0) return FLUSH_CHUNK;
+    if (strcmp(name, "end") == 0) return FLUSH_END;
+    return -1;
+}
+
+// "none" = never, "close" = once at the end, otherwise a byte interval
+// with optional k/M/G suffix
+int parse_fsync_mode(const char *arg, long long *out) {
+    if (strcmp(arg, "none") == 0) {
+        *out = 0;
+        return 0;
+    }
+    if (strcmp(arg, "close") == 0) {
+        *out = FSYNC_CLOSE;
+        return 0;
+    }
+    return parse_size(arg, out);
+}
+
+// Size with optional k/M/G (powers of 1024) suffix, must be > 0
+int parse_size(const char *arg, long long *out) {
+    char *end;
+    double v = strtod(arg, &end);
+    // strtod takes "nan" and "inf" too
+    if (end == arg || !(v > 0) || !isfinite(v)) return -1;
+    switch (*end) {
+        case 'k': case 'K': v *= 1024; end++; break;
+        case 'm': case 'M': v *= 1024 * 1024; end++; break;
+        case 'g': case 'G': v *= 1024.0 * 1024 * 1024; end++; break;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end || v >= 9223372036854775807.0) return -1;
+    *out = (long long)v;
+    return 0;
+}
+
+// Like parse_timeout_ms, but a bare number is milliseconds
+int parse_interval_ms(const char *arg, int *out) {
+    char *end;
+    long v = strtol(arg, &end, 10);
+    if (end != arg && *end == 0) {
+        if (v < 1 || v > 2147483647L) return -1;
+        *out = (int)v;
+        return 0;
+    }
+    return parse_timeout_ms(arg, out);
+}
+
+// "250ms", "1.5s" or a bare number of seconds (the historical unit)
+int parse_timeout_ms(const char *arg, int *out) {
+    char *end;
+    double v = strtod(arg, &end);
+    if (end == arg) return -1;
+    if (strcmp(end, "ms") != 0) {
+        if (*end && strcmp(end, "s") != 0) return -1;
+        v *= 1000;
+    }
+    // !(v >= 1) also rejects the NaN strtod accepts
+    if (!(v >= 1) || v > 2147483647.0) return -1;
+    *out = (int)v;
+    return 0;
+}
+
+void format_timeout(int ms, char *buf, size_t buflen) {
+    if (ms % 1000 == 0) snprintf(buf, buflen, "%d seconds", ms / 1000);
+    else snprintf(buf, buflen, "%d ms", ms);
+}